@@ -4,20 +4,113 @@
 
 using namespace articuno::ryml;
 
-const Config& Config::GetSingleton() noexcept {
-    static Config instance;
+namespace {
+    std::string_view Trim(std::string_view value) {
+        auto begin = value.find_first_not_of(" \t");
+        if (begin == std::string_view::npos) {
+            return {};
+        }
+        return value.substr(begin, value.find_last_not_of(" \t") - begin + 1);
+    }
+
+    Config& GetInstance() noexcept {
+        static Config instance;
+        return instance;
+    }
+}
+
+Config Config::Load() {
+    Config config;
+    std::ifstream inputFile(R"(Data\SKSE\Plugins\AlchemyReworked.yaml)");
+    if (inputFile.good()) {
+        yaml_source ar(inputFile);
+        ar >> config;
+    }
+    config.Compile();
+    return config;
+}
 
+const Config& Config::GetSingleton() noexcept {
     static std::atomic_bool initialized;
     static std::latch latch(1);
     if (!initialized.exchange(true)) {
-        std::ifstream inputFile(R"(Data\SKSE\Plugins\AlchemyReworked.yaml)");
-        if (inputFile.good()) {
-            yaml_source ar(inputFile);
-            ar >> instance;
-        }
+        GetInstance() = Load();
         latch.count_down();
     }
     latch.wait();
 
-    return instance;
+    return GetInstance();
+}
+
+Config Config::Reload() {
+    auto loaded = Load();
+    std::swap(GetInstance(), loaded);
+    return loaded;
+}
+
+void Config::Restore(Config previous) { GetInstance() = std::move(previous); }
+
+void Config::Compile() {
+    _rules = {};
+    _errors.clear();
+    auto parseForm = [this](std::string_view value, std::string_view key) {
+        if (Trim(value).empty()) {
+            return FormRef{};
+        }
+        auto ref = AlchemyPlanner::ParseFormRef(value);
+        if (!ref) {
+            _errors.push_back(std::format("{}: expected Plugin|FormID, got '{}'", key, value));
+            return FormRef{};
+        }
+        return *ref;
+    };
+
+    AlchemyPlanner::CraftingRulesText text;
+    text.rarityNames = _rarities_config.names;
+    text.raritySuffixes = _rarities_config.suffixes;
+    text.rarityKeywords = _rarities_config.keywords;
+    text.defaultRarity = _rarities_config.defaultRarity;
+    text.levelCount = _cobj_config.levelCount;
+    text.levelRecipes = _cobj_config.levelRecipes;
+    text.level3Alt = _cobj_config.level3RecipeAlt;
+    text.levelKeywords = _cobj_config.levelKeywords;
+    text.threeIngredientRecipes = _cobj_config.threeIngredientRecipes;
+    text.maxTriplesPerEffect = _cobj_config.maxTriplesPerEffect;
+    text.levelTriples = _cobj_config.levelTriples;
+    static_cast<AlchemyPlanner::CraftingRules&>(_rules) = AlchemyPlanner::CompileCraftingRules(text, _errors);
+
+    // the first three tiers are the old common, uncommon and rare ones, a suffix the rarities section sets wins
+    const auto& legacySuffixes = _ingr_config.legacySuffixes;
+    for (std::size_t i = 0; i < legacySuffixes.size(); i++) {
+        if (!legacySuffixes[i]) {
+            continue;
+        }
+        auto key = IngredientsConfig::kLegacySuffixKeys[i];
+        if (i >= _rules.rarities.size()) {
+            _errors.push_back(std::format("ingredients.{}: deprecated and ignored, there is no rarity{}", key, i + 1));
+        } else if (_rarities_config.suffixesSet[i]) {
+            _errors.push_back(std::format("ingredients.{}: deprecated and ignored, rarities.rarity{}Suffix is used",
+                                          key, i + 1));
+        } else {
+            _rules.rarities[i].suffix = *legacySuffixes[i];
+            _errors.push_back(
+                std::format("ingredients.{}: deprecated, applied as rarities.rarity{}Suffix", key, i + 1));
+        }
+    }
+
+    // perks unlocking the potion levels
+    const auto levelCount = _rules.levelKeywords.size();
+    _rules.levelPerks.resize(levelCount);
+    for (std::size_t level = 2; level <= levelCount; level++) {
+        auto perkKey = std::format("perks.level{}", level);
+        _rules.levelPerks[level - 1] = parseForm(_perks_config.levelPerks[level - 1], perkKey);
+        if (!_rules.levelPerks[level - 1].IsSet() && Trim(_perks_config.levelPerks[level - 1]).empty()) {
+            _errors.push_back(std::format("{}: required to unlock level {} potions", perkKey, level));
+        }
+    }
+
+    _rules.potionQualityPerk = parseForm(_perks_config.potionQualityPerk, "perks.potionQuality");
+    _rules.poisonQualityPerk = parseForm(_perks_config.poisonQualityPerk, "perks.poisonQuality");
+    _rules.allQualityPerk = parseForm(_perks_config.allQualityPerk, "perks.allQuality");
+    _rules.doubleItemsPerk = parseForm(_perks_config.doubleItemsPerk, "perks.doubleItems");
 }
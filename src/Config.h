@@ -3,85 +3,141 @@
 #include <SKSE/SKSE.h>
 #include <articuno/articuno.h>
 
+#include "Planner/CraftingRules.h"
+#include "Planner/Planner.h"
+
 class Debug {
 public:
     [[nodiscard]] inline spdlog::level::level_enum GetLogLevel() const noexcept { return _logLevel; }
 
     [[nodiscard]] inline spdlog::level::level_enum GetFlushLevel() const noexcept { return _flushLevel; }
 
+    // Log every ingredient, potion, recipe and workbench access instead of aggregated summaries
+    [[nodiscard]] inline bool IsVerbose() const noexcept { return _verbose; }
+
+    // Messages buffered for the background log writer, the oldest ones are dropped when it can't keep up. Warnings
+    // and errors don't go through it. Debug and trace lines come in bursts, at those levels the queue is
+    // kDebugQueueFactor times the configured size.
+    [[nodiscard]] inline std::size_t GetLogQueueSize() const noexcept {
+        return _logLevel <= spdlog::level::level_enum::debug ? _logQueueSize * kDebugQueueFactor : _logQueueSize;
+    }
+
 private:
     articuno_serialize(ar) {
         auto logLevel = spdlog::level::to_string_view(_logLevel);
         auto flushLevel = spdlog::level::to_string_view(_flushLevel);
+        auto logQueueSize = std::to_string(_logQueueSize);
         ar <=> articuno::kv(logLevel, "logLevel");
         ar <=> articuno::kv(flushLevel, "flushLevel");
+        ar <=> articuno::kv(_verbose, "verbose");
+        ar <=> articuno::kv(logQueueSize, "logQueueSize");
     }
 
     articuno_deserialize(ar) {
         *this = Debug();
         std::string logLevel;
         std::string flushLevel;
+        std::string verbose;
+        std::string logQueueSize;
         if (ar <=> articuno::kv(logLevel, "logLevel")) {
             _logLevel = spdlog::level::from_str(logLevel);
         }
         if (ar <=> articuno::kv(flushLevel, "flushLevel")) {
             _flushLevel = spdlog::level::from_str(flushLevel);
         }
+        if (ar <=> articuno::kv(verbose, "verbose")) {
+            _verbose = verbose == "true" || verbose == "1";
+        }
+        if (ar <=> articuno::kv(logQueueSize, "logQueueSize")) {
+            _logQueueSize = std::max<std::size_t>(std::strtoull(logQueueSize.c_str(), nullptr, 10), 128);
+        }
     }
 
     spdlog::level::level_enum _logLevel{spdlog::level::level_enum::info};
-    spdlog::level::level_enum _flushLevel{spdlog::level::level_enum::trace};
+    spdlog::level::level_enum _flushLevel{spdlog::level::level_enum::warn};
+    bool _verbose = false;
+    std::size_t _logQueueSize = 8192;
+    static constexpr std::size_t kDebugQueueFactor = 8;
 
     friend class articuno::access;
 };
 
+// "Plugin|FormID" of a form, parsed when the config is loaded and looked up once the game data is loaded
+using FormRef = AlchemyPlanner::FormRef;
+
 class CobjConfig {
 public:
+    // Number of potion levels, every level needs a level keyword, a perk (from level2 on) and a recipe rule
+    int levelCount = AlchemyPlanner::kDefaultTierCount;
     // Not initialized by default since it would revert to def value if empty in config (can be intended someone might
-    // want to disable few levels)
-    std::string level1Recipe;     // = "common|common";
-    std::string level2Recipe;     // = "common|uncommon";
-    std::string level3Recipe;     // = "common|rare";
-    std::string level3RecipeAlt;  // = "uncommon|uncommon";
-    std::string level4Recipe;     // = "uncommon|rare";
-    std::string level5Recipe;     // = "rare|rare";
+    // want to disable few levels). Comma separated rarity pairs per level, level1 at [0]:
+    // common|common, common|uncommon, common|rare + uncommon|uncommon, uncommon|rare, rare|rare
+    std::vector<std::string> levelRecipes = std::vector<std::string>(AlchemyPlanner::kMaxTiers);
+    // Older configs list the second level3 pair here, it is added to the level3 rules
+    std::string level3RecipeAlt;
+    // "Plugin|FormID" of the keyword marking potions of a level, level1 at [0]. Empty entries use
+    // AlchemyReworked.esp 0x801-0x805, later levels must name their keyword.
+    std::vector<std::string> levelKeywords = std::vector<std::string>(AlchemyPlanner::kMaxTiers);
+    // Three ingredient recipes are only planned when enabled, their count grows with the cube of the load order
+    bool threeIngredientRecipes = false;
+    // Cap of three ingredient recipes per effect signature and level
+    int maxTriplesPerEffect = 50;
+    // Comma separated rarity triples per level (rarity|rarity|rarity), level1 at [0]
+    std::vector<std::string> levelTriples = std::vector<std::string>(AlchemyPlanner::kMaxTiers);
 
 private:
     articuno_serialize(ar) {
-        ar <=> articuno::kv(level1Recipe, "level1");
-        ar <=> articuno::kv(level2Recipe, "level2");
-        ar <=> articuno::kv(level3Recipe, "level3");
-        ar <=> articuno::kv(level3RecipeAlt, "level3Alt");
-        ar <=> articuno::kv(level4Recipe, "level4");
-        ar <=> articuno::kv(level5Recipe, "level5");
+        auto _levelCount = std::to_string(levelCount);
+        auto _threeIngredientRecipes = std::string(threeIngredientRecipes ? "true" : "false");
+        auto _maxTriplesPerEffect = std::to_string(maxTriplesPerEffect);
+        ar <=> articuno::kv(_levelCount, "levels");
+        for (int level = 1; level <= levelCount; level++) {
+            auto key = "level" + std::to_string(level);
+            auto keywordKey = key + "Keyword";
+            auto triplesKey = key + "Triples";
+            ar <=> articuno::kv(levelRecipes[level - 1], key.c_str());
+            ar <=> articuno::kv(levelKeywords[level - 1], keywordKey.c_str());
+            ar <=> articuno::kv(levelTriples[level - 1], triplesKey.c_str());
+        }
+        ar <=> articuno::kv(_threeIngredientRecipes, "threeIngredientRecipes");
+        ar <=> articuno::kv(_maxTriplesPerEffect, "maxTriplesPerEffect");
     }
 
     articuno_deserialize(ar) {
         *this = CobjConfig();
-        std::string _level1Recipe;
-        std::string _level2Recipe;
-        std::string _level3Recipe;
+        std::string _levelCount;
         std::string _level3RecipeAlt;
-        std::string _level4Recipe;
-        std::string _level5Recipe;
+        std::string _threeIngredientRecipes;
+        std::string _maxTriplesPerEffect;
 
-        if (ar <=> articuno::kv(_level1Recipe, "level1")) {
-            level1Recipe = _level1Recipe;
-        }
-        if (ar <=> articuno::kv(_level2Recipe, "level2")) {
-            level2Recipe = _level2Recipe;
+        if (ar <=> articuno::kv(_levelCount, "levels")) {
+            levelCount = std::clamp(std::atoi(_levelCount.c_str()), 1, AlchemyPlanner::kMaxTiers);
         }
-        if (ar <=> articuno::kv(_level3Recipe, "level3")) {
-            level3Recipe = _level3Recipe;
+        for (int level = 1; level <= AlchemyPlanner::kMaxTiers; level++) {
+            auto key = "level" + std::to_string(level);
+            auto keywordKey = key + "Keyword";
+            auto triplesKey = key + "Triples";
+            std::string _recipe;
+            std::string _keyword;
+            std::string _triples;
+            if (ar <=> articuno::kv(_recipe, key.c_str())) {
+                levelRecipes[level - 1] = _recipe;
+            }
+            if (ar <=> articuno::kv(_keyword, keywordKey.c_str())) {
+                levelKeywords[level - 1] = _keyword;
+            }
+            if (ar <=> articuno::kv(_triples, triplesKey.c_str())) {
+                levelTriples[level - 1] = _triples;
+            }
         }
         if (ar <=> articuno::kv(_level3RecipeAlt, "level3Alt")) {
             level3RecipeAlt = _level3RecipeAlt;
         }
-        if (ar <=> articuno::kv(_level4Recipe, "level4")) {
-            level4Recipe = _level4Recipe;
+        if (ar <=> articuno::kv(_threeIngredientRecipes, "threeIngredientRecipes")) {
+            threeIngredientRecipes = _threeIngredientRecipes == "true" || _threeIngredientRecipes == "1";
         }
-        if (ar <=> articuno::kv(_level5Recipe, "level5")) {
-            level5Recipe = _level5Recipe;
+        if (ar <=> articuno::kv(_maxTriplesPerEffect, "maxTriplesPerEffect")) {
+            maxTriplesPerEffect = std::max(std::atoi(_maxTriplesPerEffect.c_str()), 0);
         }
     }
     friend class articuno::access;
@@ -90,36 +146,91 @@ private:
 class IngredientsConfig {
 public:
     bool renameIngredients = true;
-    std::string commonSuffix = "(Common)";
-    std::string uncommonSuffix = "(Uncommon)";
-    std::string rareSuffix = "(Rare)";
+    // commonSuffix, uncommonSuffix and rareSuffix from before rarity tiers were configurable, they map onto
+    // rarity1Suffix to rarity3Suffix. Unset if the config doesn't have the key.
+    std::array<std::optional<std::string>, 3> legacySuffixes;
+
+    static constexpr std::array<const char*, 3> kLegacySuffixKeys = {"commonSuffix", "uncommonSuffix", "rareSuffix"};
 
 private:
-    articuno_serialize(ar) {
-        ar <=> articuno::kv(renameIngredients, "addRaritySuffix");
-        ar <=> articuno::kv(commonSuffix, "commonSuffix");
-        ar <=> articuno::kv(uncommonSuffix, "uncommonSuffix");
-        ar <=> articuno::kv(rareSuffix, "rareSuffix");
-    }
+    articuno_serialize(ar) { ar <=> articuno::kv(renameIngredients, "addRaritySuffix"); }
 
     articuno_deserialize(ar) {
         *this = IngredientsConfig();
         std::string _renameIngr;
-        std::string _commonSuffix;
-        std::string _uncommonSuffix;
-        std::string _rareSuffix;
 
         if (ar <=> articuno::kv(_renameIngr, "addRaritySuffix")) {
             renameIngredients = _renameIngr == "true" || _renameIngr == "1";
         }
-        if (ar <=> articuno::kv(_commonSuffix, "commonSuffix")) {
-            commonSuffix = _commonSuffix;
+        for (std::size_t i = 0; i < kLegacySuffixKeys.size(); i++) {
+            std::string _suffix;
+            if (ar <=> articuno::kv(_suffix, kLegacySuffixKeys[i])) {
+                legacySuffixes[i] = _suffix;
+            }
+        }
+    }
+    friend class articuno::access;
+};
+
+class RaritiesConfig {
+public:
+    // Rarity tiers in order (rarity1 at [0]), an ingredient gets the first tier it has a keyword of. Keywords are
+    // comma separated "Plugin|FormID" entries.
+    std::vector<std::string> names = {"common", "uncommon", "rare"};
+    std::vector<std::string> suffixes = {"(Common)", "(Uncommon)", "(Rare)"};
+    std::vector<std::string> keywords = {"AlchemyReworked.esp|806", "AlchemyReworked.esp|807",
+                                         "AlchemyReworked.esp|808"};
+    // Tier of ingredients without any rarity keyword
+    std::string defaultRarity = "uncommon";
+    // rarityNSuffix was in the config, indexed like suffixes. The default tiers have none set.
+    std::vector<bool> suffixesSet = std::vector<bool>(3);
+
+private:
+    articuno_serialize(ar) {
+        for (std::size_t i = 0; i < names.size(); i++) {
+            auto key = "rarity" + std::to_string(i + 1);
+            auto suffixKey = key + "Suffix";
+            auto keywordsKey = key + "Keywords";
+            ar <=> articuno::kv(names[i], key.c_str());
+            ar <=> articuno::kv(suffixes[i], suffixKey.c_str());
+            ar <=> articuno::kv(keywords[i], keywordsKey.c_str());
+        }
+        ar <=> articuno::kv(defaultRarity, "default");
+    }
+
+    articuno_deserialize(ar) {
+        *this = RaritiesConfig();
+        std::vector<std::string> _names;
+        std::vector<std::string> _suffixes;
+        std::vector<std::string> _keywords;
+        std::vector<bool> _suffixesSet;
+        std::string _defaultRarity;
+
+        // tiers are numbered without gaps, the first missing one ends the list
+        for (std::size_t i = 0; i < AlchemyPlanner::kMaxRarities; i++) {
+            auto key = "rarity" + std::to_string(i + 1);
+            auto suffixKey = key + "Suffix";
+            auto keywordsKey = key + "Keywords";
+            std::string _name;
+            std::string _suffix;
+            std::string _keyword;
+            if (!(ar <=> articuno::kv(_name, key.c_str()))) {
+                break;
+            }
+            _suffixesSet.push_back(static_cast<bool>(ar <=> articuno::kv(_suffix, suffixKey.c_str())));
+            ar <=> articuno::kv(_keyword, keywordsKey.c_str());
+            _names.push_back(_name);
+            _suffixes.push_back(_suffix);
+            _keywords.push_back(_keyword);
         }
-        if (ar <=> articuno::kv(_uncommonSuffix, "uncommonSuffix")) {
-            uncommonSuffix = _uncommonSuffix;
+        if (!_names.empty()) {
+            names = std::move(_names);
+            suffixes = std::move(_suffixes);
+            keywords = std::move(_keywords);
+            suffixesSet = std::move(_suffixesSet);
         }
-        if (ar <=> articuno::kv(_rareSuffix, "rareSuffix")) {
-            rareSuffix = _rareSuffix;
+        if (ar <=> articuno::kv(_defaultRarity, "default")) {
+            defaultRarity = _defaultRarity;
         }
     }
     friend class articuno::access;
@@ -127,10 +238,8 @@ private:
 
 class PerksConfig {
 public:
-    std::string level2Perk;
-    std::string level3Perk;
-    std::string level4Perk;
-    std::string level5Perk;
+    // "Plugin|FormID" of the perk unlocking each level, level1 at [0] needs no perk and stays empty
+    std::vector<std::string> levelPerks = std::vector<std::string>(AlchemyPlanner::kMaxTiers);
     std::string potionQualityPerk;
     std::string poisonQualityPerk;
     std::string allQualityPerk;
@@ -138,10 +247,12 @@ public:
 
 private:
     articuno_serialize(ar) {
-        ar <=> articuno::kv(level2Perk, "level2");
-        ar <=> articuno::kv(level3Perk, "level3");
-        ar <=> articuno::kv(level4Perk, "level4");
-        ar <=> articuno::kv(level5Perk, "level5");
+        for (int level = 2; level <= AlchemyPlanner::kMaxTiers; level++) {
+            if (!levelPerks[level - 1].empty()) {
+                auto key = "level" + std::to_string(level);
+                ar <=> articuno::kv(levelPerks[level - 1], key.c_str());
+            }
+        }
         ar <=> articuno::kv(potionQualityPerk, "potionQuality");
         ar <=> articuno::kv(poisonQualityPerk, "poisonQuality");
         ar <=> articuno::kv(allQualityPerk, "allQuality");
@@ -150,26 +261,17 @@ private:
 
     articuno_deserialize(ar) {
         *this = PerksConfig();
-        std::string _level2Perk;
-        std::string _level3Perk;
-        std::string _level4Perk;
-        std::string _level5Perk;
         std::string _potionQualityPerk;
         std::string _poisonQualityPerk;
         std::string _allQualityPerk;
         std::string _doubleItemsPerk;
 
-        if (ar <=> articuno::kv(_level2Perk, "level2")) {
-            level2Perk = _level2Perk;
-        }
-        if (ar <=> articuno::kv(_level3Perk, "level3")) {
-            level3Perk = _level3Perk;
-        }
-        if (ar <=> articuno::kv(_level4Perk, "level4")) {
-            level4Perk = _level4Perk;
-        }
-        if (ar <=> articuno::kv(_level5Perk, "level5")) {
-            level5Perk = _level5Perk;
+        for (int level = 2; level <= AlchemyPlanner::kMaxTiers; level++) {
+            auto key = "level" + std::to_string(level);
+            std::string _levelPerk;
+            if (ar <=> articuno::kv(_levelPerk, key.c_str())) {
+                levelPerks[level - 1] = _levelPerk;
+            }
         }
         if (ar <=> articuno::kv(_potionQualityPerk, "potionQuality")) {
             potionQualityPerk = _potionQualityPerk;
@@ -188,27 +290,133 @@ private:
     friend class articuno::access;
 };
 
+class PerformanceConfig {
+public:
+    // Threads used to plan recipes, 0 = one per hardware thread, 1 = plan on the calling thread only
+    unsigned workerThreads = 0;
+    // Plan recipes on a background thread once KID is done instead of blocking the callback
+    bool asyncInitialization = true;
+    // Reuse the recipes planned on the previous start while the load order and crafting rules stay the same
+    bool planCache = true;
+    // Create a fixed pool of COBJs bound to the recipes craftable from the inventory on workbench enter instead of
+    // one COBJ per planned recipe
+    bool recipePool = false;
+    // COBJs in the pool, the most recipes shown at once in pool mode
+    unsigned recipePoolSize = 1024;
+    // Load the plan AlchemyPlanCompiler built for this load order (AlchemyReworked.plan) instead of planning, planning
+    // still happens if the plan is missing or was built for other records, rules or plugin version
+    bool prebuiltPlan = false;
+    // Write the alchemy records and keywords of the load order to AlchemyReworked.loadorder.tsv on startup, the input
+    // of AlchemyPlanCompiler
+    bool exportLoadOrder = false;
+    // Start planning when the game data is loaded, from the keywords the KID inis in Data are predicted to distribute.
+    // Once KID is done the plan is reconciled with the keywords records really have, mismatches are planned again
+    bool earlyPlanning = true;
+
+private:
+    articuno_serialize(ar) {
+        auto _workerThreads = std::to_string(workerThreads);
+        auto _recipePoolSize = std::to_string(recipePoolSize);
+        ar <=> articuno::kv(_workerThreads, "workerThreads");
+        ar <=> articuno::kv(asyncInitialization, "asyncInitialization");
+        ar <=> articuno::kv(planCache, "planCache");
+        ar <=> articuno::kv(recipePool, "recipePool");
+        ar <=> articuno::kv(_recipePoolSize, "recipePoolSize");
+        ar <=> articuno::kv(prebuiltPlan, "prebuiltPlan");
+        ar <=> articuno::kv(exportLoadOrder, "exportLoadOrder");
+        ar <=> articuno::kv(earlyPlanning, "earlyPlanning");
+    }
+
+    articuno_deserialize(ar) {
+        *this = PerformanceConfig();
+        std::string _workerThreads;
+        std::string _asyncInitialization;
+        std::string _planCache;
+        std::string _recipePool;
+        std::string _recipePoolSize;
+        std::string _prebuiltPlan;
+        std::string _exportLoadOrder;
+        std::string _earlyPlanning;
+
+        if (ar <=> articuno::kv(_workerThreads, "workerThreads")) {
+            workerThreads = static_cast<unsigned>(std::strtoul(_workerThreads.c_str(), nullptr, 10));
+        }
+        if (ar <=> articuno::kv(_asyncInitialization, "asyncInitialization")) {
+            asyncInitialization = _asyncInitialization == "true" || _asyncInitialization == "1";
+        }
+        if (ar <=> articuno::kv(_planCache, "planCache")) {
+            planCache = _planCache == "true" || _planCache == "1";
+        }
+        if (ar <=> articuno::kv(_recipePool, "recipePool")) {
+            recipePool = _recipePool == "true" || _recipePool == "1";
+        }
+        if (ar <=> articuno::kv(_recipePoolSize, "recipePoolSize")) {
+            recipePoolSize = std::max(static_cast<unsigned>(std::strtoul(_recipePoolSize.c_str(), nullptr, 10)), 1u);
+        }
+        if (ar <=> articuno::kv(_prebuiltPlan, "prebuiltPlan")) {
+            prebuiltPlan = _prebuiltPlan == "true" || _prebuiltPlan == "1";
+        }
+        if (ar <=> articuno::kv(_exportLoadOrder, "exportLoadOrder")) {
+            exportLoadOrder = _exportLoadOrder == "true" || _exportLoadOrder == "1";
+        }
+        if (ar <=> articuno::kv(_earlyPlanning, "earlyPlanning")) {
+            earlyPlanning = _earlyPlanning == "true" || _earlyPlanning == "1";
+        }
+    }
+
+    friend class articuno::access;
+};
+
+// Typed form of the rarities, perks and crafting sections, compiled once when the config is loaded. Malformed entries
+// are left out and reported through Config::GetErrors(). The rarities and crafting sections compile the way
+// AlchemyPlanCompiler compiles them, see AlchemyPlanner::CompileCraftingRules().
+struct CompiledRules : AlchemyPlanner::CraftingRules {
+    // perk unlocking each level, same size as levelKeywords, level1 at [0] is never set
+    std::vector<FormRef> levelPerks;
+    FormRef potionQualityPerk;
+    FormRef poisonQualityPerk;
+    FormRef allQualityPerk;
+    FormRef doubleItemsPerk;
+};
+
 class Config {
 public:
     [[nodiscard]] inline const Debug& GetDebug() const noexcept { return _debug; }
-    [[nodiscard]] inline const PerksConfig& GetPerksConfig() const noexcept { return _perks_config; }
     [[nodiscard]] inline const IngredientsConfig& GetIngrConfig() const noexcept { return _ingr_config; }
-    [[nodiscard]] inline const CobjConfig& GetCobjConfig() const noexcept { return _cobj_config; }
+    [[nodiscard]] inline const PerformanceConfig& GetPerformanceConfig() const noexcept { return _perf_config; }
+    [[nodiscard]] inline const CompiledRules& GetRules() const noexcept { return _rules; }
+    // Problems found while compiling the config, logged once logging is up
+    [[nodiscard]] inline const std::vector<std::string>& GetErrors() const noexcept { return _errors; }
 
     [[nodiscard]] static const Config& GetSingleton() noexcept;
 
+    // Reads AlchemyReworked.yaml again and makes it the active config, returns the config it replaced. References
+    // returned by GetSingleton() stay valid but see the new values, game thread only.
+    static Config Reload();
+    // Makes a config returned by Reload() active again
+    static void Restore(Config previous);
+
 private:
+    [[nodiscard]] static Config Load();
+    void Compile();
+
     articuno_serde(ar) {
         ar <=> articuno::kv(_debug, "debug");
         ar <=> articuno::kv(_perks_config, "perks");
         ar <=> articuno::kv(_ingr_config, "ingredients");
+        ar <=> articuno::kv(_rarities_config, "rarities");
         ar <=> articuno::kv(_cobj_config, "crafting");
+        ar <=> articuno::kv(_perf_config, "performance");
     }
 
     Debug _debug;
     PerksConfig _perks_config;
     IngredientsConfig _ingr_config;
+    RaritiesConfig _rarities_config;
     CobjConfig _cobj_config;
+    PerformanceConfig _perf_config;
+    CompiledRules _rules;
+    std::vector<std::string> _errors;
 
     friend class articuno::access;
 };
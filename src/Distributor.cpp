@@ -1,8 +1,15 @@
 #include "Distributor.h"
 
+#include <filesystem>
 #include <ranges>
 
 #include "Config.h"
+#include "Planner/KidIni.h"
+#include "Planner/LoadOrderFile.h"
+#include "Planner/Metrics.h"
+#include "Planner/Parallel.h"
+#include "Planner/PlanCache.h"
+#include "Planner/Planner.h"
 
 using namespace RE;
 using namespace RE::BSScript;
@@ -11,257 +18,959 @@ using namespace SKSE;
 
 namespace {
 
-    struct EffectPotions {
-        AlchemyItem* level1;
-        AlchemyItem* level2;
-        AlchemyItem* level3;
-        AlchemyItem* level4;
-        AlchemyItem* level5;
-    };
+    inline BGSKeyword* alchemyKeyword;
 
-    struct CobjMetadata {
-        int targetIngredientLevel;
-        int potionMinLevel;
-        IngredientItem* ingr1;
-        IngredientItem* ingr2;
+    // planner inputs/outputs, forms are stored at the same index as their load order records
+    inline AlchemyPlanner::LoadOrder loadOrder;
+    inline AlchemyPlanner::Plan plan;
+    inline std::vector<IngredientItem*> ingredientForms;
+    inline std::vector<AlchemyItem*> potionForms;
+    // generated COBJ per row of plan.recipes, nullptr if the form couldn't be created
+    inline std::vector<BGSConstructibleObject*> recipeForms;
+    // condition items of recipeForms, indexed the same way
+    inline std::vector<TESConditionItem*> recipeConditions;
+    // Forms can't be deleted, so COBJs whose recipes a config reload dropped keep their condition items and
+    // ingredient entries and take recipes of a later replan. By the ingredient entries they hold, 2 or 3.
+    inline std::vector<std::pair<BGSConstructibleObject*, TESConditionItem*>> retiredPairs;
+    inline std::vector<std::pair<BGSConstructibleObject*, TESConditionItem*>> retiredTriples;
+    // keywords the plan was built with, a config reload replans against the same classification
+    inline AlchemyPlanner::Keywords planKeywords;
+    // ingredient names before rarity suffixes were added, indexed like ingredientForms
+    inline std::vector<std::string> ingredientBaseNames;
+
+    inline constexpr auto kPlanCachePath = R"(Data\SKSE\Plugins\AlchemyReworked.plancache)";
+    // written by AlchemyPlanCompiler from the exported load order
+    inline constexpr auto kPrebuiltPlanPath = R"(Data\SKSE\Plugins\AlchemyReworked.plan)";
+    inline constexpr auto kLoadOrderExportPath = R"(Data\SKSE\Plugins\AlchemyReworked.loadorder.tsv)";
+
+    // plan being built off the game thread, valid until it is committed
+    inline std::future<AlchemyPlanner::Plan> pendingPlan;
+    // set once the plan is committed to forms, the workbench sink does nothing before that
+    inline bool planPublished = false;
+
+    // plan started at kDataLoaded from the keywords the KID inis are expected to distribute
+    struct PredictedPlan {
+        AlchemyPlanner::Plan plan;
+        // fingerprint of the predicted records, the plan cache is keyed on it, unset if the cache is off
+        std::optional<std::uint64_t> fingerprint;
+        bool fromCache = false;
     };
+    // valid from kDataLoaded until Initialize takes the plan to reconcile it
+    inline std::future<PredictedPlan> predictedPlan;
+    // set when Initialize won't reconcile the prediction, planning that hasn't started yet is skipped
+    inline std::atomic<bool> predictionDiscarded = false;
+
+    // Waits for a prediction nothing is going to reconcile and frees its plan
+    inline void DiscardPrediction() {
+        if (!predictedPlan.valid()) {
+            return;
+        }
+        predictionDiscarded = true;
+        predictedPlan.wait();
+        predictedPlan = {};
+    }
 
-    inline BGSKeyword* alchemyKeyword;
-    inline BGSKeyword* level1Keyword;
-    inline BGSKeyword* level2Keyword;
-    inline BGSKeyword* level3Keyword;
-    inline BGSKeyword* level4Keyword;
-    inline BGSKeyword* level5Keyword;
-    inline std::map<EffectSetting*, EffectPotions> potionsByEffect = {};
-    inline std::map<BGSConstructibleObject*, CobjMetadata> constructibleMetadata = {};
-
-    typedef std::vector<IngredientItem*> IngredientArr;
-    inline IngredientArr commonIngredients = {};
-    inline IngredientArr uncommonIngredients = {};
-    inline IngredientArr rareIngredients = {};
-    inline IngredientArr emptyIngr = {};
-
-    inline BGSPerk* level2Perk;
-    inline BGSPerk* level3Perk;
-    inline BGSPerk* level4Perk;
-    inline BGSPerk* level5Perk;
+    // perk unlocking each level, level1 at [0] is always nullptr
+    inline std::vector<BGSPerk*> levelPerks;
     inline BGSPerk* potionQualityPerk;
     inline BGSPerk* poisonQualityPerk;
     inline BGSPerk* allQualityPerk;
     inline BGSPerk* doubleItemsPerk;
 
-    inline BGSPerk* LoadPerkFromConfig(std::string str) {
-        log::info("Loading {}", str);
-        int delimterIndex = str.find("|");
-        if (delimterIndex < 0) {
-            return nullptr;
+    template <class T>
+    inline T* LookupForm(const FormRef& ref) {
+        return ref.IsSet() ? TESDataHandler::GetSingleton()->LookupForm<T>(ref.localId, ref.plugin) : nullptr;
+    }
+
+    inline AlchemyPlanner::FormID GetFormID(BGSKeyword* keyword) { return keyword ? keyword->GetFormID() : 0; }
+
+    inline std::vector<AlchemyPlanner::FormID> GetKeywordIds(BGSKeywordForm* form) {
+        std::vector<AlchemyPlanner::FormID> ids;
+        ids.reserve(form->numKeywords);
+        for (std::uint32_t i = 0; i < form->numKeywords; i++) {
+            if (form->keywords[i]) {
+                ids.push_back(form->keywords[i]->GetFormID());
+            }
         }
-        auto modFile = str.substr(0, delimterIndex);
-        auto formIdStr = str.substr(delimterIndex + 1);
-        log::info("{} {}", modFile, formIdStr);
-        if (modFile == "" || formIdStr == "") {
-            return nullptr;
+        return ids;
+    }
+
+    inline std::vector<AlchemyPlanner::FormID> GetEffectIds(MagicItem* item) {
+        std::vector<AlchemyPlanner::FormID> ids;
+        ids.reserve(item->effects.size());
+        for (auto effect : item->effects) {
+            // keep slot positions intact, knownEffectFlags bits are indexed by slot
+            ids.push_back(effect && effect->baseEffect ? effect->baseEffect->GetFormID() : 0);
         }
-        unsigned int formId;
-        std::stringstream ss;
-        ss << std::hex << formIdStr;
-        ss >> formId;
-        return TESDataHandler::GetSingleton()->LookupForm<BGSPerk>(formId, modFile);
+        return ids;
     }
 
-    inline AlchemyItem* GetEarliestLevelPotion(EffectPotions& potions, int* outLevel) {
-        if (potions.level1) {
-            *outLevel = 1;
-            return potions.level1;
-        } else if (potions.level2) {
-            *outLevel = 2;
-            return potions.level2;
-        } else if (potions.level3) {
-            *outLevel = 3;
-            return potions.level3;
-        } else if (potions.level4) {
-            *outLevel = 4;
-            return potions.level4;
-        } else if (potions.level5) {
-            *outLevel = 5;
-            return potions.level5;
+    // Player state of the configured perks, one HasPerk per perk. Taken on every workbench enter: perk list sizes
+    // stay the same through a respec or a perk swap, so only the perks themselves tell whether the state changed.
+    // Recipes are only evaluated again when the snapshot differs from evaluatedPerks.
+    inline AlchemyPlanner::PerkSnapshot GetPerkSnapshot(PlayerCharacter* player) {
+        auto hasPerk = [player](BGSPerk* perk) { return perk && player->HasPerk(perk); };
+
+        AlchemyPlanner::PerkSnapshot snapshot;
+        for (int level = 2; level <= static_cast<int>(levelPerks.size()); level++) {
+            if (hasPerk(levelPerks[level - 1])) {
+                snapshot.UnlockLevel(level);
+            }
+        }
+        if (hasPerk(potionQualityPerk)) {
+            snapshot.Set(AlchemyPlanner::PerkSnapshot::kPotionQuality);
+        }
+        if (hasPerk(poisonQualityPerk)) {
+            snapshot.Set(AlchemyPlanner::PerkSnapshot::kPoisonQuality);
+        }
+        if (hasPerk(allQualityPerk)) {
+            snapshot.Set(AlchemyPlanner::PerkSnapshot::kAllQuality);
+        }
+        if (hasPerk(doubleItemsPerk)) {
+            snapshot.Set(AlchemyPlanner::PerkSnapshot::kDoubleItems);
+        }
+
+        return snapshot;
+    }
+
+    // knownEffectFlags of every ingredient, indexed like ingredientForms
+    inline std::vector<std::uint32_t> knownEffects;
+
+    inline void SnapshotKnownEffects() {
+        knownEffects.resize(ingredientForms.size());
+        for (std::size_t i = 0; i < ingredientForms.size(); i++) {
+            knownEffects[i] = ingredientForms[i]->gamedata.knownEffectFlags;
         }
-        return nullptr;
     }
 
-    inline IngredientArr& GetIngredientListForLevel(std::string level, IngredientArr& commonIngr,
-                                                    IngredientArr& uncommonIngr, IngredientArr& rareIngr) {
-        if (level == "common") {
-            return commonIngr;
+    // Visibility state carried between workbench accesses. Perk rules are only re-applied when the perk snapshot
+    // differs from the one the lists were built for, known effects are only checked for recipes whose ingredients
+    // learned a new effect since the last access.
+    inline std::optional<AlchemyPlanner::PerkSnapshot> evaluatedPerks;
+    // allowed by perks but player doesn't know the effect in both ingredients yet
+    inline AlchemyPlanner::KnownRecipeTracker pendingRecipes;
+    // allowed and known, these are unhidden while the bench is in use
+    inline std::vector<AlchemyPlanner::Index> visibleRecipes;
+
+    // Pool mode creates no COBJ per recipe. A fixed set of forms is bound to the visible recipes craftable from the
+    // inventory on workbench enter and unbound on exit, recipeForms stays empty. Chosen once at startup.
+    inline bool poolMode = false;
+    inline std::vector<BGSConstructibleObject*> poolForms;
+    // kPoolConditions condition items per pool form, in poolForms order
+    inline TESConditionItem* poolConditions = nullptr;
+    inline constexpr std::size_t kPoolConditions = 5;
+    // ingredient entries every pool form holds, see SetIngredientEntries
+    inline constexpr std::uint32_t kPoolIngredients = 3;
+    // recipe bound to poolForms[i]
+    inline std::vector<AlchemyPlanner::Index> boundRecipes;
+    inline std::unordered_map<const TESBoundObject*, AlchemyPlanner::Index> ingredientIndexes;
+    // visibleRecipes as per recipe flags, entries from allowedMarked on are not marked yet. ApplyPerks rebuilds
+    // visibleRecipes and starts the marking over, revealed recipes are only appended.
+    inline std::vector<std::uint8_t> allowedRecipes;
+    inline std::size_t allowedMarked = 0;
+
+    // Every generated recipe starts its conditions with GetGlobalValue(gate) == 1, the gate is 1 only while the player
+    // uses a bench. Closing the bench is one write, the allowed condition behind it only changes when a recipe joins
+    // or leaves visibleRecipes. nullptr if the global couldn't be created, recipes are then hidden one by one.
+    inline TESGlobal* visibilityGate = nullptr;
+
+    // GetIsReference(player) == 1 while the recipe is allowed, == 0 otherwise
+    inline TESConditionItem* GetAllowedCondition(BGSConstructibleObject* cobj) {
+        auto head = cobj->conditions.head;
+        return visibilityGate && head ? head->next : head;
+    }
+
+    inline void SetRecipesHidden(std::span<const AlchemyPlanner::Index> recipes, bool hidden) {
+        if (!hidden) {
+            AlchemyPlanner::Metrics::GetSingleton().Add("recipes.unhidden", recipes.size());
+        }
+        for (auto recipe : recipes) {
+            if (auto allowed = GetAllowedCondition(recipeForms[recipe])) {
+                allowed->data.comparisonValue.f = hidden ? 0.0f : 1.0f;
+            }
+        }
+    }
+
+    // Withdraws every recipe from visibleRecipes before it is rebuilt
+    inline void ResetVisibleRecipes() {
+        if (!poolMode) {
+            SetRecipesHidden(std::span<const AlchemyPlanner::Index>(visibleRecipes).first(allowedMarked), true);
+        }
+        visibleRecipes.clear();
+        allowedMarked = 0;
+    }
+
+    // outputs under the perks in evaluatedPerks
+    inline AlchemyPlanner::RecipeOutputs recipeOutputs;
+
+    // Expects a fresh knownEffects snapshot
+    inline void ApplyPerks(const AlchemyPlanner::PerkSnapshot& perks) {
+        std::vector<AlchemyPlanner::Index> unlockedRecipes;
+        ResetVisibleRecipes();
+        recipeOutputs = AlchemyPlanner::RecipeOutputs(perks, plan.potionTiers.GetTierCount());
+
+        std::uint64_t evaluated = 0;
+        std::uint64_t changed = 0;
+        for (AlchemyPlanner::Index recipe = 0; recipe < plan.recipes.Size(); recipe++) {
+            // pool forms get their output when they are bound
+            auto cobj = poolMode ? nullptr : recipeForms[recipe];
+            if (!poolMode && !cobj) {
+                continue;
+            }
+            evaluated++;
+            // locked recipes go back to their base output as well, so nothing a lost perk granted stays behind
+            if (cobj) {
+                auto potion = potionForms[recipeOutputs.GetPotion(plan, recipe)];
+                auto count = recipeOutputs.GetCount(plan.recipes, recipe);
+                if (cobj->createdItem != potion || cobj->data.numConstructed != count) {
+                    cobj->createdItem = potion;
+                    cobj->data.numConstructed = count;
+                    changed++;
+                }
+            }
+            if (recipeOutputs.IsUnlocked(plan.recipes, recipe)) {
+                unlockedRecipes.push_back(recipe);
+            }
         }
-        if (level == "uncommon") {
-            return uncommonIngr;
+        auto& metrics = AlchemyPlanner::Metrics::GetSingleton();
+        metrics.Add("recipes.evaluated", evaluated);
+        metrics.Add("recipes.outputsChanged", changed);
+        // Player must know effect in both ingredients
+        pendingRecipes.Reset(plan.recipes, unlockedRecipes, knownEffects, visibleRecipes);
+        evaluatedPerks = perks;
+    }
+
+    // Expects a fresh knownEffects snapshot
+    inline void RevealKnownRecipes() {
+        // Known effects are never forgotten within a save so recipes move from pending to visible only
+        auto revealed = pendingRecipes.Update(plan.recipes, knownEffects, visibleRecipes);
+        AlchemyPlanner::Metrics::GetSingleton().Add("recipes.revealed", revealed);
+        if (revealed) {
+            log::info("Revealed {} recipes, {} still need known effects", revealed, pendingRecipes.GetPendingCount());
         }
-        if (level == "rare") {
-            return rareIngr;
+    }
+
+    // Condition items of generated COBJs are carved out of these blocks, one per batch of created recipes.
+    // Generated forms live until the game exits, so the blocks are never released.
+    inline std::vector<std::unique_ptr<TESConditionItem[]>> conditionPools;
+
+    // one GetItemCount per ingredient, the allowed check and the gate
+    inline std::size_t GetConditionCount(AlchemyPlanner::Index recipe) {
+        return plan.recipes.ingr3[recipe] != AlchemyPlanner::kNoIndex ? 5 : 4;
+    }
+
+    // "Effect + Effect" names of an effect signature
+    inline std::string GetSignatureName(AlchemyPlanner::Index signature) {
+        std::string name;
+        for (auto effect : plan.potionTiers.GetEffects(signature)) {
+            auto effectForm = TESForm::LookupByID<EffectSetting>(effect);
+            if (!name.empty()) {
+                name += " + ";
+            }
+            if (effectForm && effectForm->GetFullName() && *effectForm->GetFullName()) {
+                name += effectForm->GetFullName();
+            } else {
+                name += effectForm ? effectForm->GetFormEditorID() : "unknown";
+            }
         }
-        return emptyIngr;
+        return name;
     }
 
-    inline std::pair<IngredientArr&, IngredientArr&> GetIngredientListForCrafting(std::string craftingDef,
-                                                                                  IngredientArr& commonIngr,
-                                                                                  IngredientArr& uncommonIngr,
-                                                                                  IngredientArr& rareIngr) {
-        int delimterIndex = craftingDef.find("|");
-        if (delimterIndex < 0) {
-            return std::make_pair(std::ref(emptyIngr), std::ref(emptyIngr));
+    // Fills the condition chain gateCond -> playerCond -> ingr3Cond -> ingr2Cond -> ingr1Cond, ingr3Cond only for
+    // three ingredient recipes and gateCond only with a visibility gate. playerCond is the allowed condition, the
+    // chain starts with the recipe not allowed.
+    inline TESConditionItem* LinkConditions(TESConditionItem* conditions, PlayerCharacter* playerRef,
+                                            IngredientItem* ingr1, IngredientItem* ingr2, IngredientItem* ingr3) {
+        auto ingr1Cond = &conditions[0];
+        ingr1Cond->next = nullptr;
+        ingr1Cond->data.comparisonValue.f = 1.0f;
+        ingr1Cond->data.functionData.function = FUNCTION_DATA::FunctionID::kGetItemCount;
+        ingr1Cond->data.flags.opCode = CONDITION_ITEM_DATA::OpCode::kGreaterThanOrEqualTo;
+        ingr1Cond->data.functionData.params[0] = ingr1;
+
+        auto ingr2Cond = &conditions[1];
+        ingr2Cond->next = ingr1Cond;
+        ingr2Cond->data.comparisonValue.f = 1.0f;
+        ingr2Cond->data.functionData.function = FUNCTION_DATA::FunctionID::kGetItemCount;
+        ingr2Cond->data.flags.opCode = CONDITION_ITEM_DATA::OpCode::kGreaterThanOrEqualTo;
+        // ingr2Cond->data.flags.isOR = true;
+        ingr2Cond->data.functionData.params[0] = ingr2;
+
+        auto lastIngrCond = ingr2Cond;
+        if (ingr3) {
+            auto ingr3Cond = &conditions[4];
+            ingr3Cond->next = ingr2Cond;
+            ingr3Cond->data.comparisonValue.f = 1.0f;
+            ingr3Cond->data.functionData.function = FUNCTION_DATA::FunctionID::kGetItemCount;
+            ingr3Cond->data.flags.opCode = CONDITION_ITEM_DATA::OpCode::kGreaterThanOrEqualTo;
+            ingr3Cond->data.functionData.params[0] = ingr3;
+            lastIngrCond = ingr3Cond;
         }
-        auto firstStr = craftingDef.substr(0, delimterIndex);
-        auto secondStr = craftingDef.substr(delimterIndex + 1);
 
-        auto& firstArr = GetIngredientListForLevel(firstStr, commonIngr, uncommonIngr, rareIngr);
-        auto& secondArr = GetIngredientListForLevel(secondStr, commonIngr, uncommonIngr, rareIngr);
+        auto playerCond = &conditions[2];
+        playerCond->next = lastIngrCond;
+        playerCond->data.comparisonValue.f = 0.0f;
+        playerCond->data.functionData.function = FUNCTION_DATA::FunctionID::kGetIsReference;
+        playerCond->data.functionData.params[0] = playerRef;
+        if (!visibilityGate) {
+            return playerCond;
+        }
 
-        return std::make_pair(std::ref(firstArr), std::ref(secondArr));
+        auto gateCond = &conditions[3];
+        gateCond->next = playerCond;
+        gateCond->data.comparisonValue.f = 1.0f;
+        gateCond->data.functionData.function = FUNCTION_DATA::FunctionID::kGetGlobalValue;
+        gateCond->data.functionData.params[0] = visibilityGate;
+        return gateCond;
     }
 
-    inline AlchemyItem* GetHigherLevelPotion(EffectPotions& potions, int targetLevel) {
-        if (targetLevel <= 1) {
-            return potions.level1;
+    inline void CreateVisibilityGate() {
+        auto factory = IFormFactory::GetConcreteFormFactoryByType<TESGlobal>();
+        visibilityGate = factory ? factory->Create() : nullptr;
+        if (!visibilityGate) {
+            log::warn("Unable to create the recipe visibility gate, recipes are hidden one by one");
+            return;
         }
-        if (targetLevel == 2) {
-            if (potions.level2) return potions.level2;
-            return potions.level1;
+        visibilityGate->value = 0.0f;
+    }
+
+    // Points the ingredient entries of a form created with `entries` of them at two or three ingredients,
+    // ingredients[2] is null for a pair. Entries can't be added or removed in place, a pair only lowers the count in
+    // use and the entry past it stays allocated for a later recipe. The count in use never exceeds the entries the
+    // form was created with, so it is also a safe lower bound of them.
+    inline void SetIngredientEntries(BGSConstructibleObject* obj, std::uint32_t entries,
+                                     const std::array<IngredientItem*, 3>& ingredients) {
+        auto& items = obj->requiredItems;
+        const std::uint32_t used = ingredients[2] ? 3 : 2;
+        assert(used <= entries && items.containerObjects);
+        items.numContainerObjects = used;
+        for (std::uint32_t i = 0; i < used; i++) {
+            items.containerObjects[i]->obj = ingredients[i];
+            items.containerObjects[i]->count = 1;
         }
-        if (targetLevel == 3) {
-            if (potions.level3) return potions.level3;
-            if (potions.level2) return potions.level2;
-            return potions.level1;
+    }
+
+    // Points obj at a recipe. A new form (retiredEntries 0) gets its ingredient entries added, a retired one holds
+    // retiredEntries of them already and they are overwritten.
+    inline void FillRecipe(BGSConstructibleObject* obj, std::uint32_t retiredEntries, PlayerCharacter* playerRef,
+                           TESConditionItem* conditions, AlchemyPlanner::Index recipe) {
+        auto ingr1 = ingredientForms[plan.recipes.ingr1[recipe]];
+        auto ingr2 = ingredientForms[plan.recipes.ingr2[recipe]];
+        auto ingr3 = plan.recipes.ingr3[recipe] != AlchemyPlanner::kNoIndex
+                         ? ingredientForms[plan.recipes.ingr3[recipe]]
+                         : nullptr;
+        auto potion = potionForms[AlchemyPlanner::GetRecipePotion(plan, recipe)];
+
+        if (Config::GetSingleton().GetDebug().IsVerbose()) {
+            log::info("Level {} Recipe: {}, ingr1: {}, ingr2: {}{}{}", plan.recipes.targetIngredientLevel[recipe],
+                      GetSignatureName(plan.recipes.signature[recipe]), ingr1->GetFullName(), ingr2->GetFullName(),
+                      ingr3 ? ", ingr3: " : "", ingr3 ? ingr3->GetFullName() : "");
         }
-        if (targetLevel == 4) {
-            if (potions.level4) return potions.level4;
-            if (potions.level3) return potions.level3;
-            if (potions.level2) return potions.level2;
-            return potions.level1;
+        obj->benchKeyword = alchemyKeyword;
+        if (retiredEntries) {
+            SetIngredientEntries(obj, retiredEntries, {ingr1, ingr2, ingr3});
+        } else {
+            obj->requiredItems.AddObjectToContainer(ingr1, 1, nullptr);
+            obj->requiredItems.AddObjectToContainer(ingr2, 1, nullptr);
+            if (ingr3) {
+                obj->requiredItems.AddObjectToContainer(ingr3, 1, nullptr);
+            }
         }
-        if (targetLevel >= 5) {
-            if (potions.level5) return potions.level5;
-            if (potions.level4) return potions.level4;
-            if (potions.level3) return potions.level3;
-            if (potions.level2) return potions.level2;
-            return potions.level1;
+        obj->createdItem = potion;
+        obj->data.numConstructed = 1;
+
+        obj->conditions.head = LinkConditions(conditions, playerRef, ingr1, ingr2, ingr3);
+    }
+
+    struct RetiredRecipe {
+        BGSConstructibleObject* form;
+        TESConditionItem* conditions;
+        // ingredient entries the form holds, by the list it was retired to
+        std::uint32_t entries;
+    };
+
+    // Takes a retired form with room for the recipe, three ingredient forms can take two ingredient recipes as well
+    inline std::optional<RetiredRecipe> TakeRetiredRecipe(AlchemyPlanner::Index recipe) {
+        const auto triple = plan.recipes.ingr3[recipe] != AlchemyPlanner::kNoIndex;
+        const auto fromPairs = !triple && !retiredPairs.empty();
+        auto& retired = fromPairs ? retiredPairs : retiredTriples;
+        if (retired.empty()) {
+            return std::nullopt;
         }
-        return nullptr;
+        auto [form, conditions] = retired.back();
+        retired.pop_back();
+        return RetiredRecipe{form, conditions, fromPairs ? 2u : 3u};
     }
 
-    inline bool HasKnownEffectInIngredient(EffectSetting* effect, IngredientItem* item) {
-        auto index = -1;
-
-        for (int i = 0; i < item->effects.size(); i++) {
-            auto ingrEffect = item->effects[i];
-            if (ingrEffect->baseEffect == effect) {
-                index = i;
+    // Creates the COBJs of the planned recipes from row first on, retired forms are taken first. The form array is
+    // grown once for the whole batch and condition items come from one pooled block instead of one heap allocation
+    // each. Returns the number of new forms.
+    inline std::size_t CreateRecipes(std::size_t first = 0) {
+        const auto factory = IFormFactory::GetConcreteFormFactoryByType<BGSConstructibleObject>();
+        if (!factory) {
+            log::error("Unable to get COBJ form factory");
+            return 0;
+        }
+        const auto count = plan.recipes.Size() - first;
+        auto playerRef = PlayerCharacter::GetSingleton();
+        auto& formArray = TESDataHandler::GetSingleton()->GetFormArray<BGSConstructibleObject>();
+
+        // what pushing one by one would have cost: BSTArray doubles its capacity (4 at minimum) when full and copies
+        // the old contents over, reserving upfront copies the current contents only once
+        std::size_t growthReallocations = 0;
+        std::size_t growthBytes = 0;
+        for (std::size_t capacity = formArray.capacity(); capacity < formArray.size() + count;
+             capacity = capacity ? capacity * 2 : 4) {
+            growthReallocations++;
+            growthBytes += capacity * sizeof(BGSConstructibleObject*);
+        }
+        auto savedReallocations = growthReallocations ? growthReallocations - 1 : 0;
+        auto savedCopyBytes = growthBytes - std::min(growthBytes, formArray.size() * sizeof(BGSConstructibleObject*));
+
+        formArray.reserve(static_cast<std::uint32_t>(formArray.size() + count));
+        recipeForms.resize(plan.recipes.Size());
+        recipeConditions.resize(plan.recipes.Size());
+        std::size_t recycled = 0;
+        std::size_t conditionCount = 0;
+        for (auto i = first; i < plan.recipes.Size(); i++) {
+            auto recipe = static_cast<AlchemyPlanner::Index>(i);
+            if (auto retired = TakeRetiredRecipe(recipe)) {
+                FillRecipe(retired->form, retired->entries, playerRef, retired->conditions, recipe);
+                recipeForms[i] = retired->form;
+                recipeConditions[i] = retired->conditions;
+                recycled++;
+            } else {
+                recipeForms[i] = nullptr;
+                conditionCount += GetConditionCount(recipe);
+            }
+        }
+        auto conditions = conditionCount
+                              ? conditionPools.emplace_back(std::make_unique<TESConditionItem[]>(conditionCount)).get()
+                              : nullptr;
+
+        std::size_t created = 0;
+        std::size_t conditionOffset = 0;
+        for (auto i = first; i < plan.recipes.Size(); i++) {
+            auto recipe = static_cast<AlchemyPlanner::Index>(i);
+            if (recipeForms[i]) {
+                continue;
+            }
+            auto obj = factory->Create();
+            recipeConditions[i] = &conditions[conditionOffset];
+            conditionOffset += GetConditionCount(recipe);
+            if (obj) {
+                FillRecipe(obj, 0, playerRef, recipeConditions[i], recipe);
+                recipeForms[i] = obj;
+                formArray.push_back(obj);
+                created++;
+            }
+        }
+        if (recycled) {
+            AlchemyPlanner::Metrics::GetSingleton().Add("recipes.recycled", recycled);
+            log::info("Reused {} retired COBJs, {} more are left for later reloads", recycled,
+                      retiredPairs.size() + retiredTriples.size());
+        }
+
+        log::info("Bulk COBJ creation saved {} allocations: {} condition items in one {} byte block, {} form array "
+                  "reallocations ({} bytes of copies) avoided",
+                  (conditionCount ? conditionCount - 1 : 0) + savedReallocations, conditionCount,
+                  conditionCount * sizeof(TESConditionItem), savedReallocations, savedCopyBytes);
+        return created;
+    }
+
+    // Creates the pool forms. Each one holds kPoolIngredients ingredient entries and kPoolConditions condition items
+    // from the start, binding overwrites them and sets how many ingredient entries count.
+    inline std::size_t CreateRecipePool(std::size_t size) {
+        const auto factory = IFormFactory::GetConcreteFormFactoryByType<BGSConstructibleObject>();
+        if (!factory || ingredientForms.size() < kPoolIngredients || potionForms.empty()) {
+            log::error("Unable to create the recipe pool");
+            return 0;
+        }
+        auto playerRef = PlayerCharacter::GetSingleton();
+        auto& formArray = TESDataHandler::GetSingleton()->GetFormArray<BGSConstructibleObject>();
+        formArray.reserve(static_cast<std::uint32_t>(formArray.size() + size));
+        poolConditions =
+            conditionPools.emplace_back(std::make_unique<TESConditionItem[]>(size * kPoolConditions)).get();
+
+        // adding a form the container already has only raises the count of its entry, so every entry gets its own
+        std::array<IngredientItem*, kPoolIngredients> placeholders{ingredientForms[0], ingredientForms[1],
+                                                                   ingredientForms[2]};
+        for (std::size_t slot = 0; slot < size; slot++) {
+            auto obj = factory->Create();
+            if (!obj) {
+                break;
+            }
+            obj->benchKeyword = alchemyKeyword;
+            for (auto placeholder : placeholders) {
+                obj->requiredItems.AddObjectToContainer(placeholder, 1, nullptr);
+            }
+            if (obj->requiredItems.numContainerObjects != kPoolIngredients) {
+                log::error("Recipe pool form holds {} ingredient entries instead of {}, pool stops at {} forms",
+                           obj->requiredItems.numContainerObjects, kPoolIngredients, poolForms.size());
                 break;
             }
+            obj->createdItem = potionForms.front();
+            obj->data.numConstructed = 1;
+            obj->conditions.head = LinkConditions(&poolConditions[slot * kPoolConditions], playerRef,
+                                                  placeholders[0], placeholders[1], placeholders[2]);
+            formArray.push_back(obj);
+            poolForms.push_back(obj);
         }
-        if (index < 0) {
-            return false;
+        for (AlchemyPlanner::Index i = 0; i < ingredientForms.size(); i++) {
+            ingredientIndexes.emplace(ingredientForms[i], i);
         }
+        log::info("Recipe pool: {} forms for {} planned recipes", poolForms.size(), plan.recipes.Size());
+        return poolForms.size();
+    }
 
-        return (item->gamedata.knownEffectFlags & (1 << index)) != 0;
+    // Points a pool form at a recipe with the potion and count of recipeOutputs, and reveals it
+    inline void BindRecipe(std::size_t slot, AlchemyPlanner::Index recipe, PlayerCharacter* playerRef) {
+        auto cobj = poolForms[slot];
+        auto third = plan.recipes.ingr3[recipe];
+        auto ingr3 = third != AlchemyPlanner::kNoIndex ? ingredientForms[third] : nullptr;
+        std::array<IngredientItem*, 3> ingredients{ingredientForms[plan.recipes.ingr1[recipe]],
+                                                   ingredientForms[plan.recipes.ingr2[recipe]], ingr3};
+        SetIngredientEntries(cobj, kPoolIngredients, ingredients);
+
+        cobj->createdItem = potionForms[recipeOutputs.GetPotion(plan, recipe)];
+        cobj->data.numConstructed = recipeOutputs.GetCount(plan.recipes, recipe);
+        cobj->conditions.head = LinkConditions(&poolConditions[slot * kPoolConditions], playerRef, ingredients[0],
+                                               ingredients[1], ingredients[2]);
+        GetAllowedCondition(cobj)->data.comparisonValue.f = 1.0f;
     }
 
-    inline bool HasKnownEffectInIngredients(BGSConstructibleObject* cobj, EffectSetting* effect) {
-        if (!constructibleMetadata.contains(cobj)) {
-            return false;
+    // Binds the pool to the visible recipes whose ingredients are all in the player's inventory. Expects
+    // visibleRecipes and recipeOutputs to be up to date.
+    inline void BindRecipePool() {
+        auto player = PlayerCharacter::GetSingleton();
+        std::vector<std::uint8_t> held(ingredientForms.size());
+        std::vector<AlchemyPlanner::Index> heldIngredients;
+        auto inventory = player->GetInventory([](TESBoundObject& object) { return object.Is(FormType::Ingredient); });
+        for (const auto& [object, entry] : inventory) {
+            auto it = ingredientIndexes.find(object);
+            if (entry.first > 0 && it != ingredientIndexes.end() && !held[it->second]) {
+                held[it->second] = 1;
+                heldIngredients.push_back(it->second);
+            }
         }
-        auto metadata = constructibleMetadata[cobj];
-        if (!metadata.ingr1 || !metadata.ingr2) {
-            return false;
+        // the inventory is ordered by pointer, load order keeps the choice stable when the pool is full
+        std::sort(heldIngredients.begin(), heldIngredients.end());
+
+        if (allowedMarked == 0) {
+            allowedRecipes.assign(plan.recipes.Size(), 0);
         }
-        auto potion = cobj->createdItem->As<AlchemyItem>();
-        if (!potion || !potion->effects[0] || !potion->effects[0]->baseEffect) {
-            return false;
+        for (; allowedMarked < visibleRecipes.size(); allowedMarked++) {
+            allowedRecipes[visibleRecipes[allowedMarked]] = 1;
         }
-        auto potionEffect = potion->effects[0]->baseEffect;
 
-        if (!HasKnownEffectInIngredient(potionEffect, metadata.ingr1) ||
-            !HasKnownEffectInIngredient(potionEffect, metadata.ingr2)) {
-            return false;
+        // forms bound last time stay allowed behind a closed gate, the ones not bound again are withdrawn here
+        const auto previouslyBound = boundRecipes.size();
+        boundRecipes.clear();
+        auto skipped = AlchemyPlanner::SelectCraftableRecipes(plan.recipes, pendingRecipes.GetRecipesByIngredient(),
+                                                              heldIngredients, held, allowedRecipes, poolForms.size(),
+                                                              boundRecipes);
+        for (std::size_t slot = 0; slot < boundRecipes.size(); slot++) {
+            BindRecipe(slot, boundRecipes[slot], player);
         }
+        for (auto slot = boundRecipes.size(); slot < previouslyBound; slot++) {
+            GetAllowedCondition(poolForms[slot])->data.comparisonValue.f = 0.0f;
+        }
+        AlchemyPlanner::Metrics::GetSingleton().Add("recipes.bound", boundRecipes.size());
+        if (skipped) {
+            log::info("Recipe pool is full, {} more craftable recipes are not shown", skipped);
+        }
+    }
+
+    // Reveals the allowed recipes, only recipes that became visible since the last enter are touched
+    inline void RevealRecipes() {
+        if (poolMode) {
+            BindRecipePool();
+        } else {
+            SetRecipesHidden(std::span<const AlchemyPlanner::Index>(visibleRecipes).subspan(allowedMarked), false);
+            allowedMarked = visibleRecipes.size();
+        }
+        if (visibilityGate) {
+            visibilityGate->value = 1.0f;
+        }
+    }
+
+    // Hides whatever the last workbench enter revealed. Closing the gate is enough, allowed states stay for the next
+    // enter.
+    inline void HideRevealedRecipes() {
+        if (visibilityGate) {
+            visibilityGate->value = 0.0f;
+        } else if (poolMode) {
+            for (std::size_t slot = 0; slot < boundRecipes.size(); slot++) {
+                GetAllowedCondition(poolForms[slot])->data.comparisonValue.f = 0.0f;
+            }
+            boundRecipes.clear();
+        } else {
+            SetRecipesHidden(std::span<const AlchemyPlanner::Index>(visibleRecipes).first(allowedMarked), true);
+            allowedMarked = 0;
+        }
+    }
+
+    // "level1/level2/.../levelN" counts
+    inline std::string FormatLevels(std::span<const std::size_t> counts) {
+        std::string out;
+        for (std::size_t i = 0; i < counts.size(); i++) {
+            if (i) {
+                out += '/';
+            }
+            out += std::to_string(counts[i]);
+        }
+        return out;
+    }
 
+    // One line per recipe level and per effect signature instead of one per recipe
+    inline void LogRecipeSummary() {
+        const auto& recipes = plan.recipes;
+        const auto levels = static_cast<std::size_t>(plan.potionTiers.GetTierCount());
+        // signature * level counts, same shape as the potion tier table
+        std::vector<std::size_t> bySignature(plan.potionTiers.SignatureCount() * levels);
+        std::vector<std::size_t> byLevel(levels);
+        for (AlchemyPlanner::Index i = 0; i < recipes.Size(); i++) {
+            if (!poolMode && !recipeForms[i]) {
+                continue;
+            }
+            bySignature[recipes.signature[i] * levels + recipes.potionMinLevel[i] - 1]++;
+            byLevel[recipes.potionMinLevel[i] - 1]++;
+        }
+        log::info("Recipes by level: {}", FormatLevels(byLevel));
+        for (AlchemyPlanner::Index signature = 0; signature < plan.potionTiers.SignatureCount(); signature++) {
+            auto counts = std::span<const std::size_t>(bySignature).subspan(signature * levels, levels);
+            std::size_t total = 0;
+            for (auto count : counts) {
+                total += count;
+            }
+            if (!total) {
+                continue;
+            }
+            log::info("Effect {}: {} recipes by level {}", GetSignatureName(signature), total, FormatLevels(counts));
+        }
+    }
+
+    // Sets every ingredient name to its base name plus the suffix of its rarity, so renaming again after a config
+    // reload never stacks suffixes
+    inline void ApplyIngredientNames(const Config& config) {
+        const auto& rarities = config.GetRules().rarities;
+        const auto rename = config.GetIngrConfig().renameIngredients;
+        for (AlchemyPlanner::Index i = 0; i < ingredientForms.size(); i++) {
+            const auto& suffix = rarities[plan.ingredientRarity[i]].suffix;
+            if (rename && !suffix.empty()) {
+                ingredientForms[i]->fullName = BSFixedString(ingredientBaseNames[i] + " " + suffix);
+            } else if (ingredientForms[i]->fullName.c_str() != ingredientBaseNames[i]) {
+                ingredientForms[i]->fullName = BSFixedString(ingredientBaseNames[i]);
+            }
+        }
+    }
+
+    // Keywords the records are classified by, false if a level keyword the config names can't be found
+    inline bool BuildKeywords(const CompiledRules& rules, AlchemyPlanner::Keywords& keywords) {
+        const auto levelCount = static_cast<int>(rules.levelKeywords.size());
+        keywords.craftable =
+            GetFormID(TESDataHandler::GetSingleton()->LookupForm<BGSKeyword>(0x800, "AlchemyReworked.esp"));
+        for (int level = 1; level <= levelCount; level++) {
+            const auto& keywordRef = rules.levelKeywords[level - 1];
+            auto levelKeyword = LookupForm<BGSKeyword>(keywordRef);
+            // the default keywords may be missing, the level has no potions then
+            if (!levelKeyword && (!keywordRef.IsSet() || keywordRef.plugin != "AlchemyReworked.esp")) {
+                log::error("Unable to load level{} keyword from config", level);
+                return false;
+            }
+            keywords.levels.push_back(GetFormID(levelKeyword));
+        }
+
+        for (std::size_t rarity = 0; rarity < rules.rarities.size(); rarity++) {
+            for (const auto& keywordRef : rules.rarities[rarity].keywords) {
+                if (auto keyword = LookupForm<BGSKeyword>(keywordRef)) {
+                    keywords.rarities.emplace_back(keyword->GetFormID(), static_cast<AlchemyPlanner::Rarity>(rarity));
+                } else {
+                    log::warn("Unable to find {} rarity keyword {}|{:X}", rules.rarities[rarity].name,
+                              keywordRef.plugin, keywordRef.localId);
+                }
+            }
+        }
+        keywords.defaultRarity = rules.defaultRarity;
+        keywords.rarityCount = rules.rarities.size();
         return true;
     }
 
-    inline void CreateRecipes(std::vector<IngredientItem*>& first, std::vector<IngredientItem*>& second,
-                              AlchemyItem* potion, int targetLevel, int potionMinLevel) {
-        if (!first.size() || !second.size()) {
-            return;
+    inline void CollectForms() {
+        const auto dataHandler = TESDataHandler::GetSingleton();
+        ingredientForms.clear();
+        for (auto ingredientItem : dataHandler->GetFormArray<IngredientItem>()) {
+            if (ingredientItem) {
+                ingredientForms.push_back(ingredientItem);
+            }
         }
-        // to avoid creating duplicate recipes when first = second, e.g. common + common
-        std::set<unsigned int> createdForFormIds;
-        const auto factory = IFormFactory::GetConcreteFormFactoryByType<BGSConstructibleObject>();
-        auto playerRef = PlayerCharacter::GetSingleton();
+        potionForms.clear();
+        for (auto alchItem : dataHandler->GetFormArray<AlchemyItem>()) {
+            if (alchItem) {
+                potionForms.push_back(alchItem);
+            }
+        }
+    }
+
+    // Fills loadOrder from ingredientForms and potionForms
+    inline void ReadRecords() {
+        AlchemyPlanner::ScopedTimer readTimer("init.readRecords");
+        loadOrder = {};
+        loadOrder.ingredients.reserve(ingredientForms.size());
+        for (auto ingredientItem : ingredientForms) {
+            loadOrder.ingredients.push_back({ingredientItem->GetFormID(), ingredientItem->GetFullName(),
+                                             GetKeywordIds(ingredientItem), GetEffectIds(ingredientItem)});
+        }
+        loadOrder.potions.reserve(potionForms.size());
+        for (auto alchItem : potionForms) {
+            loadOrder.potions.push_back({alchItem->GetFormID(), alchItem->GetFullName(), GetKeywordIds(alchItem),
+                                         GetEffectIds(alchItem), alchItem->IsPoison()});
+        }
+    }
+
+    // loadOrder with the plugins and keywords of the game, editor ids are empty for record types the game doesn't keep
+    // them of
+    inline AlchemyPlanner::LoadOrderFile DescribeLoadOrder() {
         const auto dataHandler = TESDataHandler::GetSingleton();
+        AlchemyPlanner::LoadOrderFile file;
+        for (auto plugin : dataHandler->compiledFileCollection.files) {
+            file.plugins.emplace_back(std::string(plugin->GetFilename()),
+                                      static_cast<AlchemyPlanner::FormID>(plugin->compileIndex) << 24);
+        }
+        for (auto plugin : dataHandler->compiledFileCollection.smallFiles) {
+            file.plugins.emplace_back(
+                std::string(plugin->GetFilename()),
+                0xFE000000 | static_cast<AlchemyPlanner::FormID>(plugin->smallFileCompileIndex) << 12);
+        }
+        for (auto keyword : dataHandler->GetFormArray<BGSKeyword>()) {
+            if (keyword) {
+                file.keywords.emplace_back(keyword->GetFormID(), keyword->GetFormEditorID());
+            }
+        }
+        file.loadOrder = loadOrder;
+        file.ingredientEditorIds.reserve(ingredientForms.size());
+        for (auto ingredientItem : ingredientForms) {
+            file.ingredientEditorIds.emplace_back(ingredientItem->GetFormEditorID());
+        }
+        file.potionEditorIds.reserve(potionForms.size());
+        for (auto alchItem : potionForms) {
+            file.potionEditorIds.emplace_back(alchItem->GetFormEditorID());
+        }
+        return file;
+    }
 
-        for (int i = 0; i < first.size(); i++) {
-            auto ingr1 = first.at(i);
+    // Writes loadOrder for AlchemyPlanCompiler, records keep the keywords KID gave them
+    inline void ExportLoadOrder() {
+        AlchemyPlanner::ScopedTimer exportTimer("init.exportLoadOrder");
+        if (AlchemyPlanner::WriteLoadOrderFile(kLoadOrderExportPath, DescribeLoadOrder())) {
+            log::info("Exported {} ingredients and {} alchemy items to {}", loadOrder.ingredients.size(),
+                      loadOrder.potions.size(), kLoadOrderExportPath);
+        } else {
+            log::warn("Unable to export the load order to {}", kLoadOrderExportPath);
+        }
+    }
 
-            for (int k = 0; k < second.size(); k++) {
-                auto ingr2 = second.at(k);
-                if (ingr1 == ingr2) {
-                    continue;
-                }
+    inline void SavePlan(std::uint64_t fingerprint, const AlchemyPlanner::Plan& saved) {
+        if (AlchemyPlanner::SavePlanCache(kPlanCachePath, fingerprint, saved)) {
+            log::info("Saved plan cache {:016x}", fingerprint);
+        } else {
+            log::warn("Unable to save plan cache to {}", kPlanCachePath);
+        }
+    }
+
+    // Plans recipes for the records in loadOrder and stores the result in the plan cache when a fingerprint is given.
+    // A plan predicted at kDataLoaded is reconciled with the records instead, the cache then stays keyed on the
+    // prediction. Safe to run off the game thread.
+    inline AlchemyPlanner::Plan PlanAndCache(const AlchemyPlanner::Keywords& keywords,
+                                             const AlchemyPlanner::RecipeRules& rules, unsigned workerThreads,
+                                             std::optional<std::uint64_t> fingerprint) {
+        if (!predictedPlan.valid()) {
+            auto built = AlchemyPlanner::BuildPlan(loadOrder, keywords, rules, workerThreads);
+            if (fingerprint) {
+                SavePlan(*fingerprint, built);
+            }
+            return built;
+        }
 
-                auto ingrFormId = ingr1->GetFormID();
-                auto secIngrFormId = ingr2->GetFormID();
-
-                auto key = ingrFormId + secIngrFormId;
-                // create recipe if not created already
-                if (!createdForFormIds.contains(key)) {
-                    createdForFormIds.insert(key);
-                    auto obj = factory ? factory->Create() : nullptr;
-
-                    if (obj) {
-                        auto baseEffect = potion->effects[0]->baseEffect;
-                        auto baseEffectName =
-                            baseEffect->GetFullName() ? baseEffect->GetFullName() : baseEffect->GetFormEditorID();
-
-                        log::info("Level {} Recipe: {}, ingr1: {}, ingr2: {}", targetLevel, baseEffectName,
-                                  ingr1->GetFullName(), ingr2->GetFullName());
-                        obj->benchKeyword = alchemyKeyword;
-                        obj->requiredItems.AddObjectToContainer(ingr1, 1, nullptr);
-                        obj->requiredItems.AddObjectToContainer(ingr2, 1, nullptr);
-                        obj->createdItem = potion;
-                        obj->data.numConstructed = 1;
-
-                        auto ingr1Cond = new TESConditionItem;
-                        ingr1Cond->next = nullptr;
-                        ingr1Cond->data.comparisonValue.f = 1.0f;
-                        ingr1Cond->data.functionData.function = FUNCTION_DATA::FunctionID::kGetItemCount;
-                        ingr1Cond->data.flags.opCode = CONDITION_ITEM_DATA::OpCode::kGreaterThanOrEqualTo;
-                        ingr1Cond->data.functionData.params[0] = ingr1;
-
-                        auto ingr2Cond = new TESConditionItem;
-                        ingr2Cond->next = ingr1Cond;
-                        ingr2Cond->data.comparisonValue.f = 1.0f;
-                        ingr2Cond->data.functionData.function = FUNCTION_DATA::FunctionID::kGetItemCount;
-                        ingr2Cond->data.flags.opCode = CONDITION_ITEM_DATA::OpCode::kGreaterThanOrEqualTo;
-                        // ingr2Cond->data.flags.isOR = true;
-                        ingr2Cond->data.functionData.params[0] = ingr2;
-
-                        auto playerCond = new TESConditionItem;
-                        playerCond->next = ingr2Cond;
-                        playerCond->data.comparisonValue.f = 0.0f;
-                        playerCond->data.functionData.function = FUNCTION_DATA::FunctionID::kGetIsReference;
-                        playerCond->data.functionData.params[0] = playerRef;
-                        obj->conditions.head = playerCond;
-
-                        constructibleMetadata[obj].potionMinLevel = potionMinLevel;
-                        constructibleMetadata[obj].targetIngredientLevel = targetLevel;
-                        constructibleMetadata[obj].ingr1 = ingr1;
-                        constructibleMetadata[obj].ingr2 = ingr2;
-
-                        dataHandler->GetFormArray<BGSConstructibleObject>().push_back(obj);
-                    }
+        auto predicted = predictedPlan.get();
+        auto result = AlchemyPlanner::ReconcilePlan(loadOrder, keywords, rules, predicted.plan, workerThreads);
+        if (result.rebuilt) {
+            log::info("Predicted plan doesn't fit the records, planned every recipe again");
+        } else {
+            log::info("Reconciled predicted plan: {} ingredients and {} alchemy items differed, replanned {} of {} "
+                      "potion lines",
+                      result.ingredients, result.potions, result.signatures,
+                      predicted.plan.potionTiers.SignatureCount());
+        }
+        // a cached prediction that held needs no write
+        if (predicted.fingerprint && (!predicted.fromCache || result.ingredients || result.potions)) {
+            SavePlan(*predicted.fingerprint, predicted.plan);
+        }
+        return std::move(predicted.plan);
+    }
+
+    // Moves the finished plan out of pendingPlan and applies it to forms, waits for planning if it is still running.
+    // Must run on the game thread, does nothing once the plan is published.
+    inline void CommitPlan() {
+        if (planPublished || !pendingPlan.valid()) {
+            return;
+        }
+        try {
+            plan = pendingPlan.get();
+        } catch (const std::exception& e) {
+            log::error("Recipe planning failed: {}", e.what());
+            return;
+        }
+        log::info("Planned {} recipes", plan.recipes.Size());
+        AlchemyPlanner::ScopedTimer timer("init.commit");
+        const auto& config = Config::GetSingleton();
+
+        // rename ingredients by rarity
+        const auto& rarities = config.GetRules().rarities;
+        const auto verbose = config.GetDebug().IsVerbose();
+        ingredientBaseNames.clear();
+        ingredientBaseNames.reserve(ingredientForms.size());
+        for (auto ingredientItem : ingredientForms) {
+            ingredientBaseNames.emplace_back(ingredientItem->fullName.c_str());
+        }
+        ApplyIngredientNames(config);
+        std::vector<std::size_t> ingredientsByRarity(rarities.size());
+        for (AlchemyPlanner::Index i = 0; i < ingredientForms.size(); i++) {
+            auto rarity = plan.ingredientRarity[i];
+            ingredientsByRarity[rarity]++;
+            if (verbose) {
+                log::info("Ingredient: {}, {}", ingredientForms[i]->GetFullName(), rarities[rarity].name);
+            }
+        }
+        std::string rarityCounts;
+        for (std::size_t rarity = 0; rarity < rarities.size(); rarity++) {
+            rarityCounts +=
+                std::format("{}{} {}", rarity ? ", " : "", ingredientsByRarity[rarity], rarities[rarity].name);
+        }
+        log::info("Ingredients: {}", rarityCounts);
+
+        std::vector<std::size_t> potionsByLevel(static_cast<std::size_t>(plan.potionTiers.GetTierCount()));
+        std::size_t skippedPotions = 0;
+        for (AlchemyPlanner::Index i = 0; i < potionForms.size(); i++) {
+            auto alchItem = potionForms[i];
+            auto level = plan.potionLevel[i];
+            if (level > 0) {
+                potionsByLevel[level - 1]++;
+            } else if (level == 0) {
+                skippedPotions++;
+            }
+            if (!verbose) {
+                continue;
+            }
+            if (level > 0) {
+                log::info("Processing {}, isPoison: {}, Alchemy Level: {}", alchItem->GetFullName(),
+                          alchItem->IsPoison(), level);
+            } else if (level == 0) {
+                log::info("Skipping {}, isPoison: {}, No Alch level assigned", alchItem->GetFullName(),
+                          alchItem->IsPoison());
+            }
+        }
+        log::info("Craftable potions by level: {}, skipped without level keyword: {}", FormatLevels(potionsByLevel),
+                  skippedPotions);
+
+        // the projection is only known when the plan was built in this session, not read from the cache
+        if (!plan.projection.pairs.empty()) {
+            log::info("Projected recipes by level: pairs {}, triples {}", FormatLevels(plan.projection.pairs),
+                      FormatLevels(plan.projection.triples));
+        }
+
+        // create cobj objects
+        std::size_t createdRecipes;
+        {
+            AlchemyPlanner::ScopedTimer createTimer("init.createRecipes");
+            CreateVisibilityGate();
+            createdRecipes = poolMode ? CreateRecipePool(config.GetPerformanceConfig().recipePoolSize)
+                                      : CreateRecipes();
+        }
+        AlchemyPlanner::Metrics::GetSingleton().Add("recipes.created", createdRecipes);
+        pendingRecipes.Build(plan.recipes, ingredientForms.size());
+
+        LogRecipeSummary();
+        log::info("Total potion lines: {}", plan.potionTiers.SignatureCount());
+        log::info("Total ingredients: {}", ingredientForms.size());
+        log::info("Total recipes: {}", poolMode ? plan.recipes.Size() : createdRecipes);
+
+        // recipes carry their effect slots, the records are not needed anymore
+        AlchemyPlanner::ReleasePlanningScratch(plan);
+        loadOrder = {};
+
+        planPublished = true;
+        log::info("Initialization Completed");
+    }
+
+    // Plans the levels in levelMask (bit level - 1) again with the rules of the active config. COBJs of kept recipes
+    // move to their new rows. Forms can't be removed, so the COBJs of dropped recipes are retired hidden and the
+    // replanned recipes take them before new ones are created, repeated reloads don't grow the form count past the
+    // largest plan. The pool keeps its forms, only the plan changes. Must run on the game thread after the plan is
+    // published.
+    inline void ReplanRecipes(std::uint32_t levelMask) {
+        AlchemyPlanner::ScopedTimer timer("reload.replan");
+        const auto& config = Config::GetSingleton();
+        HideRevealedRecipes();
+        ResetVisibleRecipes();
+
+        const auto previousCount = plan.recipes.Size();
+        ReadRecords();
+        AlchemyPlanner::ClassifyIngredients(loadOrder, planKeywords, plan);
+        auto previousRows = AlchemyPlanner::ReplanLevels(
+            loadOrder, config.GetRules().recipeRules, plan, levelMask,
+            AlchemyPlanner::ResolveThreadCount(config.GetPerformanceConfig().workerThreads));
+        AlchemyPlanner::ReleasePlanningScratch(plan);
+        loadOrder = {};
+
+        std::size_t kept = 0;
+        while (kept < previousRows.size() && previousRows[kept] != AlchemyPlanner::kNoIndex) {
+            kept++;
+        }
+        const auto retired = previousCount - kept;
+        auto created = previousRows.size() - kept;
+        if (!poolMode) {
+            std::vector<BGSConstructibleObject*> forms(previousRows.size());
+            std::vector<TESConditionItem*> conditions(previousRows.size());
+            std::vector<std::uint8_t> keptRows(previousCount);
+            for (std::size_t i = 0; i < kept; i++) {
+                forms[i] = recipeForms[previousRows[i]];
+                conditions[i] = recipeConditions[previousRows[i]];
+                keptRows[previousRows[i]] = 1;
+            }
+            for (std::size_t row = 0; row < previousCount; row++) {
+                auto form = recipeForms[row];
+                if (keptRows[row] || !form) {
+                    continue;
                 }
+                // ResetVisibleRecipes withdrew them already, the allowed condition stays off until they are reused.
+                // The count in use is at most the entries the form holds, see SetIngredientEntries.
+                auto& retiredForms = form->requiredItems.numContainerObjects >= 3 ? retiredTriples : retiredPairs;
+                retiredForms.emplace_back(form, recipeConditions[row]);
             }
+            recipeForms = std::move(forms);
+            recipeConditions = std::move(conditions);
+            created = CreateRecipes(kept);
+            AlchemyPlanner::Metrics::GetSingleton().Add("recipes.created", created);
         }
+        pendingRecipes.Build(plan.recipes, ingredientForms.size());
+
+        log::info("Replanned levels {:b}: kept {} recipes, retired {}, created {}", levelMask, kept, retired, created);
+        LogRecipeSummary();
+    }
+
+    // Resolves perk again if its config entry changed, keeps the previous perk if the new one can't be found
+    inline bool UpdatePerk(BGSPerk*& perk, const FormRef& before, const FormRef& after, std::string_view name) {
+        if (before == after) {
+            return false;
+        }
+        auto updated = LookupForm<BGSPerk>(after);
+        if (!updated && after.IsSet()) {
+            log::error("Unable to load {} perk {}|{:X}, keeping the previous one", name, after.plugin, after.localId);
+            return false;
+        }
+        perk = updated;
+        return true;
     }
 
     class EventHandler : public BSTEventSink<TESFurnitureEvent> {
@@ -282,104 +991,38 @@ namespace {
                 return BSEventNotifyControl::kContinue;
             }
 
-            log::info("Accessing Workbench: {}, {}", event->targetFurniture->GetDisplayFullName(),
-                      event->type == TESFurnitureEvent::FurnitureEventType::kEnter ? "Enter" : "Exit");
-
-            auto level1Allowed = true;
-            auto level2Allowed = true;
-            auto level3Allowed = true;
-            auto level4Allowed = false;
-            auto level5Allowed = false;
+            if (Config::GetSingleton().GetDebug().IsVerbose()) {
+                log::info("Accessing Workbench: {}, {}", event->targetFurniture->GetDisplayFullName(),
+                          event->type == TESFurnitureEvent::FurnitureEventType::kEnter ? "Enter" : "Exit");
+            }
 
-            auto playerCharacter = PlayerCharacter::GetSingleton();
+            if (!planPublished) {
+                // reached a bench before the background build was committed, finish it here
+                log::info("Recipes are not ready yet, waiting for planning to finish");
+                CommitPlan();
+                if (!planPublished) {
+                    return BSEventNotifyControl::kContinue;
+                }
+            }
 
+            AlchemyPlanner::ScopedTimer timer(event->type == TESFurnitureEvent::FurnitureEventType::kEnter
+                                                  ? "workbench.enter"
+                                                  : "workbench.exit",
+                                              AlchemyPlanner::ScopedTimer::Kind::kLatency);
             if (event->type == TESFurnitureEvent::FurnitureEventType::kEnter) {
-                for (auto data : constructibleMetadata) {
-                    auto cobj = data.first;
-                    auto& metadata = data.second;
-                    auto potion = cobj->createdItem->As<AlchemyItem>();
-                    if (!potion || !potion->effects[0] || !potion->effects[0]->baseEffect) {
-                        continue;
-                    }
-
-                    int maxAllowedPotionLevel = 1;
-                    if (playerCharacter->HasPerk(level2Perk)) {
-                        maxAllowedPotionLevel = 2;
-                    }
-                    if (playerCharacter->HasPerk(level3Perk)) {
-                        maxAllowedPotionLevel = 3;
-                    }
-                    if (playerCharacter->HasPerk(level4Perk)) {
-                        maxAllowedPotionLevel = 4;
-                    }
-                    if (playerCharacter->HasPerk(level5Perk)) {
-                        maxAllowedPotionLevel = 5;
-                    }
-
-                    // must have perk to access it
-                    if (metadata.potionMinLevel == 2 && !playerCharacter->HasPerk(level2Perk)) {
-                        continue;
-                    }
-                    if (metadata.potionMinLevel == 3 && !playerCharacter->HasPerk(level3Perk)) {
-                        continue;
-                    }
-                    if (metadata.potionMinLevel == 4 && !playerCharacter->HasPerk(level4Perk)) {
-                        continue;
-                    }
-                    if (metadata.potionMinLevel == 5 && !playerCharacter->HasPerk(level5Perk)) {
-                        continue;
-                    }
-
-                    // adjust number of potions constructed if has corresponding perk
-                    if (doubleItemsPerk && playerCharacter->HasPerk(doubleItemsPerk)) {
-                        cobj->data.numConstructed = 2;
-                    }
-
-                    int increaseLevel = 0;
-
-                    if (potionQualityPerk && playerCharacter->HasPerk(potionQualityPerk) && !potion->IsPoison()) {
-                        increaseLevel++;
-                    }
-                    if (poisonQualityPerk && playerCharacter->HasPerk(poisonQualityPerk) && potion->IsPoison()) {
-                        increaseLevel++;
-                    }
-                    if (allQualityPerk && playerCharacter->HasPerk(allQualityPerk)) {
-                        increaseLevel++;
-                    }
-
-                    if (increaseLevel > 0) {
-                        int newLevel = metadata.potionMinLevel + increaseLevel;
-                        if (newLevel > maxAllowedPotionLevel) {
-                            newLevel = maxAllowedPotionLevel;
-                        }
-                        auto effect = potion->effects[0]->baseEffect;
-                        if (effect && potionsByEffect.contains(effect) && newLevel > metadata.potionMinLevel) {
-                            auto potionsVariations = potionsByEffect[effect];
-                            auto newPotion = GetHigherLevelPotion(potionsVariations, newLevel);
-                            if (newPotion) {
-                                cobj->createdItem = newPotion;
-                            }
-                        }
-                    }
-
-                    // Player must know effect in both ingredients
-                    auto potionEffect = potion->effects[0]->baseEffect;
-                    if (!HasKnownEffectInIngredients(cobj, potionEffect)) {
-                        continue;
-                    }
-
-                    // unhide recipe
-                    if (data.first->conditions.head) {
-                        data.first->conditions.head->data.comparisonValue.f = 1.0f;
-                    }
+                SnapshotKnownEffects();
+                auto perks = GetPerkSnapshot(PlayerCharacter::GetSingleton());
+                if (evaluatedPerks != perks) {
+                    ApplyPerks(perks);
+                } else {
+                    RevealKnownRecipes();
                 }
+
+                // unhide recipes
+                RevealRecipes();
             } else {
-                // Mark all recipes hidden again
-                for (auto data : constructibleMetadata) {
-                    if (data.first->conditions.head) {
-                        data.first->conditions.head->data.comparisonValue.f = 0.0f;
-                    }
-                }
+                // Mark unhidden recipes hidden again
+                HideRevealedRecipes();
             }
 
             return BSEventNotifyControl::kContinue;
@@ -387,70 +1030,143 @@ namespace {
     };
 }  // namespace
 
-void AlchmeyDistributor::Initialize() {
-    const auto dataHandler = TESDataHandler::GetSingleton();
+void AlchmeyDistributor::OnGameLoaded() {
+    // known effects of another save can differ even if its perks are the same
+    HideRevealedRecipes();
+    evaluatedPerks.reset();
+}
 
-    alchemyKeyword = TESForm::LookupByID<BGSKeyword>(0x0004F6E6);
-    auto craftableKeyword = dataHandler->LookupForm<BGSKeyword>(0x800, "AlchemyReworked.esp");
-
-    level1Keyword = dataHandler->LookupForm<BGSKeyword>(0x801, "AlchemyReworked.esp");
-    level2Keyword = dataHandler->LookupForm<BGSKeyword>(0x802, "AlchemyReworked.esp");
-    level3Keyword = dataHandler->LookupForm<BGSKeyword>(0x803, "AlchemyReworked.esp");
-    level4Keyword = dataHandler->LookupForm<BGSKeyword>(0x804, "AlchemyReworked.esp");
-    level5Keyword = dataHandler->LookupForm<BGSKeyword>(0x805, "AlchemyReworked.esp");
-
-    auto commonIngrKeyword = dataHandler->LookupForm<BGSKeyword>(0x806, "AlchemyReworked.esp");
-    auto uncommonIngrKeyword = dataHandler->LookupForm<BGSKeyword>(0x807, "AlchemyReworked.esp");
-    auto rareIngrKeyword = dataHandler->LookupForm<BGSKeyword>(0x808, "AlchemyReworked.esp");
-
-    auto config = Config::GetSingleton();
-    level2Perk = LoadPerkFromConfig(config.GetPerksConfig().level2Perk);
-    level3Perk = LoadPerkFromConfig(config.GetPerksConfig().level3Perk);
-    level4Perk = LoadPerkFromConfig(config.GetPerksConfig().level4Perk);
-    level5Perk = LoadPerkFromConfig(config.GetPerksConfig().level5Perk);
-    potionQualityPerk = LoadPerkFromConfig(config.GetPerksConfig().potionQualityPerk);
-    poisonQualityPerk = LoadPerkFromConfig(config.GetPerksConfig().poisonQualityPerk);
-    allQualityPerk = LoadPerkFromConfig(config.GetPerksConfig().allQualityPerk);
-    doubleItemsPerk = LoadPerkFromConfig(config.GetPerksConfig().doubleItemsPerk);
-
-    if (!level2Perk) {
-        log::error("Unable to load level2 perk from config");
+void AlchmeyDistributor::OnDataLoaded() {
+    const auto& config = Config::GetSingleton();
+    const auto& performance = config.GetPerformanceConfig();
+    // a prebuilt plan needs no planning, KID may also have been done before the game data message got here
+    if (!performance.earlyPlanning || performance.prebuiltPlan || pendingPlan.valid() || planPublished) {
         return;
     }
-    if (!level3Perk) {
-        log::error("Unable to load level3 perk from config");
+    AlchemyPlanner::ScopedTimer timer("init.dataLoaded");
+    const auto& rules = config.GetRules();
+    AlchemyPlanner::Keywords keywords;
+    if (!BuildKeywords(rules, keywords)) {
         return;
     }
-    if (!level4Perk) {
-        log::error("Unable to load level4 perk from config");
-        return;
+
+    // every ini KID reads, it looks for *_KID.ini in Data
+    std::vector<AlchemyPlanner::KidIni> inis;
+    std::vector<std::string> errors;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator("Data", error)) {
+        auto name = entry.path().filename().string();
+        if (!entry.is_regular_file(error) || name.size() <= 8 ||
+            !AlchemyPlanner::EqualsIgnoreCase(std::string_view(name).substr(name.size() - 8), "_KID.ini")) {
+            continue;
+        }
+        if (!AlchemyPlanner::ReadKidIni(entry.path(), inis.emplace_back(), errors)) {
+            log::warn("Unable to read {}", name);
+            inis.pop_back();
+        }
+    }
+    // rules KID resolves at runtime (traits, chances) are left to reconciling
+    for (const auto& message : errors) {
+        log::debug("KID prediction: {}", message);
+    }
+
+    CollectForms();
+    ReadRecords();
+    auto file = DescribeLoadOrder();
+    loadOrder = {};
+    // other keywords don't change the plan, their rules aren't matched
+    std::vector<AlchemyPlanner::FormID> planningKeywords{keywords.craftable};
+    planningKeywords.insert(planningKeywords.end(), keywords.levels.begin(), keywords.levels.end());
+    for (const auto& rarityKeyword : keywords.rarities) {
+        planningKeywords.push_back(rarityKeyword.first);
     }
-    if (!level5Perk) {
-        log::error("Unable to load level5 perk from config");
+    std::erase(planningKeywords, AlchemyPlanner::FormID{0});
+
+    std::optional<std::string> version;
+    if (performance.planCache) {
+        version = PluginDeclaration::GetSingleton()->GetVersion().string();
+    }
+    auto workerThreads = AlchemyPlanner::ResolveThreadCount(performance.workerThreads);
+    predictedPlan = std::async(std::launch::async, [file = std::move(file), inis = std::move(inis), keywords,
+                                                    recipeRules = rules.recipeRules, workerThreads, version,
+                                                    planningKeywords = std::move(planningKeywords)]() mutable {
+        AlchemyPlanner::ScopedTimer predictTimer("init.predictPlan");
+        std::vector<std::string> kidErrors;
+        auto added = AlchemyPlanner::ApplyKidRules(inis, file, kidErrors, planningKeywords);
+        PredictedPlan predicted;
+        if (version) {
+            predicted.fingerprint = AlchemyPlanner::GetPlanFingerprint(file.loadOrder, keywords, recipeRules, *version);
+            predicted.fromCache = AlchemyPlanner::LoadPlanCache(kPlanCachePath, *predicted.fingerprint,
+                                                                file.loadOrder, predicted.plan);
+        }
+        if (predictionDiscarded) {
+            return predicted;
+        }
+        if (!predicted.fromCache) {
+            predicted.plan = AlchemyPlanner::BuildPlan(file.loadOrder, keywords, recipeRules, workerThreads);
+        }
+        log::info("Predicted {} keywords from {} KID inis, {} {} recipes", added, inis.size(),
+                  predicted.fromCache ? "loaded" : "planned", predicted.plan.recipes.Size());
+        return predicted;
+    });
+    log::info("Planning recipes from the KID inis while KID distributes keywords");
+}
+
+void AlchmeyDistributor::Initialize() {
+    // time the KID callback is blocked for, planning in the background is reported separately
+    AlchemyPlanner::ScopedTimer timer("init.kidCallback");
+    const auto dataHandler = TESDataHandler::GetSingleton();
+
+    alchemyKeyword = TESForm::LookupByID<BGSKeyword>(0x0004F6E6);
+
+    // config entries are parsed and validated when the config is loaded, only the lookups happen here
+    const auto& config = Config::GetSingleton();
+    const auto& rules = config.GetRules();
+    const auto levelCount = static_cast<int>(rules.levelKeywords.size());
+    poolMode = config.GetPerformanceConfig().recipePool;
+
+    AlchemyPlanner::Keywords keywords;
+    if (!BuildKeywords(rules, keywords)) {
+        DiscardPrediction();
         return;
     }
-    if (config.GetPerksConfig().potionQualityPerk != "") {
+
+    levelPerks.assign(static_cast<std::size_t>(levelCount), nullptr);
+    for (int level = 2; level <= levelCount; level++) {
+        levelPerks[level - 1] = LookupForm<BGSPerk>(rules.levelPerks[level - 1]);
+        if (!levelPerks[level - 1]) {
+            log::error("Unable to load level{} perk from config", level);
+            DiscardPrediction();
+            return;
+        }
+    }
+    potionQualityPerk = LookupForm<BGSPerk>(rules.potionQualityPerk);
+    poisonQualityPerk = LookupForm<BGSPerk>(rules.poisonQualityPerk);
+    allQualityPerk = LookupForm<BGSPerk>(rules.allQualityPerk);
+    doubleItemsPerk = LookupForm<BGSPerk>(rules.doubleItemsPerk);
+
+    if (rules.potionQualityPerk.IsSet()) {
         if (potionQualityPerk) {
             log::info("Loaded perk for potion +1 level");
         } else {
             log::info("Unable to load perk for potion +1 level");
         }
     }
-    if (config.GetPerksConfig().poisonQualityPerk != "") {
+    if (rules.poisonQualityPerk.IsSet()) {
         if (poisonQualityPerk) {
             log::info("Loaded perk for poison +1 level");
         } else {
             log::info("Unable to load perk for poison +1 level");
         }
     }
-    if (config.GetPerksConfig().allQualityPerk != "") {
+    if (rules.allQualityPerk.IsSet()) {
         if (allQualityPerk) {
             log::info("Loaded perk for all +1 level");
         } else {
             log::info("Unable to load perk for all +1 level");
         }
     }
-    if (config.GetPerksConfig().doubleItemsPerk != "") {
+    if (rules.doubleItemsPerk.IsSet()) {
         if (doubleItemsPerk) {
             log::info("Loaded perk for double potions");
         } else {
@@ -466,171 +1182,175 @@ void AlchmeyDistributor::Initialize() {
         }
     }
 
-    // categorize and store ingredients by rarity
-    for (auto ingredientItem : dataHandler->GetFormArray<IngredientItem>()) {
-        if (!ingredientItem) {
-            continue;
-        }
-
-        BGSKeyword* keyword;
+    CollectForms();
+    ReadRecords();
+    planKeywords = keywords;
+    if (config.GetPerformanceConfig().exportLoadOrder) {
+        ExportLoadOrder();
+    }
 
-        if (ingredientItem->HasKeyword(commonIngrKeyword)) {
-            keyword = commonIngrKeyword;
-            commonIngredients.push_back(ingredientItem);
-            if (config.GetIngrConfig().renameIngredients) {
-                ingredientItem->fullName = BSFixedString(std::string(ingredientItem->fullName.c_str()) + " " +
-                                                         config.GetIngrConfig().commonSuffix);
-            }
-        } else if (ingredientItem->HasKeyword(uncommonIngrKeyword)) {
-            keyword = uncommonIngrKeyword;
-            uncommonIngredients.push_back(ingredientItem);
-            if (config.GetIngrConfig().renameIngredients) {
-                ingredientItem->fullName = BSFixedString(std::string(ingredientItem->fullName.c_str()) + " " +
-                                                         config.GetIngrConfig().uncommonSuffix);
-            }
-        } else if (ingredientItem->HasKeyword(rareIngrKeyword)) {
-            keyword = rareIngrKeyword;
-            rareIngredients.push_back(ingredientItem);
-            if (config.GetIngrConfig().renameIngredients) {
-                ingredientItem->fullName = BSFixedString(std::string(ingredientItem->fullName.c_str()) + " " +
-                                                         config.GetIngrConfig().rareSuffix);
-            }
-        } else {
-            // Non-keyworded ingredients are uncommon
-            // TODO: make conf option for this
-            uncommonIngredients.push_back(ingredientItem);
-            keyword = uncommonIngrKeyword;
-            if (config.GetIngrConfig().renameIngredients) {
-                ingredientItem->fullName = BSFixedString(std::string(ingredientItem->fullName.c_str()) + " " +
-                                                         config.GetIngrConfig().uncommonSuffix);
-            }
-        }
+    const auto& recipeRules = rules.recipeRules;
+    // a plan loaded from disk is committed right away like a finished build
+    auto commitLoaded = [](AlchemyPlanner::Plan loaded) {
+        DiscardPrediction();
+        std::promise<AlchemyPlanner::Plan> ready;
+        ready.set_value(std::move(loaded));
+        pendingPlan = ready.get_future();
+        CommitPlan();
+        ScriptEventSourceHolder::GetSingleton()->GetEventSource<TESFurnitureEvent>()->AddEventSink(
+            EventHandler::GetSingleton());
+    };
 
-        if (keyword) {
-            log::info("Ingredient: {}, {}", ingredientItem->GetFullName(), keyword->GetFormEditorID());
+    if (config.GetPerformanceConfig().prebuiltPlan) {
+        // compiled offline, so the fingerprint uses the version the compiler knows instead of the plugin declaration
+        auto prebuiltFingerprint = AlchemyPlanner::GetPlanFingerprint(loadOrder, keywords, recipeRules,
+                                                                      AlchemyPlanner::kPrebuiltPlanVersion);
+        AlchemyPlanner::Plan prebuilt;
+        if (AlchemyPlanner::LoadPlanCache(kPrebuiltPlanPath, prebuiltFingerprint, loadOrder, prebuilt)) {
+            log::info("Loaded {} recipes from prebuilt plan {:016x}", prebuilt.recipes.Size(), prebuiltFingerprint);
+            commitLoaded(std::move(prebuilt));
+            return;
         }
+        log::warn("Prebuilt plan {} is missing or doesn't match this load order ({:016x}), planning recipes",
+                  kPrebuiltPlanPath, prebuiltFingerprint);
     }
 
-    // Categorize and store potions & poisons by rarity
-    for (auto alchItem : dataHandler->GetFormArray<AlchemyItem>()) {
-        if (!alchItem) {
-            continue;
-        }
-        if (!alchItem->HasKeyword(craftableKeyword)) {
-            continue;
-        }
-        // skip multi-effect potions
-        if (alchItem->effects.size() != 1) {
-            continue;
-        }
-        int level = 0;
-        auto potionEffect = alchItem->effects[0]->baseEffect;
-        if (alchItem->HasKeyword(level1Keyword)) {
-            level = 1;
-            potionsByEffect[potionEffect].level1 = alchItem;
-        } else if (alchItem->HasKeyword(level2Keyword)) {
-            level = 2;
-            potionsByEffect[potionEffect].level2 = alchItem;
-        } else if (alchItem->HasKeyword(level3Keyword)) {
-            level = 3;
-            potionsByEffect[potionEffect].level3 = alchItem;
-        } else if (alchItem->HasKeyword(level4Keyword)) {
-            level = 4;
-            potionsByEffect[potionEffect].level4 = alchItem;
-        } else if (alchItem->HasKeyword(level5Keyword)) {
-            level = 5;
-            potionsByEffect[potionEffect].level5 = alchItem;
-        }
-        if (level != 0) {
-            log::info("Processing {}, isPoison: {}, Alchemy Level: {}", alchItem->GetFullName(), alchItem->IsPoison(),
-                      level);
-        } else {
-            log::info("Skipping {}, isPoison: {}, No Alch level assigned", alchItem->GetFullName(),
-                      alchItem->IsPoison());
+    // records are read on this thread, planning only touches the records so it can fan out to workers. Forms are
+    // mutated by CommitPlan on the game thread in table order, which keeps form ids of created recipes stable.
+    auto workerThreads = AlchemyPlanner::ResolveThreadCount(config.GetPerformanceConfig().workerThreads);
+    std::optional<std::uint64_t> fingerprint;
+    if (predictedPlan.valid()) {
+        // the prediction was looked up in the cache already, planning reconciles it with these records
+        log::info("Reconciling the plan predicted from the KID inis");
+    } else if (config.GetPerformanceConfig().planCache) {
+        fingerprint = AlchemyPlanner::GetPlanFingerprint(
+            loadOrder, keywords, recipeRules, PluginDeclaration::GetSingleton()->GetVersion().string());
+        AlchemyPlanner::Plan cached;
+        if (AlchemyPlanner::LoadPlanCache(kPlanCachePath, *fingerprint, loadOrder, cached)) {
+            log::info("Loaded {} recipes from plan cache {:016x}", cached.recipes.Size(), *fingerprint);
+            commitLoaded(std::move(cached));
+            return;
         }
+        log::info("Plan cache {:016x} not found or outdated, planning recipes", *fingerprint);
     }
 
-    // create cobj objects
-    const auto factory = IFormFactory::GetConcreteFormFactoryByType<BGSConstructibleObject>();
-    auto playerRef = PlayerCharacter::GetSingleton();
+    if (!config.GetPerformanceConfig().asyncInitialization) {
+        // deferred, planning runs inside CommitPlan on this thread
+        pendingPlan = std::async(std::launch::deferred, [keywords, recipeRules, workerThreads, fingerprint]() {
+            return PlanAndCache(keywords, recipeRules, workerThreads, fingerprint);
+        });
+        CommitPlan();
+        ScriptEventSourceHolder::GetSingleton()->GetEventSource<TESFurnitureEvent>()->AddEventSink(
+            EventHandler::GetSingleton());
+        return;
+    }
 
-    for (const auto& data : potionsByEffect) {
-        auto effect = data.first;
-        auto potions = data.second;
+    // the sink is registered now so it can commit the plan itself if the player gets to a bench first
+    ScriptEventSourceHolder::GetSingleton()->GetEventSource<TESFurnitureEvent>()->AddEventSink(
+        EventHandler::GetSingleton());
+    pendingPlan = std::async(std::launch::async, [keywords, recipeRules, workerThreads, fingerprint]() {
+        // queued on the way out so a failed build is reported by CommitPlan as well
+        struct QueueCommit {
+            ~QueueCommit() { GetTaskInterface()->AddTask([]() { CommitPlan(); }); }
+        } queueCommit;
+        return PlanAndCache(keywords, recipeRules, workerThreads, fingerprint);
+    });
+    log::info("Planning recipes in the background using {} threads", workerThreads);
+}
 
-        // int minLevel = 0;
-        // auto minPotion = GetEarliestLevelPotion(potions, &minLevel);
-        // if (!minPotion || minLevel == 0) {
-        //     continue;
-        // }
+void AlchmeyDistributor::ReloadConfig() {
+    if (!planPublished) {
+        log::warn("Recipes are not built yet, config reload skipped");
+        return;
+    }
+    AlchemyPlanner::ScopedTimer timer("reload.total");
+    log::info("Reloading config");
+    auto previous = Config::Reload();
+    const auto& config = Config::GetSingleton();
+    for (const auto& error : config.GetErrors()) {
+        log::error("Config: {}", error);
+    }
+    const auto& before = previous.GetRules();
+    const auto& after = config.GetRules();
 
-        auto filterEffect = [effect](IngredientItem* ingr) {
-            for (const auto ingrEffect : ingr->effects) {
-                if (ingrEffect->baseEffect == effect) {
-                    return true;
-                }
-            }
+    // recipes and ingredients refer to levels and rarities by position, changing them needs a full build
+    auto sameTiers = [&]() {
+        if (before.rarities.size() != after.rarities.size()) {
             return false;
-        };
-
-        IngredientArr effectCommonIngredients;
-        std::copy_if(commonIngredients.begin(), commonIngredients.end(), std::back_inserter(effectCommonIngredients),
-                     filterEffect);
-
-        IngredientArr effectUncommonIngredients;
-        std::copy_if(uncommonIngredients.begin(), uncommonIngredients.end(),
-                     std::back_inserter(effectUncommonIngredients), filterEffect);
-
-        IngredientArr effectRareIngredients;
-        std::copy_if(rareIngredients.begin(), rareIngredients.end(), std::back_inserter(effectRareIngredients),
-                     filterEffect);
-
-        // ingredient rules:
-        // common + common = level 1
-        // common + uncommon = level 2
-        // common + rare = level 3
-        // uncommon + uncommon = level 3
-        // uncommon + rare = level 4
-        // rare + rare = level 5
-
-        if (potions.level1) {
-            auto lists = GetIngredientListForCrafting(config.GetCobjConfig().level1Recipe, effectCommonIngredients,
-                                                      effectUncommonIngredients, effectRareIngredients);
-            CreateRecipes(lists.first, lists.second, potions.level1, 1, 1);
-        }
-        if (potions.level2) {
-            auto lists = GetIngredientListForCrafting(config.GetCobjConfig().level2Recipe, effectCommonIngredients,
-                                                      effectUncommonIngredients, effectRareIngredients);
-            CreateRecipes(lists.first, lists.second, potions.level2, 2, 2);
-        }
-        if (potions.level3) {
-            auto lists = GetIngredientListForCrafting(config.GetCobjConfig().level3Recipe, effectCommonIngredients,
-                                                      effectUncommonIngredients, effectRareIngredients);
-            CreateRecipes(lists.first, lists.second, potions.level3, 3, 3);
-            // alt
-            auto listsAlt =
-                GetIngredientListForCrafting(config.GetCobjConfig().level3RecipeAlt, effectCommonIngredients,
-                                             effectUncommonIngredients, effectRareIngredients);
-            CreateRecipes(listsAlt.first, listsAlt.second, potions.level3, 3, 3);
-        }
-        if (potions.level4) {
-            auto lists = GetIngredientListForCrafting(config.GetCobjConfig().level4Recipe, effectCommonIngredients,
-                                                      effectUncommonIngredients, effectRareIngredients);
-            CreateRecipes(lists.first, lists.second, potions.level4, 4, 4);
-        }
-        if (potions.level5) {
-            auto lists = GetIngredientListForCrafting(config.GetCobjConfig().level5Recipe, effectCommonIngredients,
-                                                      effectUncommonIngredients, effectRareIngredients);
-            CreateRecipes(lists.first, lists.second, potions.level5, 5, 5);
-        }
-    }
-
-    log::info("Total potions: {}", potionsByEffect.size());
-    log::info("Total ingredients: {}", commonIngredients.size() + uncommonIngredients.size() + rareIngredients.size());
-    log::info("Total recipes: {}", constructibleMetadata.size());
+        }
+        for (std::size_t rarity = 0; rarity < after.rarities.size(); rarity++) {
+            if (before.rarities[rarity].keywords != after.rarities[rarity].keywords) {
+                return false;
+            }
+        }
+        return true;
+    };
+    if (before.levelKeywords != after.levelKeywords || before.defaultRarity != after.defaultRarity || !sameTiers()) {
+        log::warn("Potion levels or rarity tiers changed, restart the game to apply the new config");
+        Config::Restore(std::move(previous));
+        return;
+    }
 
-    ScriptEventSourceHolder::GetSingleton()->GetEventSource<TESFurnitureEvent>()->AddEventSink(
-        EventHandler::GetSingleton());
+    auto logger = spdlog::default_logger();
+    logger->set_level(config.GetDebug().GetLogLevel());
+    logger->flush_on(config.GetDebug().GetFlushLevel());
+    const auto& performanceBefore = previous.GetPerformanceConfig();
+    const auto& performanceAfter = config.GetPerformanceConfig();
+    if (performanceBefore.recipePool != performanceAfter.recipePool ||
+        performanceBefore.recipePoolSize != performanceAfter.recipePoolSize) {
+        log::warn("Recipe pool settings apply after a restart");
+    }
+
+    bool perksChanged = false;
+    for (std::size_t level = 2; level <= levelPerks.size(); level++) {
+        perksChanged |= UpdatePerk(levelPerks[level - 1], before.levelPerks[level - 1], after.levelPerks[level - 1],
+                                   std::format("level{}", level));
+    }
+    perksChanged |= UpdatePerk(potionQualityPerk, before.potionQualityPerk, after.potionQualityPerk, "potion quality");
+    perksChanged |= UpdatePerk(poisonQualityPerk, before.poisonQualityPerk, after.poisonQualityPerk, "poison quality");
+    perksChanged |= UpdatePerk(allQualityPerk, before.allQualityPerk, after.allQualityPerk, "all quality");
+    perksChanged |= UpdatePerk(doubleItemsPerk, before.doubleItemsPerk, after.doubleItemsPerk, "double items");
+
+    if (previous.GetIngrConfig().renameIngredients != config.GetIngrConfig().renameIngredients ||
+        before.rarities != after.rarities) {
+        ApplyIngredientNames(config);
+        log::info("Renamed ingredients");
+    }
 
-    log::info("Initialization Completed");
+    const auto& beforeRecipes = before.recipeRules;
+    const auto& afterRecipes = after.recipeRules;
+    auto getTriples = [](const AlchemyPlanner::RecipeRules& rules, std::size_t level) {
+        return level <= rules.tripleLevels.size() ? rules.tripleLevels[level - 1]
+                                                  : std::vector<AlchemyPlanner::RarityTriple>{};
+    };
+    std::uint32_t levelMask = 0;
+    std::uint32_t tripleMask = 0;
+    bool pairsChanged = false;
+    for (std::size_t level = 1; level <= afterRecipes.levels.size(); level++) {
+        auto triplesBefore = getTriples(beforeRecipes, level);
+        auto triplesAfter = getTriples(afterRecipes, level);
+        if (!triplesBefore.empty() || !triplesAfter.empty()) {
+            tripleMask |= 1u << (level - 1);
+        }
+        if (beforeRecipes.levels[level - 1] != afterRecipes.levels[level - 1]) {
+            levelMask |= 1u << (level - 1);
+            pairsChanged = true;
+        } else if (triplesBefore != triplesAfter) {
+            levelMask |= 1u << (level - 1);
+        }
+    }
+    // triples are pruned against the pairs of every level, so changed pairs or a changed cap replan all of them
+    if (pairsChanged || beforeRecipes.maxTriplesPerSignature != afterRecipes.maxTriplesPerSignature) {
+        levelMask |= tripleMask;
+    }
+    if (levelMask) {
+        ReplanRecipes(levelMask);
+    }
+
+    if (perksChanged || levelMask) {
+        // lists are rebuilt on the next bench access
+        evaluatedPerks.reset();
+    }
+    log::info("Config reloaded, {} levels replanned, perks {}", std::popcount(levelMask),
+              perksChanged ? "updated" : "unchanged");
 }
@@ -1,5 +1,10 @@
 #pragma once
 
 namespace AlchmeyDistributor {
+    // Starts planning from the keywords the KID inis are expected to distribute, Initialize reconciles that plan
+    void OnDataLoaded();
     void Initialize();
+    void OnGameLoaded();
+    // Applies a changed AlchemyReworked.yaml to the running game, game thread only
+    void ReloadConfig();
 }
\ No newline at end of file
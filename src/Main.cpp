@@ -2,6 +2,7 @@
 
 #include "Config.h"
 #include "Distributor.h"
+#include "Planner/Metrics.h"
 
 using namespace RE::BSScript;
 using namespace SKSE;
@@ -9,6 +10,35 @@ using namespace SKSE::log;
 using namespace SKSE::stl;
 
 namespace {
+    // sink behind the async logger, exit time lines are written to it from the exiting thread
+    spdlog::sink_ptr logSink;
+
+    // Hands lines below warn to the async logger. Warnings and errors skip the queue and are written to the sink on
+    // the calling thread, so a burst of debug lines overrunning the ring buffer can't drop them.
+    class QueueBelowWarnSink final : public spdlog::sinks::base_sink<spdlog::details::null_mutex> {
+    public:
+        QueueBelowWarnSink(std::shared_ptr<spdlog::async_logger> queue, spdlog::sink_ptr sink)
+            : _queue(std::move(queue)), _sink(std::move(sink)) {}
+
+    protected:
+        void sink_it_(const spdlog::details::log_msg& msg) override {
+            if (msg.level < spdlog::level::warn) {
+                _queue->log(msg.time, msg.source, msg.level, msg.payload);
+            } else {
+                _sink->log(msg);
+            }
+        }
+
+        void flush_() override {
+            _queue->flush();
+            _sink->flush();
+        }
+
+    private:
+        std::shared_ptr<spdlog::async_logger> _queue;
+        spdlog::sink_ptr _sink;
+    };
+
     class KIDEventHandler : public RE::BSTEventSink<SKSE::ModCallbackEvent> {
     public:
         static KIDEventHandler* GetSingleton() {
@@ -61,19 +91,57 @@ namespace {
         *path /= PluginDeclaration::GetSingleton()->GetName();
         *path += L".log";
 
-        std::shared_ptr<spdlog::logger> log;
+        const auto& debugConfig = Config::GetSingleton().GetDebug();
+        // Lines below warn are formatted on the calling thread and written by a single background thread. The queue
+        // is a bounded ring buffer, when it is full the oldest lines are dropped instead of stalling the game.
+        // Warnings and errors are rare and written synchronously, they are never dropped.
+        spdlog::init_thread_pool(debugConfig.GetLogQueueSize(), 1);
+        spdlog::sink_ptr sink;
         if (IsDebuggerPresent()) {
-            log = std::make_shared<spdlog::logger>("Global", std::make_shared<spdlog::sinks::msvc_sink_mt>());
+            sink = std::make_shared<spdlog::sinks::msvc_sink_mt>();
         } else {
-            log = std::make_shared<spdlog::logger>(
-                "Global", std::make_shared<spdlog::sinks::basic_file_sink_mt>(path->string(), true));
+            sink = std::make_shared<spdlog::sinks::basic_file_sink_mt>(path->string(), true);
         }
-        const auto& debugConfig = Config::GetSingleton().GetDebug();
+        // both paths end in this sink, it formats every line the same way
+        sink->set_pattern("[%Y-%m-%d %H:%M:%S.%e] [%n] [%l] [%t] [%s:%#] %v");
+        logSink = sink;
+        // the default logger filters by level, the queue takes whatever it is handed
+        auto queue = std::make_shared<spdlog::async_logger>("Global", sink, spdlog::thread_pool(),
+                                                            spdlog::async_overflow_policy::overrun_oldest);
+        queue->set_level(spdlog::level::trace);
+        auto log = std::make_shared<spdlog::logger>("Global",
+                                                    std::make_shared<QueueBelowWarnSink>(std::move(queue), sink));
         log->set_level(debugConfig.GetLogLevel());
         log->flush_on(debugConfig.GetFlushLevel());
 
         spdlog::set_default_logger(std::move(log));
-        spdlog::set_pattern("[%Y-%m-%d %H:%M:%S.%e] [%n] [%l] [%t] [%s:%#] %v");
+        // below flushLevel lines still reach the file every few seconds
+        spdlog::flush_every(std::chrono::seconds(3));
+    }
+
+    /**
+     * Write collected metrics to the log and to <code>AlchemyReworked.stats.json</code> next to it.
+     *
+     * <p>
+     * Called when the game saves and when it exits, so the stats file is there even if the game doesn't shut down
+     * cleanly. Only the exit dump goes to the log.
+     * </p>
+     */
+    void DumpMetrics(bool toLog) {
+        const auto& metrics = AlchemyPlanner::Metrics::GetSingleton();
+        if (toLog) {
+            log::info("Metrics summary:");
+            metrics.ForEachSummaryLine([](const std::string& line) { log::info("  {}", line); });
+        }
+        auto path = log_directory();
+        if (!path) {
+            return;
+        }
+        *path /= PluginDeclaration::GetSingleton()->GetName();
+        *path += L".stats.json";
+        if (!metrics.WriteJson(*path)) {
+            log::warn("Unable to write metrics to {}", path->string());
+        }
     }
 
     /**
@@ -116,14 +184,22 @@ namespace {
      * additional functions.
      * </p>
      */
-    // void InitializePapyrus() {
-    //     log::trace("Initializing Papyrus binding...");
-    //     if (GetPapyrusInterface()->Register(Sample::RegisterHitCounter)) {
-    //         log::debug("Papyrus functions bound.");
-    //     } else {
-    //         stl::report_and_fail("Failure to register Papyrus bindings.");
-    //     }
-    // }
+    void InitializePapyrus() {
+        log::trace("Initializing Papyrus binding...");
+        // AlchemyReworked.ReloadConfig(), also reachable from the console with cgf "AlchemyReworked.ReloadConfig"
+        auto registerFunctions = [](IVirtualMachine* vm) {
+            vm->RegisterFunction("ReloadConfig", "AlchemyReworked", [](RE::StaticFunctionTag*) {
+                // Papyrus runs on its own threads, forms and the recipe lists belong to the game thread
+                GetTaskInterface()->AddTask([]() { AlchmeyDistributor::ReloadConfig(); });
+            });
+            return true;
+        };
+        if (GetPapyrusInterface()->Register(registerFunctions)) {
+            log::debug("Papyrus functions bound.");
+        } else {
+            stl::report_and_fail("Failure to register Papyrus bindings.");
+        }
+    }
 
     /**
      * Initialize the trampoline space for function hooks.
@@ -189,17 +265,22 @@ namespace {
                                                            // active.
                         // It is now safe to access form data.
                         // AlchmeyDistributor::InstallHooks();
+                        AlchmeyDistributor::OnDataLoaded();
                         break;
 
                     // Skyrim game events.
-                    case MessagingInterface::kNewGame:      // Player starts a new game from main menu.
-                    case MessagingInterface::kPreLoadGame:  // Player selected a game to load, but it hasn't loaded yet.
-                                                            // Data will be the name of the loaded save.
+                    case MessagingInterface::kNewGame:       // Player starts a new game from main menu.
                     case MessagingInterface::kPostLoadGame:  // Player's selected save game has finished loading.
                                                              // Data will be a boolean indicating whether the load was
                                                              // successful.
-                    case MessagingInterface::kSaveGame:      // The player has saved a game.
-                                                             // Data will be the save name.
+                        AlchmeyDistributor::OnGameLoaded();
+                        break;
+                    case MessagingInterface::kSaveGame:  // The player has saved a game.
+                                                         // Data will be the save name.
+                        DumpMetrics(false);
+                        break;
+                    case MessagingInterface::kPreLoadGame:  // Player selected a game to load, but it hasn't loaded yet.
+                                                            // Data will be the name of the loaded save.
                     case MessagingInterface::kDeleteGame:  // The player deleted a saved game from within the load menu.
                         break;
                 }
@@ -225,11 +306,27 @@ SKSEPluginLoad(const LoadInterface* skse) {
     auto* plugin = PluginDeclaration::GetSingleton();
     auto version = plugin->GetVersion();
     log::info("{} {} is loading...", plugin->GetName(), version);
+    for (const auto& error : Config::GetSingleton().GetErrors()) {
+        log::error("Config: {}", error);
+    }
 
     Init(skse);
     InitializeMessaging();
+    std::atexit([]() {
+        // The writer thread of the async logger may already be gone when the process exits and this runs under the
+        // loader lock, so neither the queue nor the thread are touched. The summary goes to the sink synchronously.
+        if (logSink) {
+            auto exitLogger = std::make_shared<spdlog::logger>("Global", logSink);
+            exitLogger->set_level(Config::GetSingleton().GetDebug().GetLogLevel());
+            spdlog::set_default_logger(std::move(exitLogger));
+        }
+        DumpMetrics(true);
+        if (logSink) {
+            logSink->flush();
+        }
+    });
     // InitializeSerialization();
-    // InitializePapyrus();
+    InitializePapyrus();
 
     log::info("{} has finished loading.", plugin->GetName());
     return true;
@@ -104,6 +104,8 @@
 #include <Psapi.h>
 #undef cdecl // Workaround for Clang 14 CMake configure error.
 
+#include <spdlog/async.h>
+#include <spdlog/sinks/base_sink.h>
 #include <spdlog/sinks/basic_file_sink.h>
 #include <spdlog/sinks/msvc_sink.h>
 
@@ -0,0 +1,151 @@
+#include "CraftingRules.h"
+
+#include <algorithm>
+#include <charconv>
+
+namespace AlchemyPlanner {
+    namespace {
+        std::string_view Trim(std::string_view value) {
+            auto begin = value.find_first_not_of(" \t\r");
+            if (begin == std::string_view::npos) {
+                return {};
+            }
+            return value.substr(begin, value.find_last_not_of(" \t\r") - begin + 1);
+        }
+
+        // Comma separated entries, blank entries are skipped
+        std::vector<std::string_view> SplitList(std::string_view value) {
+            std::vector<std::string_view> entries;
+            while (!value.empty()) {
+                auto delimiter = value.find(',');
+                auto entry = Trim(value.substr(0, delimiter));
+                if (!entry.empty()) {
+                    entries.push_back(entry);
+                }
+                if (delimiter == std::string_view::npos) {
+                    break;
+                }
+                value.remove_prefix(delimiter + 1);
+            }
+            return entries;
+        }
+
+        // entry i of a list, empty past its end
+        std::string_view At(const std::vector<std::string>& list, std::size_t i) {
+            return i < list.size() ? std::string_view(list[i]) : std::string_view{};
+        }
+
+        // Unset and reported if a non empty value is malformed
+        FormRef ParseOptionalFormRef(std::string_view value, const std::string& key, std::vector<std::string>& errors) {
+            if (Trim(value).empty()) {
+                return {};
+            }
+            auto ref = ParseFormRef(value);
+            if (!ref) {
+                errors.push_back(key + ": expected Plugin|FormID, got '" + std::string(value) + "'");
+                return {};
+            }
+            return *ref;
+        }
+    }
+
+    std::optional<FormRef> ParseFormRef(std::string_view value) {
+        auto delimiter = value.find('|');
+        if (delimiter == std::string_view::npos) {
+            return std::nullopt;
+        }
+        auto plugin = Trim(value.substr(0, delimiter));
+        auto formId = Trim(value.substr(delimiter + 1));
+        if (formId.starts_with("0x") || formId.starts_with("0X")) {
+            formId.remove_prefix(2);
+        }
+        FormID localId = 0;
+        auto [end, error] = std::from_chars(formId.data(), formId.data() + formId.size(), localId, 16);
+        if (plugin.empty() || formId.empty() || error != std::errc{} || end != formId.data() + formId.size()) {
+            return std::nullopt;
+        }
+        return FormRef{std::string(plugin), localId};
+    }
+
+    CraftingRules CompileCraftingRules(const CraftingRulesText& text, std::vector<std::string>& errors) {
+        CraftingRules rules;
+
+        // rarity tiers, their position is the rarity id the planner works with
+        std::vector<std::string> rarityNames;
+        for (std::size_t i = 0; i < std::min(text.rarityNames.size(), kMaxRarities); i++) {
+            auto key = "rarities.rarity" + std::to_string(i + 1);
+            std::string name(Trim(text.rarityNames[i]));
+            if (name.empty() || name.find_first_of("|,") != std::string::npos ||
+                std::find(rarityNames.begin(), rarityNames.end(), name) != rarityNames.end()) {
+                errors.push_back(key + ": '" + name + "' is empty, a duplicate or contains | or ,");
+                break;
+            }
+            RarityTier tier{name, std::string(At(text.raritySuffixes, i)), {}};
+            for (auto keyword : SplitList(At(text.rarityKeywords, i))) {
+                if (auto ref = ParseOptionalFormRef(keyword, key + "Keywords", errors); ref.IsSet()) {
+                    tier.keywords.push_back(std::move(ref));
+                }
+            }
+            rarityNames.push_back(std::move(name));
+            rules.rarities.push_back(std::move(tier));
+        }
+        if (rules.rarities.empty()) {
+            errors.push_back("rarities: no valid rarity tier, using a single 'common' tier");
+            rarityNames = {"common"};
+            rules.rarities.push_back({"common", "", {}});
+        }
+        auto defaultRarity = std::find(rarityNames.begin(), rarityNames.end(), Trim(text.defaultRarity));
+        if (defaultRarity == rarityNames.end()) {
+            errors.push_back("rarities.default: unknown rarity '" + text.defaultRarity + "', using '" +
+                             rarityNames.front() + "'");
+            defaultRarity = rarityNames.begin();
+        }
+        rules.defaultRarity = static_cast<Rarity>(defaultRarity - rarityNames.begin());
+
+        // potion levels
+        const auto levelCount = static_cast<std::size_t>(std::clamp(text.levelCount, 1, kMaxTiers));
+        rules.levelKeywords.resize(levelCount);
+        rules.recipeRules.levels.resize(levelCount);
+        if (text.threeIngredientRecipes) {
+            rules.recipeRules.tripleLevels.resize(levelCount);
+            rules.recipeRules.maxTriplesPerSignature = static_cast<std::size_t>(std::max(text.maxTriplesPerEffect, 0));
+        }
+        for (std::size_t i = 0; i < levelCount; i++) {
+            const auto level = static_cast<int>(i + 1);
+            auto key = "crafting.level" + std::to_string(level);
+            if (!Trim(At(text.levelKeywords, i)).empty()) {
+                rules.levelKeywords[i] = ParseOptionalFormRef(At(text.levelKeywords, i), key + "Keyword", errors);
+            } else if (level <= kDefaultTierCount) {
+                rules.levelKeywords[i] = {"AlchemyReworked.esp", static_cast<FormID>(0x800 + level)};
+            } else {
+                errors.push_back(key + "Keyword: required for levels past " + std::to_string(kDefaultTierCount));
+            }
+
+            auto definitions = SplitList(At(text.levelRecipes, i));
+            if (level == 3) {
+                auto alt = SplitList(text.level3Alt);
+                definitions.insert(definitions.end(), alt.begin(), alt.end());
+            }
+            for (auto definition : definitions) {
+                if (auto pair = ParseRarityPair(definition, rarityNames)) {
+                    rules.recipeRules.levels[i].push_back(*pair);
+                } else {
+                    errors.push_back(key + ": '" + std::string(definition) +
+                                     "' is not a pair of known rarities (rarity|rarity)");
+                }
+            }
+
+            if (text.threeIngredientRecipes) {
+                for (auto definition : SplitList(At(text.levelTriples, i))) {
+                    if (auto triple = ParseRarityTriple(definition, rarityNames)) {
+                        rules.recipeRules.tripleLevels[i].push_back(*triple);
+                    } else {
+                        errors.push_back(key + "Triples: '" + std::string(definition) +
+                                         "' is not a triple of known rarities (rarity|rarity|rarity)");
+                    }
+                }
+            }
+        }
+        return rules;
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Planner.h"
+
+// Rarity tiers and crafting rules of the rarities and crafting sections of AlchemyReworked.yaml, compiled from the text
+// of the config. The plugin compiles its config with it and the plan compiler the same file, so a prebuilt plan is
+// planned with the rules the plugin would use. Forms stay "Plugin|FormID" references, the caller resolves them
+// against its load order.
+namespace AlchemyPlanner {
+    // "Plugin|FormID" of a form, unset if the plugin is empty
+    struct FormRef {
+        std::string plugin;
+        FormID localId = 0;
+
+        [[nodiscard]] inline bool IsSet() const noexcept { return !plugin.empty(); }
+
+        bool operator==(const FormRef&) const = default;
+    };
+
+    struct RarityTier {
+        std::string name;
+        // appended to the names of ingredients of the tier
+        std::string suffix;
+        std::vector<FormRef> keywords;
+
+        bool operator==(const RarityTier&) const = default;
+    };
+
+    // Config values as written, lists of rarities are indexed from rarity1 and lists of levels from level1. Missing
+    // entries are empty. The defaults are those of a config without the sections.
+    struct CraftingRulesText {
+        std::vector<std::string> rarityNames = {"common", "uncommon", "rare"};
+        std::vector<std::string> raritySuffixes = {"(Common)", "(Uncommon)", "(Rare)"};
+        // comma separated "Plugin|FormID" entries per rarity
+        std::vector<std::string> rarityKeywords = {"AlchemyReworked.esp|806", "AlchemyReworked.esp|807",
+                                                   "AlchemyReworked.esp|808"};
+        std::string defaultRarity = "uncommon";
+        // clamped to 1 - kMaxTiers
+        int levelCount = kDefaultTierCount;
+        // comma separated rarity pairs per level
+        std::vector<std::string> levelRecipes;
+        // older configs list the second level3 pair here, it is added to the level3 rules
+        std::string level3Alt;
+        // "Plugin|FormID" per level, empty entries use AlchemyReworked.esp 0x801-0x805
+        std::vector<std::string> levelKeywords;
+        bool threeIngredientRecipes = false;
+        int maxTriplesPerEffect = 50;
+        // comma separated rarity triples per level
+        std::vector<std::string> levelTriples;
+    };
+
+    struct CraftingRules {
+        std::vector<RarityTier> rarities;
+        Rarity defaultRarity = 0;
+        // keyword per potion level, level1 at [0], the number of entries is the level count. Unset if malformed or
+        // missing past the default levels.
+        std::vector<FormRef> levelKeywords;
+        RecipeRules recipeRules;
+    };
+
+    // "Plugin|FormID" with a hexadecimal FormID
+    [[nodiscard]] std::optional<FormRef> ParseFormRef(std::string_view value);
+
+    // Malformed entries are left out and reported in errors as "section.key: ...". A config without a valid rarity tier
+    // gets a single 'common' one.
+    [[nodiscard]] CraftingRules CompileCraftingRules(const CraftingRulesText& text, std::vector<std::string>& errors);
+}
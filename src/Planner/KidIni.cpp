@@ -0,0 +1,344 @@
+#include "KidIni.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <fstream>
+#include <optional>
+
+namespace AlchemyPlanner {
+    namespace {
+        std::string_view Trim(std::string_view value) {
+            auto begin = value.find_first_not_of(" \t\r");
+            if (begin == std::string_view::npos) {
+                return {};
+            }
+            return value.substr(begin, value.find_last_not_of(" \t\r") - begin + 1);
+        }
+
+        // Next trimmed part of value up to delimiter, value is left behind it. Empty once value is used up.
+        std::string_view NextField(std::string_view& value, char delimiter) {
+            auto end = value.find(delimiter);
+            auto field = Trim(value.substr(0, end));
+            value.remove_prefix(end == std::string_view::npos ? value.size() : end + 1);
+            return field;
+        }
+
+        bool IsUnset(std::string_view field) { return field.empty() || EqualsIgnoreCase(field, "NONE"); }
+
+        bool ContainsIgnoreCase(std::string_view text, std::string_view part) {
+            return std::search(text.begin(), text.end(), part.begin(), part.end(), [](char x, char y) {
+                       return std::tolower(static_cast<unsigned char>(x)) ==
+                              std::tolower(static_cast<unsigned char>(y));
+                   }) != text.end();
+        }
+
+        // "0xFormID~Plugin" to its runtime FormID, nullopt if the reference isn't in that form, 0 if the plugin
+        // isn't loaded
+        std::optional<FormID> ResolveFormRef(std::string_view ref, const LoadOrderFile& file) {
+            auto tilde = ref.find('~');
+            if (tilde == std::string_view::npos) {
+                return std::nullopt;
+            }
+            auto id = ref.substr(0, tilde);
+            if (id.starts_with("0x") || id.starts_with("0X")) {
+                id.remove_prefix(2);
+            }
+            FormID localId = 0;
+            auto [end, error] = std::from_chars(id.data(), id.data() + id.size(), localId, 16);
+            if (id.empty() || error != std::errc{} || end != id.data() + id.size()) {
+                return std::nullopt;
+            }
+            return file.Resolve(ref.substr(tilde + 1), localId);
+        }
+
+        // what filters are matched against
+        struct RecordView {
+            FormID formId;
+            std::string_view editorId;
+            std::string_view name;
+            std::span<const FormID> keywords;
+        };
+
+        enum class FilterField : std::uint8_t { kStrings, kForms };
+
+        // One filter field of a rule with every term resolved once, so matching a record compares FormIDs and strings
+        // only
+        class FilterMatcher {
+        public:
+            FilterMatcher(const LoadOrderFile& file, FilterField field) : _file(file), _field(field) {}
+
+            void Compile(std::string_view filters) {
+                _terms.clear();
+                _entries.clear();
+                _hasAlternatives = false;
+                if (IsUnset(filters)) {
+                    return;
+                }
+                while (!filters.empty()) {
+                    auto entry = NextField(filters, ',');
+                    if (entry.empty()) {
+                        continue;
+                    }
+                    Entry compiled{EntryKind::kAny, false, static_cast<std::uint32_t>(_terms.size()), 0};
+                    if (entry.starts_with('-')) {
+                        compiled.kind = EntryKind::kExclude;
+                        AddTerm(Trim(entry.substr(1)), false);
+                    } else if (entry.find('+') != std::string_view::npos) {
+                        compiled.kind = EntryKind::kAll;
+                        while (!entry.empty()) {
+                            AddTerm(NextField(entry, '+'), false);
+                        }
+                    } else {
+                        compiled.wildcard = _field == FilterField::kStrings && entry.starts_with('*');
+                        AddTerm(compiled.wildcard ? Trim(entry.substr(1)) : entry, compiled.wildcard);
+                        _hasAlternatives = true;
+                    }
+                    compiled.end = static_cast<std::uint32_t>(_terms.size());
+                    _entries.push_back(compiled);
+                }
+            }
+
+            bool Matches(const RecordView& record) {
+                auto matchedAlternative = false;
+                for (const auto& entry : _entries) {
+                    auto terms = std::span(_terms).subspan(entry.begin, entry.end - entry.begin);
+                    switch (entry.kind) {
+                        case EntryKind::kExclude:
+                            if (MatchesTerm(terms[0], record, false)) {
+                                return false;
+                            }
+                            break;
+                        case EntryKind::kAll:
+                            for (const auto& term : terms) {
+                                if (!MatchesTerm(term, record, false)) {
+                                    return false;
+                                }
+                            }
+                            break;
+                        case EntryKind::kAny:
+                            matchedAlternative = matchedAlternative || MatchesTerm(terms[0], record, entry.wildcard);
+                            break;
+                    }
+                }
+                return !_hasAlternatives || matchedAlternative;
+            }
+
+        private:
+            enum class EntryKind : std::uint8_t { kAny, kAll, kExclude };
+
+            struct Term {
+                std::string_view text;
+                // set for 0xFormID~Plugin terms, 0 if the plugin isn't loaded
+                std::optional<FormID> form;
+                // keyword named by the term, 0 if no keyword has it as editor id
+                FormID keyword = 0;
+                // set for plugin names, records whose FormID masked by pluginMask is pluginFirst come from the plugin
+                FormID pluginFirst = 0;
+                FormID pluginMask = 0;
+            };
+
+            struct Entry {
+                EntryKind kind;
+                bool wildcard;
+                std::uint32_t begin;
+                std::uint32_t end;
+            };
+
+            void AddTerm(std::string_view text, bool wildcard) {
+                Term term{.text = text};
+                if (_field == FilterField::kForms) {
+                    term.form = ResolveFormRef(text, _file);
+                    auto plugin = std::ranges::find_if(_file.plugins, [&](const auto& entry) {
+                        return EqualsIgnoreCase(entry.first, text);
+                    });
+                    if (!term.form && plugin != _file.plugins.end()) {
+                        term.pluginFirst = plugin->second;
+                        // light plugins have 12 bit local ids behind an FE prefix
+                        term.pluginMask = (plugin->second >> 24) == 0xFE ? 0xFFFFF000 : 0xFF000000;
+                    }
+                }
+                if (!term.form && !term.pluginMask && !wildcard) {
+                    term.keyword = _file.FindKeyword(text);
+                }
+                _terms.push_back(term);
+            }
+
+            bool MatchesTerm(const Term& term, const RecordView& record, bool wildcard) {
+                if (term.form) {
+                    return *term.form != 0 && (record.formId == *term.form || HasKeyword(record.keywords, *term.form));
+                }
+                if (term.pluginMask) {
+                    return (record.formId & term.pluginMask) == term.pluginFirst;
+                }
+                if (term.text.empty()) {
+                    return false;
+                }
+                if (_field == FilterField::kForms) {
+                    return EqualsIgnoreCase(record.editorId, term.text) || HasKeyword(record.keywords, term.keyword);
+                }
+                if (!wildcard) {
+                    return EqualsIgnoreCase(record.editorId, term.text) || EqualsIgnoreCase(record.name, term.text) ||
+                           HasKeyword(record.keywords, term.keyword);
+                }
+                return ContainsIgnoreCase(record.editorId, term.text) || ContainsIgnoreCase(record.name, term.text) ||
+                       std::ranges::any_of(record.keywords, [&](FormID keyword) {
+                           return ContainsIgnoreCase(GetKeywordEditorId(keyword), term.text);
+                       });
+            }
+
+            // sorted on first use, wildcard terms are rare
+            std::string_view GetKeywordEditorId(FormID keyword) {
+                if (_keywordNames.empty() && !_file.keywords.empty()) {
+                    _keywordNames.reserve(_file.keywords.size());
+                    for (const auto& [id, editorId] : _file.keywords) {
+                        _keywordNames.emplace_back(id, editorId);
+                    }
+                    std::sort(_keywordNames.begin(), _keywordNames.end());
+                }
+                auto it = std::lower_bound(_keywordNames.begin(), _keywordNames.end(),
+                                           std::pair<FormID, std::string_view>{keyword, {}});
+                return it != _keywordNames.end() && it->first == keyword ? it->second : std::string_view{};
+            }
+
+            const LoadOrderFile& _file;
+            FilterField _field;
+            std::vector<Term> _terms;
+            std::vector<Entry> _entries;
+            bool _hasAlternatives = false;
+            std::vector<std::pair<FormID, std::string_view>> _keywordNames;
+        };
+
+        std::string_view GetEditorId(const std::vector<std::string>& editorIds, std::size_t i) {
+            return i < editorIds.size() ? std::string_view(editorIds[i]) : std::string_view{};
+        }
+
+        bool AddKeyword(std::vector<FormID>& keywords, FormID keyword) {
+            if (HasKeyword(keywords, keyword)) {
+                return false;
+            }
+            keywords.push_back(keyword);
+            return true;
+        }
+
+        std::string GetLocation(std::string_view source, std::uint32_t line) {
+            return std::string(source) + ":" + std::to_string(line);
+        }
+
+        // unset chances are 100 like in KID
+        bool IsCertain(std::string_view chance) {
+            if (IsUnset(chance)) {
+                return true;
+            }
+            double value = 0.0;
+            auto [end, error] = std::from_chars(chance.data(), chance.data() + chance.size(), value);
+            return error == std::errc{} && end == chance.data() + chance.size() && value >= 100.0;
+        }
+    }
+
+    void ParseKidIni(std::string_view text, std::string_view source, std::vector<KidRule>& rules,
+                     std::vector<std::string>& errors) {
+        rules.reserve(rules.size() + static_cast<std::size_t>(std::count(text.begin(), text.end(), '\n')) + 1);
+        for (std::uint32_t lineNumber = 1; !text.empty(); lineNumber++) {
+            auto line = NextField(text, '\n');
+            if (line.empty() || line.starts_with(';') || line.starts_with('#') || line.starts_with('[')) {
+                continue;
+            }
+
+            auto equals = line.find('=');
+            if (equals == std::string_view::npos || !EqualsIgnoreCase(Trim(line.substr(0, equals)), "Keyword")) {
+                errors.push_back(GetLocation(source, lineNumber) + ": not a Keyword = entry");
+                continue;
+            }
+            auto fields = line.substr(equals + 1);
+            auto keyword = NextField(fields, '|');
+            auto type = NextField(fields, '|');
+            if (keyword.empty() || type.empty()) {
+                errors.push_back(GetLocation(source, lineNumber) + ": expected keyword|type|filters");
+                continue;
+            }
+            KidRule rule{keyword, {}, {}, lineNumber, KidRecordType::kIngredient};
+            if (EqualsIgnoreCase(type, "Ingredient")) {
+                rule.type = KidRecordType::kIngredient;
+            } else if (EqualsIgnoreCase(type, "Potion")) {
+                rule.type = KidRecordType::kPotion;
+            } else {
+                continue;
+            }
+            rule.stringFilters = NextField(fields, '|');
+            rule.formFilters = NextField(fields, '|');
+            auto traits = NextField(fields, '|');
+            auto chance = NextField(fields, '|');
+            if (!IsUnset(traits) || !IsCertain(chance)) {
+                errors.push_back(GetLocation(source, lineNumber) +
+                                 ": traits and chances can't be resolved offline, rule skipped");
+                continue;
+            }
+            rules.push_back(rule);
+        }
+    }
+
+    bool ReadKidIni(const std::filesystem::path& path, KidIni& out, std::vector<std::string>& errors) {
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in) {
+            return false;
+        }
+        out.name = path.filename().string();
+        out.text.resize(static_cast<std::size_t>(in.tellg()));
+        in.seekg(0);
+        if (!in.read(out.text.data(), static_cast<std::streamsize>(out.text.size()))) {
+            return false;
+        }
+        out.rules.clear();
+        ParseKidIni(std::string_view(out.text.data(), out.text.size()), out.name, out.rules, errors);
+        return true;
+    }
+
+    FormID ResolveKidKeyword(std::string_view keyword, const LoadOrderFile& file) noexcept {
+        return ResolveFormRef(keyword, file).value_or(file.FindKeyword(keyword));
+    }
+
+    std::size_t ApplyKidRules(std::span<const KidIni> inis, LoadOrderFile& file, std::vector<std::string>& errors,
+                              std::span<const FormID> onlyKeywords) {
+        auto& loadOrder = file.loadOrder;
+        FilterMatcher strings(file, FilterField::kStrings);
+        FilterMatcher forms(file, FilterField::kForms);
+        auto matches = [&](const RecordView& record) { return strings.Matches(record) && forms.Matches(record); };
+        std::size_t added = 0;
+        for (const auto& ini : inis) {
+            for (const auto& rule : ini.rules) {
+                auto keyword = ResolveKidKeyword(rule.keyword, file);
+                if (!keyword) {
+                    if (onlyKeywords.empty()) {
+                        errors.push_back(GetLocation(ini.name, rule.line) + ": keyword " + std::string(rule.keyword) +
+                                         " is not in the load order");
+                    }
+                    continue;
+                }
+                if (!onlyKeywords.empty() && !HasKeyword(onlyKeywords, keyword)) {
+                    continue;
+                }
+                strings.Compile(rule.stringFilters);
+                forms.Compile(rule.formFilters);
+                if (rule.type == KidRecordType::kIngredient) {
+                    for (std::size_t i = 0; i < loadOrder.ingredients.size(); i++) {
+                        auto& ingr = loadOrder.ingredients[i];
+                        if (matches({ingr.formId, GetEditorId(file.ingredientEditorIds, i), ingr.name,
+                                     ingr.keywords})) {
+                            added += AddKeyword(ingr.keywords, keyword);
+                        }
+                    }
+                } else {
+                    for (std::size_t i = 0; i < loadOrder.potions.size(); i++) {
+                        auto& potion = loadOrder.potions[i];
+                        if (matches({potion.formId, GetEditorId(file.potionEditorIds, i), potion.name,
+                                     potion.keywords})) {
+                            added += AddKeyword(potion.keywords, keyword);
+                        }
+                    }
+                }
+            }
+        }
+        return added;
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "LoadOrderFile.h"
+
+// Keyword rules of KID (Keyword Item Distributor) ini files, as far as planning needs them:
+//   Keyword = <keyword>|<type>|<string filters>|<form filters>|<traits>|<chance>
+// The keyword is an editor id or 0xFormID~Plugin. Only Ingredient and Potion rules are kept, the rest never change a
+// plan. Trailing fields may be left out, NONE or nothing leaves a field unset. A record has to match both filter
+// fields, an unset one matches every record. Each field is a list of comma separated entries: entries are
+// alternatives, terms joined by + must all match and a leading - excludes records.
+//   string filters  editor id, name or keyword editor id of the record, a leading * matches a substring
+//   form filters    0xFormID~Plugin of the record or a keyword it has, a plugin name for records it adds, or a
+//                   keyword editor id
+//
+// Parsing doesn't copy anything, rules are views into the text of the ini they were read from. The plugin parses
+// every ini at startup while KID is still distributing.
+namespace AlchemyPlanner {
+    enum class KidRecordType : std::uint8_t { kIngredient, kPotion };
+
+    struct KidRule {
+        std::string_view keyword;
+        // filter fields as written, empty matches every record
+        std::string_view stringFilters;
+        std::string_view formFilters;
+        std::uint32_t line = 0;
+        KidRecordType type = KidRecordType::kIngredient;
+    };
+
+    // One ini file, rules point into text so it is kept as a buffer that doesn't move with the KidIni
+    struct KidIni {
+        std::string name;
+        std::vector<char> text;
+        std::vector<KidRule> rules;
+    };
+
+    // Appends the ingredient and potion rules of an ini to rules, they point into text. Rules with traits or a chance
+    // below 100 can't be resolved offline, they are skipped and reported in errors like malformed lines.
+    void ParseKidIni(std::string_view text, std::string_view source, std::vector<KidRule>& rules,
+                     std::vector<std::string>& errors);
+    // Returns false if the file can't be read
+    bool ReadKidIni(const std::filesystem::path& path, KidIni& out, std::vector<std::string>& errors);
+
+    // Runtime FormID of a rule keyword, 0 if it isn't in the load order
+    [[nodiscard]] FormID ResolveKidKeyword(std::string_view keyword, const LoadOrderFile& file) noexcept;
+
+    // Adds the keyword of every rule, in order, to the records it matches that don't have it yet. Later rules see the
+    // keywords of earlier ones like they do in KID. With onlyKeywords set, rules for any other keyword are left out.
+    // Returns the number of keywords added.
+    std::size_t ApplyKidRules(std::span<const KidIni> inis, LoadOrderFile& file, std::vector<std::string>& errors,
+                              std::span<const FormID> onlyKeywords = {});
+}
@@ -0,0 +1,210 @@
+#include "LoadOrderFile.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <fstream>
+#include <sstream>
+
+namespace AlchemyPlanner {
+    namespace {
+        std::vector<std::string_view> SplitFields(std::string_view line) {
+            std::vector<std::string_view> fields;
+            while (true) {
+                auto tab = line.find('\t');
+                fields.push_back(line.substr(0, tab));
+                if (tab == std::string_view::npos) {
+                    return fields;
+                }
+                line.remove_prefix(tab + 1);
+            }
+        }
+
+        bool ParseFormID(std::string_view text, FormID& out) {
+            if (text.starts_with("0x") || text.starts_with("0X")) {
+                text.remove_prefix(2);
+            }
+            auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), out, 16);
+            return !text.empty() && error == std::errc{} && end == text.data() + text.size();
+        }
+
+        bool ParseFormIDs(std::string_view text, std::vector<FormID>& out) {
+            out.clear();
+            while (!text.empty()) {
+                auto comma = text.find(',');
+                FormID id = 0;
+                if (!ParseFormID(text.substr(0, comma), id)) {
+                    return false;
+                }
+                out.push_back(id);
+                if (comma == std::string_view::npos) {
+                    break;
+                }
+                text.remove_prefix(comma + 1);
+            }
+            return true;
+        }
+
+        // tabs and line breaks would split the entry
+        std::string Sanitize(std::string_view text) {
+            std::string out(text);
+            std::replace_if(out.begin(), out.end(), [](char c) { return c == '\t' || c == '\r' || c == '\n'; }, ' ');
+            return out;
+        }
+
+        // eight upper case hex digits
+        void AppendFormID(std::string& out, FormID id) {
+            constexpr std::string_view kDigits = "0123456789ABCDEF";
+            for (int shift = 28; shift >= 0; shift -= 4) {
+                out += kDigits[(id >> shift) & 0xF];
+            }
+        }
+
+        void AppendFormIDs(std::string& out, std::span<const FormID> ids) {
+            for (std::size_t i = 0; i < ids.size(); i++) {
+                if (i) {
+                    out += ',';
+                }
+                AppendFormID(out, ids[i]);
+            }
+        }
+
+        // "kind\tFormID\tfield" start of an entry
+        void AppendEntry(std::string& out, std::string_view kind, FormID id, std::string_view field) {
+            out += kind;
+            out += '\t';
+            AppendFormID(out, id);
+            out += '\t';
+            out += Sanitize(field);
+        }
+    }
+
+    bool EqualsIgnoreCase(std::string_view a, std::string_view b) noexcept {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+                   return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+               });
+    }
+
+    FormID LoadOrderFile::Resolve(std::string_view plugin, FormID localId) const noexcept {
+        for (const auto& [name, first] : plugins) {
+            if (EqualsIgnoreCase(name, plugin)) {
+                // light plugins have 12 bit local ids behind an FE prefix
+                return (first >> 24) == 0xFE ? first | (localId & 0xFFF) : first | (localId & 0xFFFFFF);
+            }
+        }
+        return 0;
+    }
+
+    FormID LoadOrderFile::FindKeyword(std::string_view editorId) const noexcept {
+        for (const auto& [id, name] : keywords) {
+            if (EqualsIgnoreCase(name, editorId)) {
+                return id;
+            }
+        }
+        return 0;
+    }
+
+    std::string_view LoadOrderFile::GetKeywordEditorId(FormID keyword) const noexcept {
+        for (const auto& [id, name] : keywords) {
+            if (id == keyword) {
+                return name;
+            }
+        }
+        return {};
+    }
+
+    bool ReadLoadOrderFile(const std::filesystem::path& path, LoadOrderFile& out, std::vector<std::string>& errors) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            return false;
+        }
+        std::ostringstream buffer;
+        buffer << in.rdbuf();
+        const auto text = buffer.str();
+
+        out = {};
+        std::string_view rest = text;
+        for (std::size_t lineNumber = 1; !rest.empty(); lineNumber++) {
+            auto end = rest.find('\n');
+            auto line = rest.substr(0, end);
+            rest.remove_prefix(end == std::string_view::npos ? rest.size() : end + 1);
+            if (line.ends_with('\r')) {
+                line.remove_suffix(1);
+            }
+            if (line.empty() || line.starts_with('#')) {
+                continue;
+            }
+
+            auto fields = SplitFields(line);
+            auto kind = fields[0];
+            FormID formId = 0;
+            auto valid = fields.size() >= 3 && ParseFormID(fields[1], formId);
+            if (valid && kind == "plugin") {
+                out.plugins.emplace_back(std::string(fields[2]), formId);
+            } else if (valid && kind == "keyword") {
+                out.keywords.emplace_back(formId, std::string(fields[2]));
+            } else if (valid && kind == "ingredient" && fields.size() == 6) {
+                IngredientRecord record{formId, std::string(fields[5]), {}, {}};
+                valid = ParseFormIDs(fields[3], record.keywords) && ParseFormIDs(fields[4], record.effects);
+                if (valid) {
+                    out.loadOrder.ingredients.push_back(std::move(record));
+                    out.ingredientEditorIds.emplace_back(fields[2]);
+                }
+            } else if (valid && kind == "potion" && fields.size() == 7 && (fields[5] == "0" || fields[5] == "1")) {
+                PotionRecord record{formId, std::string(fields[6]), {}, {}, fields[5] == "1"};
+                valid = ParseFormIDs(fields[3], record.keywords) && ParseFormIDs(fields[4], record.effects);
+                if (valid) {
+                    out.loadOrder.potions.push_back(std::move(record));
+                    out.potionEditorIds.emplace_back(fields[2]);
+                }
+            } else {
+                valid = false;
+            }
+            if (!valid) {
+                errors.push_back("line " + std::to_string(lineNumber) + ": malformed " + std::string(kind) + " entry");
+            }
+        }
+        return true;
+    }
+
+    bool WriteLoadOrderFile(const std::filesystem::path& path, const LoadOrderFile& file) {
+        std::string text = "# AlchemyReworked load order, see LoadOrderFile.h for the format\n";
+        for (const auto& [name, first] : file.plugins) {
+            AppendEntry(text, "plugin", first, name);
+            text += '\n';
+        }
+        for (const auto& [id, editorId] : file.keywords) {
+            AppendEntry(text, "keyword", id, editorId);
+            text += '\n';
+        }
+        const auto& loadOrder = file.loadOrder;
+        for (std::size_t i = 0; i < loadOrder.ingredients.size(); i++) {
+            const auto& ingr = loadOrder.ingredients[i];
+            AppendEntry(text, "ingredient", ingr.formId,
+                        i < file.ingredientEditorIds.size() ? file.ingredientEditorIds[i] : std::string_view{});
+            text += '\t';
+            AppendFormIDs(text, ingr.keywords);
+            text += '\t';
+            AppendFormIDs(text, ingr.effects);
+            text += '\t';
+            text += Sanitize(ingr.name);
+            text += '\n';
+        }
+        for (std::size_t i = 0; i < loadOrder.potions.size(); i++) {
+            const auto& potion = loadOrder.potions[i];
+            AppendEntry(text, "potion", potion.formId,
+                        i < file.potionEditorIds.size() ? file.potionEditorIds[i] : std::string_view{});
+            text += '\t';
+            AppendFormIDs(text, potion.keywords);
+            text += '\t';
+            AppendFormIDs(text, potion.effects);
+            text += potion.poison ? "\t1\t" : "\t0\t";
+            text += Sanitize(potion.name);
+            text += '\n';
+        }
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << text;
+        return static_cast<bool>(out.flush());
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "Planner.h"
+
+// Text description of the alchemy records of a load order, what the plan compiler plans from. The plugin exports it
+// with the keywords the records have in game, tools may write it as well. One entry per line, fields separated by
+// tabs, records in the order the game lists them:
+//   plugin      <first FormID>  <file name>                                  0A000000, FE012000 for light plugins
+//   keyword     <FormID>        <editor id>
+//   ingredient  <FormID>        <editor id>  <keywords>  <effects>  <name>
+//   potion      <FormID>        <editor id>  <keywords>  <effects>  <poison 0|1>  <name>
+// FormIDs are hexadecimal, keywords and effects are comma separated FormIDs and may be empty like editor ids. Lines
+// starting with # are comments.
+namespace AlchemyPlanner {
+    struct LoadOrderFile {
+        // file name and the FormID its first record maps to at runtime, in load order
+        std::vector<std::pair<std::string, FormID>> plugins;
+        // editor ids of keywords, KID rules and filters may name keywords by editor id
+        std::vector<std::pair<FormID, std::string>> keywords;
+        LoadOrder loadOrder;
+        // indexed like loadOrder.ingredients and loadOrder.potions, empty if unknown
+        std::vector<std::string> ingredientEditorIds;
+        std::vector<std::string> potionEditorIds;
+
+        // runtime FormID of a record of the plugin (file names compare case insensitive), 0 if it isn't loaded
+        [[nodiscard]] FormID Resolve(std::string_view plugin, FormID localId) const noexcept;
+        // 0 if no keyword has the editor id
+        [[nodiscard]] FormID FindKeyword(std::string_view editorId) const noexcept;
+        // empty if the keyword has no editor id
+        [[nodiscard]] std::string_view GetKeywordEditorId(FormID keyword) const noexcept;
+    };
+
+    [[nodiscard]] bool EqualsIgnoreCase(std::string_view a, std::string_view b) noexcept;
+
+    // Malformed lines are skipped and reported in errors as "line N: ...". Returns false if the file can't be read.
+    bool ReadLoadOrderFile(const std::filesystem::path& path, LoadOrderFile& out, std::vector<std::string>& errors);
+    bool WriteLoadOrderFile(const std::filesystem::path& path, const LoadOrderFile& file);
+}
@@ -0,0 +1,161 @@
+#include "Metrics.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+namespace AlchemyPlanner {
+    namespace {
+        std::string Format(const char* format, auto... args) {
+            std::array<char, 256> buffer;
+            auto length = std::snprintf(buffer.data(), buffer.size(), format, args...);
+            return std::string(buffer.data(), static_cast<std::size_t>(std::clamp<int>(length, 0, buffer.size() - 1)));
+        }
+
+        // metric names are plain identifiers, only quotes and backslashes need escaping
+        void AppendJsonString(std::string& out, std::string_view value) {
+            out += '"';
+            for (auto c : value) {
+                if (c == '"' || c == '\\') {
+                    out += '\\';
+                }
+                out += c;
+            }
+            out += '"';
+        }
+    }
+
+    void Histogram::Record(double microseconds) noexcept {
+        auto bucket = std::lower_bound(kBucketBounds.begin(), kBucketBounds.end(), microseconds);
+        _buckets[static_cast<std::size_t>(bucket - kBucketBounds.begin())]++;
+        _count++;
+        _sum += microseconds;
+        _max = std::max(_max, microseconds);
+    }
+
+    double Histogram::GetPercentile(double percentile) const noexcept {
+        if (!_count) {
+            return 0;
+        }
+        auto rank = static_cast<std::uint64_t>(std::clamp(percentile, 0.0, 1.0) * static_cast<double>(_count - 1)) + 1;
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < kBucketBounds.size(); i++) {
+            seen += _buckets[i];
+            if (seen >= rank) {
+                return std::min(kBucketBounds[i], _max);
+            }
+        }
+        return _max;
+    }
+
+    Metrics& Metrics::GetSingleton() noexcept {
+        static Metrics instance;
+        return instance;
+    }
+
+    void Metrics::Add(std::string_view counter, std::uint64_t value) {
+        std::scoped_lock guard(_lock);
+        auto it = _counters.find(counter);
+        if (it == _counters.end()) {
+            it = _counters.emplace(std::string(counter), 0).first;
+        }
+        it->second += value;
+    }
+
+    void Metrics::SetPhase(std::string_view phase, double milliseconds) {
+        std::scoped_lock guard(_lock);
+        auto it = _phases.find(phase);
+        if (it == _phases.end()) {
+            it = _phases.emplace(std::string(phase), 0).first;
+        }
+        it->second = milliseconds;
+    }
+
+    void Metrics::Record(std::string_view histogram, double microseconds) {
+        std::scoped_lock guard(_lock);
+        auto it = _histograms.find(histogram);
+        if (it == _histograms.end()) {
+            it = _histograms.emplace(std::string(histogram), Histogram{}).first;
+        }
+        it->second.Record(microseconds);
+    }
+
+    void Metrics::Clear() {
+        std::scoped_lock guard(_lock);
+        _counters.clear();
+        _phases.clear();
+        _histograms.clear();
+    }
+
+    void Metrics::ForEachSummaryLine(const std::function<void(const std::string&)>& emit) const {
+        std::scoped_lock guard(_lock);
+        for (const auto& [name, ms] : _phases) {
+            emit(Format("phase %s: %.2f ms", name.c_str(), ms));
+        }
+        for (const auto& [name, value] : _counters) {
+            emit(Format("counter %s: %llu", name.c_str(), static_cast<unsigned long long>(value)));
+        }
+        for (const auto& [name, histogram] : _histograms) {
+            emit(Format("latency %s: count %llu, mean %.1f us, p50 %.0f us, p99 %.0f us, max %.1f us", name.c_str(),
+                        static_cast<unsigned long long>(histogram.GetCount()), histogram.GetMean(),
+                        histogram.GetPercentile(0.5), histogram.GetPercentile(0.99), histogram.GetMax()));
+        }
+    }
+
+    std::string Metrics::ToJson() const {
+        std::scoped_lock guard(_lock);
+        std::string out = "{\n  \"phasesMs\": {";
+        const char* separator = "";
+        for (const auto& [name, ms] : _phases) {
+            out += separator;
+            out += "\n    ";
+            AppendJsonString(out, name);
+            out += Format(": %.3f", ms);
+            separator = ",";
+        }
+        out += "\n  },\n  \"counters\": {";
+        separator = "";
+        for (const auto& [name, value] : _counters) {
+            out += separator;
+            out += "\n    ";
+            AppendJsonString(out, name);
+            out += Format(": %llu", static_cast<unsigned long long>(value));
+            separator = ",";
+        }
+        out += "\n  },\n  \"latencyUs\": {";
+        separator = "";
+        for (const auto& [name, histogram] : _histograms) {
+            out += separator;
+            out += "\n    ";
+            AppendJsonString(out, name);
+            out += Format(": {\"count\": %llu, \"mean\": %.3f, \"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, "
+                          "\"max\": %.3f}",
+                          static_cast<unsigned long long>(histogram.GetCount()), histogram.GetMean(),
+                          histogram.GetPercentile(0.5), histogram.GetPercentile(0.9), histogram.GetPercentile(0.99),
+                          histogram.GetMax());
+            separator = ",";
+        }
+        out += "\n  }\n}\n";
+        return out;
+    }
+
+    bool Metrics::WriteJson(const std::filesystem::path& path) const {
+        auto json = ToJson();
+        std::ofstream out(path, std::ios::trunc);
+        out << json;
+        return static_cast<bool>(out.flush());
+    }
+
+    ScopedTimer::~ScopedTimer() {
+        auto elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - _start).count();
+        try {
+            if (_kind == Kind::kPhase) {
+                Metrics::GetSingleton().SetPhase(_name, elapsed / 1000.0);
+            } else {
+                Metrics::GetSingleton().Record(_name, elapsed);
+            }
+        } catch (...) {
+            // metrics must never take the caller down
+        }
+    }
+}
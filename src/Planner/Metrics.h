@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+// Process wide counters, phase timings and latency histograms. Recording takes a lock and a map lookup so hot loops
+// should count locally and report once.
+namespace AlchemyPlanner {
+    // Latency distribution over fixed microsecond buckets, percentiles are reported as the upper bound of the bucket
+    // they fall in
+    class Histogram {
+    public:
+        static constexpr std::array<double, 16> kBucketBounds = {
+            10, 25, 50, 100, 250, 500, 1'000, 2'500, 5'000, 10'000, 25'000, 50'000, 100'000, 250'000, 500'000,
+            1'000'000};
+
+        void Record(double microseconds) noexcept;
+
+        [[nodiscard]] std::uint64_t GetCount() const noexcept { return _count; }
+        [[nodiscard]] double GetMean() const noexcept { return _count ? _sum / static_cast<double>(_count) : 0; }
+        [[nodiscard]] double GetMax() const noexcept { return _max; }
+        // percentile in [0, 1]
+        [[nodiscard]] double GetPercentile(double percentile) const noexcept;
+
+    private:
+        // last bucket collects everything above the highest bound
+        std::array<std::uint64_t, kBucketBounds.size() + 1> _buckets{};
+        std::uint64_t _count = 0;
+        double _sum = 0;
+        double _max = 0;
+    };
+
+    class Metrics {
+    public:
+        [[nodiscard]] static Metrics& GetSingleton() noexcept;
+
+        void Add(std::string_view counter, std::uint64_t value = 1);
+        // duration of a one-off stage, recording the same phase again replaces it
+        void SetPhase(std::string_view phase, double milliseconds);
+        void Record(std::string_view histogram, double microseconds);
+        void Clear();
+
+        // one line per metric, for logs
+        void ForEachSummaryLine(const std::function<void(const std::string&)>& emit) const;
+        [[nodiscard]] std::string ToJson() const;
+        bool WriteJson(const std::filesystem::path& path) const;
+
+    private:
+        mutable std::mutex _lock;
+        std::map<std::string, std::uint64_t, std::less<>> _counters;
+        std::map<std::string, double, std::less<>> _phases;
+        std::map<std::string, Histogram, std::less<>> _histograms;
+    };
+
+    // Reports the time spent in its scope as a phase or as a latency sample when it goes out of scope
+    class ScopedTimer {
+    public:
+        enum class Kind { kPhase, kLatency };
+
+        explicit ScopedTimer(std::string_view name, Kind kind = Kind::kPhase) noexcept
+            : _name(name), _kind(kind), _start(std::chrono::steady_clock::now()) {}
+        ~ScopedTimer();
+
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    private:
+        std::string_view _name;
+        Kind _kind;
+        std::chrono::steady_clock::time_point _start;
+    };
+}
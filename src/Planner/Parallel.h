@@ -0,0 +1,66 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace AlchemyPlanner {
+    // 0 picks the number of hardware threads
+    [[nodiscard]] inline unsigned ResolveThreadCount(unsigned requested) noexcept {
+        if (requested) {
+            return requested;
+        }
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Calls fn(i) for every i in [0, count) on up to `threads` threads, the calling thread takes part as well.
+    // Indices are handed out in chunks of `grain` through a shared counter so uneven work balances itself. The first
+    // exception thrown by fn is rethrown once every thread has finished.
+    template <class Fn>
+    void ParallelFor(std::size_t count, unsigned threads, Fn&& fn, std::size_t grain = 1) {
+        grain = std::max<std::size_t>(grain, 1);
+        auto workers = std::min<std::size_t>(ResolveThreadCount(threads), (count + grain - 1) / grain);
+        if (workers <= 1) {
+            for (std::size_t i = 0; i < count; i++) {
+                fn(i);
+            }
+            return;
+        }
+
+        std::atomic_size_t next{0};
+        std::exception_ptr error;
+        std::mutex errorLock;
+        auto work = [&]() {
+            try {
+                for (auto start = next.fetch_add(grain); start < count; start = next.fetch_add(grain)) {
+                    for (auto i = start; i < std::min(start + grain, count); i++) {
+                        fn(i);
+                    }
+                }
+            } catch (...) {
+                std::scoped_lock guard(errorLock);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next = count;
+            }
+        };
+
+        std::vector<std::thread> pool;
+        pool.reserve(workers - 1);
+        for (std::size_t i = 1; i < workers; i++) {
+            pool.emplace_back(work);
+        }
+        work();
+        for (auto& thread : pool) {
+            thread.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
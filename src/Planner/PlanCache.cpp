@@ -0,0 +1,337 @@
+#include "PlanCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <span>
+#include <system_error>
+#include <type_traits>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace AlchemyPlanner {
+    namespace {
+        static_assert(sizeof(PlanCacheHeader) == 40);
+
+        class Fnv1a {
+        public:
+            void Add(std::uint64_t value) noexcept {
+                for (int i = 0; i < 8; i++) {
+                    _hash = (_hash ^ ((value >> (i * 8)) & 0xFF)) * 1099511628211ull;
+                }
+            }
+
+            void Add(std::string_view value) noexcept {
+                Add(value.size());
+                for (auto c : value) {
+                    _hash = (_hash ^ static_cast<std::uint8_t>(c)) * 1099511628211ull;
+                }
+            }
+
+            void Add(std::span<const FormID> values) noexcept {
+                Add(values.size());
+                for (auto value : values) {
+                    Add(std::uint64_t{value});
+                }
+            }
+
+            [[nodiscard]] std::uint64_t Get() const noexcept { return _hash; }
+
+        private:
+            std::uint64_t _hash = 1469598103934665603ull;
+        };
+
+        // Read-only mapping of a whole file, empty if the file is missing or can't be mapped
+        class MappedFile {
+        public:
+            explicit MappedFile(const std::filesystem::path& path) {
+#ifdef _WIN32
+                _file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                    FILE_ATTRIBUTE_NORMAL, nullptr);
+                if (_file == INVALID_HANDLE_VALUE) {
+                    return;
+                }
+                LARGE_INTEGER size;
+                if (!GetFileSizeEx(_file, &size) || size.QuadPart == 0) {
+                    return;
+                }
+                _mapping = CreateFileMappingW(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                if (!_mapping) {
+                    return;
+                }
+                _data = MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+                if (_data) {
+                    _size = static_cast<std::size_t>(size.QuadPart);
+                }
+#else
+                _file = open(path.c_str(), O_RDONLY);
+                if (_file < 0) {
+                    return;
+                }
+                struct stat info;
+                if (fstat(_file, &info) != 0 || info.st_size == 0) {
+                    return;
+                }
+                auto data = mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, _file, 0);
+                if (data != MAP_FAILED) {
+                    _data = data;
+                    _size = static_cast<std::size_t>(info.st_size);
+                }
+#endif
+            }
+
+            ~MappedFile() {
+#ifdef _WIN32
+                if (_data) {
+                    UnmapViewOfFile(_data);
+                }
+                if (_mapping) {
+                    CloseHandle(_mapping);
+                }
+                if (_file != INVALID_HANDLE_VALUE) {
+                    CloseHandle(_file);
+                }
+#else
+                if (_data) {
+                    munmap(_data, _size);
+                }
+                if (_file >= 0) {
+                    close(_file);
+                }
+#endif
+            }
+
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
+
+            [[nodiscard]] std::span<const std::byte> GetBytes() const noexcept {
+                return {static_cast<const std::byte*>(_data), _size};
+            }
+
+        private:
+#ifdef _WIN32
+            HANDLE _file = INVALID_HANDLE_VALUE;
+            HANDLE _mapping = nullptr;
+#else
+            int _file = -1;
+#endif
+            void* _data = nullptr;
+            std::size_t _size = 0;
+        };
+
+        // Sequential reader over the mapped bytes, every Read fails once the data runs out
+        class Reader {
+        public:
+            explicit Reader(std::span<const std::byte> bytes) : _bytes(bytes) {}
+
+            template <class T>
+            bool Read(std::vector<T>& out, std::size_t count) {
+                static_assert(std::is_trivially_copyable_v<T>);
+                if (count > (_bytes.size() - _offset) / sizeof(T)) {
+                    return false;
+                }
+                out.resize(count);
+                std::memcpy(out.data(), _bytes.data() + _offset, count * sizeof(T));
+                _offset += count * sizeof(T);
+                return true;
+            }
+
+            template <class T>
+            bool Read(T& out) {
+                static_assert(std::is_trivially_copyable_v<T>);
+                if (sizeof(T) > _bytes.size() - _offset) {
+                    return false;
+                }
+                std::memcpy(&out, _bytes.data() + _offset, sizeof(T));
+                _offset += sizeof(T);
+                return true;
+            }
+
+            [[nodiscard]] bool AtEnd() const noexcept { return _offset == _bytes.size(); }
+
+        private:
+            std::span<const std::byte> _bytes;
+            std::size_t _offset = 0;
+        };
+
+        template <class T>
+        void Write(std::ofstream& out, std::span<const T> values) {
+            out.write(reinterpret_cast<const char*>(values.data()), static_cast<std::streamsize>(values.size_bytes()));
+        }
+    }
+
+    std::uint64_t GetPlanFingerprint(const LoadOrder& loadOrder, const Keywords& keywords, const RecipeRules& rules,
+                                     std::string_view version) noexcept {
+        Fnv1a hash;
+        hash.Add(std::uint64_t{kPlanCacheFormat});
+        hash.Add(version);
+
+        hash.Add(std::uint64_t{keywords.craftable});
+        hash.Add(keywords.levels);
+        hash.Add(keywords.rarities.size());
+        for (auto [keyword, rarity] : keywords.rarities) {
+            hash.Add((std::uint64_t{keyword} << 8) | rarity);
+        }
+        hash.Add(std::uint64_t{keywords.defaultRarity});
+        hash.Add(keywords.rarityCount);
+        hash.Add(rules.levels.size());
+        for (const auto& level : rules.levels) {
+            hash.Add(level.size());
+            for (auto [first, second] : level) {
+                hash.Add((std::uint64_t{first} << 8) | second);
+            }
+        }
+        hash.Add(rules.tripleLevels.size());
+        for (const auto& level : rules.tripleLevels) {
+            hash.Add(level.size());
+            for (auto [first, second, third] : level) {
+                hash.Add((std::uint64_t{first} << 16) | (std::uint64_t{second} << 8) | third);
+            }
+        }
+        hash.Add(rules.maxTriplesPerSignature);
+
+        // records contribute their classification instead of their keywords, so keywords other mods add or the
+        // order KID distributes them in don't invalidate a plan
+        hash.Add(loadOrder.ingredients.size());
+        for (const auto& ingr : loadOrder.ingredients) {
+            hash.Add(std::uint64_t{ingr.formId});
+            hash.Add(std::uint64_t{GetIngredientRarity(ingr, keywords)});
+            hash.Add(ingr.effects);
+        }
+        hash.Add(loadOrder.potions.size());
+        for (const auto& potion : loadOrder.potions) {
+            hash.Add(std::uint64_t{potion.formId});
+            hash.Add(static_cast<std::uint64_t>(GetPotionLevel(potion, keywords) + 1));
+            hash.Add(potion.effects);
+            hash.Add(std::uint64_t{potion.poison});
+        }
+        return hash.Get();
+    }
+
+    bool SavePlanCache(const std::filesystem::path& path, std::uint64_t fingerprint, const Plan& plan) {
+        PlanCacheHeader header;
+        header.fingerprint = fingerprint;
+        header.ingredients = static_cast<std::uint32_t>(plan.ingredientRarity.size());
+        header.potions = static_cast<std::uint32_t>(plan.potionLevel.size());
+        header.signatures = static_cast<std::uint32_t>(plan.potionTiers.SignatureCount());
+        header.tiers = static_cast<std::uint32_t>(plan.potionTiers.GetTierCount());
+        header.recipes = plan.recipes.Size();
+
+        std::vector<std::int8_t> potionLevel(plan.potionLevel.begin(), plan.potionLevel.end());
+
+        // written next to the target and renamed over it so a crash never leaves a torn cache behind
+        auto temp = path;
+        temp += ".tmp";
+        {
+            std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+            if (!out) {
+                return false;
+            }
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            Write<Index>(out, plan.potionTiers.GetSignatureOffsets());
+            Write<FormID>(out, plan.potionTiers.GetEffectFormIds());
+            Write<Index>(out, plan.potionTiers.GetPotions());
+            Write<Index>(out, plan.recipes.signature);
+            Write<Index>(out, plan.recipes.ingr1);
+            Write<Index>(out, plan.recipes.ingr2);
+            Write<Index>(out, plan.recipes.ingr3);
+            Write<std::uint8_t>(out, plan.recipes.slots1);
+            Write<std::uint8_t>(out, plan.recipes.slots2);
+            Write<std::uint8_t>(out, plan.recipes.slots3);
+            Write<std::uint8_t>(out, plan.recipes.potionMinLevel);
+            Write<std::uint8_t>(out, plan.recipes.targetIngredientLevel);
+            Write<std::uint8_t>(out, plan.recipes.poison);
+            Write<Rarity>(out, plan.ingredientRarity);
+            Write<std::int8_t>(out, potionLevel);
+            if (!out.flush()) {
+                return false;
+            }
+        }
+        std::error_code error;
+        std::filesystem::rename(temp, path, error);
+        if (error) {
+            std::filesystem::remove(temp, error);
+            return false;
+        }
+        return true;
+    }
+
+    bool LoadPlanCache(const std::filesystem::path& path, std::uint64_t fingerprint, const LoadOrder& loadOrder,
+                       Plan& plan) {
+        MappedFile file(path);
+        Reader reader(file.GetBytes());
+
+        PlanCacheHeader header;
+        if (!reader.Read(header) || header.magic != kPlanCacheMagic || header.format != kPlanCacheFormat ||
+            header.fingerprint != fingerprint || header.tiers > kMaxTiers ||
+            header.ingredients != loadOrder.ingredients.size() || header.potions != loadOrder.potions.size()) {
+            return false;
+        }
+
+        Plan loaded;
+        std::vector<Index> offsets;
+        std::vector<FormID> effects;
+        std::vector<Index> tierPotions;
+        std::vector<std::int8_t> potionLevel;
+        auto recipes = static_cast<std::size_t>(header.recipes);
+        if (!reader.Read(offsets, std::size_t{header.signatures} + 1) || offsets.front() != 0 ||
+            !std::is_sorted(offsets.begin(), offsets.end())) {
+            return false;
+        }
+        if (!reader.Read(effects, offsets.back()) ||
+            !reader.Read(tierPotions, std::size_t{header.signatures} * header.tiers) ||
+            !reader.Read(loaded.recipes.signature, recipes) || !reader.Read(loaded.recipes.ingr1, recipes) ||
+            !reader.Read(loaded.recipes.ingr2, recipes) || !reader.Read(loaded.recipes.ingr3, recipes) ||
+            !reader.Read(loaded.recipes.slots1, recipes) || !reader.Read(loaded.recipes.slots2, recipes) ||
+            !reader.Read(loaded.recipes.slots3, recipes) || !reader.Read(loaded.recipes.potionMinLevel, recipes) ||
+            !reader.Read(loaded.recipes.targetIngredientLevel, recipes) ||
+            !reader.Read(loaded.recipes.poison, recipes) || !reader.Read(loaded.ingredientRarity, header.ingredients) ||
+            !reader.Read(potionLevel, header.potions) || !reader.AtEnd()) {
+            return false;
+        }
+
+        // a file that passed the fingerprint may still have been written by a broken or foreign tool, every index
+        // is checked before the plan gets near the game
+        auto inRange = [](const auto& values, std::size_t bound, bool optional = false) {
+            return std::ranges::all_of(values, [&](auto value) {
+                return static_cast<std::size_t>(value) < bound || (optional && value == kNoIndex);
+            });
+        };
+        auto levelInRange = [&](const std::vector<std::uint8_t>& levels) {
+            return std::ranges::all_of(levels, [&](std::uint8_t level) { return level >= 1 && level <= header.tiers; });
+        };
+        if (!inRange(tierPotions, header.potions, true) || !inRange(loaded.recipes.signature, header.signatures) ||
+            !inRange(loaded.recipes.ingr1, header.ingredients) || !inRange(loaded.recipes.ingr2, header.ingredients) ||
+            !inRange(loaded.recipes.ingr3, header.ingredients, true) || !levelInRange(loaded.recipes.potionMinLevel) ||
+            !levelInRange(loaded.recipes.targetIngredientLevel) || !inRange(loaded.ingredientRarity, kMaxRarities)) {
+            return false;
+        }
+
+        loaded.potionTiers.Reset(std::move(effects), std::move(offsets), static_cast<int>(header.tiers),
+                                 std::move(tierPotions));
+        loaded.potionTiers.Finalize();
+        // recipes index potionForms with the potion of their tier, a tier without one has nothing to craft
+        for (Index recipe = 0; recipe < recipes; recipe++) {
+            if (GetRecipePotion(loaded, recipe) == kNoIndex) {
+                return false;
+            }
+        }
+        loaded.potionLevel.assign(potionLevel.begin(), potionLevel.end());
+
+        plan = std::move(loaded);
+        return true;
+    }
+}
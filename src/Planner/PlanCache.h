@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+
+#include "Planner.h"
+
+// Binary snapshot of a finished Plan so unchanged load orders can skip planning on the next start.
+//
+// Layout (little endian, 4 byte sections come first so every section stays aligned when mapped):
+//   PlanCacheHeader
+//   Index    signatureOffsets[signatures + 1]             effect signatures of Plan::potionTiers in dense id order
+//   FormID   signatureEffects[signatureOffsets[signatures]]
+//   Index    tierPotions[signatures][tiers]
+//   Index    recipe signature / ingr1 / ingr2 / ingr3 columns[recipes]
+//   uint8_t  recipe slots1 / slots2 / slots3 / potionMinLevel / targetIngredientLevel / poison columns[recipes]
+//   uint8_t  ingredientRarity[ingredients]
+//   int8_t   potionLevel[potions]
+namespace AlchemyPlanner {
+    inline constexpr std::uint32_t kPlanCacheMagic = 0x43505241;  // "ARPC"
+    // bump whenever the layout or the planning rules change
+    inline constexpr std::uint32_t kPlanCacheFormat = 5;
+    // version hashed into the fingerprint of plans compiled offline, set by the build
+    inline constexpr std::string_view kPrebuiltPlanVersion = ALCHEMY_REWORKED_VERSION;
+
+    struct PlanCacheHeader {
+        std::uint32_t magic = kPlanCacheMagic;
+        std::uint32_t format = kPlanCacheFormat;
+        std::uint64_t fingerprint = 0;
+        std::uint32_t ingredients = 0;
+        std::uint32_t potions = 0;
+        std::uint32_t signatures = 0;
+        std::uint32_t tiers = 0;
+        std::uint64_t recipes = 0;
+    };
+
+    // Hash of everything planning depends on: FormIDs, effects and classification of the records, the keywords and
+    // rules used and the plugin version. Names and keywords that don't change a classification are left out, they
+    // don't change the plan.
+    [[nodiscard]] std::uint64_t GetPlanFingerprint(const LoadOrder& loadOrder, const Keywords& keywords,
+                                                   const RecipeRules& rules, std::string_view version) noexcept;
+
+    // Planning scratch (rarity lists, effect index) and the tier fallbacks are not stored, fallbacks are rebuilt on
+    // load and the plan looks like one after ReleasePlanningScratch(). Returns false if the file couldn't be written.
+    bool SavePlanCache(const std::filesystem::path& path, std::uint64_t fingerprint, const Plan& plan);
+
+    // Maps the file and copies it into plan if the fingerprint matches, it was written for as many ingredients and
+    // potions as loadOrder has, its indices are consistent and every recipe has a potion. plan is left untouched
+    // otherwise.
+    bool LoadPlanCache(const std::filesystem::path& path, std::uint64_t fingerprint, const LoadOrder& loadOrder,
+                       Plan& plan);
+}
@@ -0,0 +1,1289 @@
+#include "Planner.h"
+
+#include <algorithm>
+#include <future>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+#include "Metrics.h"
+#include "Parallel.h"
+
+namespace AlchemyPlanner {
+    namespace {
+        constexpr std::size_t kMinParallelRecipes = 1 << 16;
+
+        // Rarity pairs per level. Rules of one level that name the same pair (common|rare and rare|common) are
+        // merged, distinct pairs never share an ingredient pair since every ingredient has a single rarity. Levels
+        // without rules get no pairs.
+        std::vector<std::vector<RarityPair>> GetRarityPairsByLevel(const RecipeRules& rules, int tierCount,
+                                                                   std::size_t rarityCount) {
+            std::vector<std::vector<RarityPair>> pairs(static_cast<std::size_t>(tierCount));
+            for (std::size_t level = 0; level < pairs.size() && level < rules.levels.size(); level++) {
+                auto& levelPairs = pairs[level];
+                for (auto [first, second] : rules.levels[level]) {
+                    auto pair = MakeRarityPair(first, second);
+                    if (pair.second < rarityCount &&
+                        std::find(levelPairs.begin(), levelPairs.end(), pair) == levelPairs.end()) {
+                        levelPairs.push_back(pair);
+                    }
+                }
+            }
+            return pairs;
+        }
+
+        // Rarity triples per level, merged and filtered like the pairs
+        std::vector<std::vector<RarityTriple>> GetRarityTriplesByLevel(const RecipeRules& rules, int tierCount,
+                                                                       std::size_t rarityCount) {
+            std::vector<std::vector<RarityTriple>> triples(static_cast<std::size_t>(tierCount));
+            for (std::size_t level = 0; level < triples.size() && level < rules.tripleLevels.size(); level++) {
+                auto& levelTriples = triples[level];
+                for (auto [first, second, third] : rules.tripleLevels[level]) {
+                    auto triple = MakeRarityTriple(first, second, third);
+                    if (triple[2] < rarityCount &&
+                        std::find(levelTriples.begin(), levelTriples.end(), triple) == levelTriples.end()) {
+                        levelTriples.push_back(triple);
+                    }
+                }
+            }
+            return triples;
+        }
+
+        // "rarity|rarity|..." with exactly rarities.size() names
+        bool ParseRarities(std::string_view rule, std::span<const std::string> rarityNames,
+                           std::span<Rarity> rarities) noexcept {
+            for (std::size_t i = 0; i < rarities.size(); i++) {
+                auto delimiter = rule.find('|');
+                if ((delimiter == std::string_view::npos) != (i + 1 == rarities.size())) {
+                    return false;
+                }
+                auto name = rule.substr(0, delimiter);
+                auto begin = name.find_first_not_of(' ');
+                name = begin == std::string_view::npos ? std::string_view{} : name.substr(begin);
+                name = name.substr(0, name.find_last_not_of(' ') + 1);
+                auto it = std::find(rarityNames.begin(), rarityNames.end(), name);
+                if (it == rarityNames.end()) {
+                    return false;
+                }
+                rarities[i] = static_cast<Rarity>(it - rarityNames.begin());
+                rule.remove_prefix(delimiter == std::string_view::npos ? rule.size() : delimiter + 1);
+            }
+            return true;
+        }
+
+        // Signature effects an ingredient carries, bit i stands for signature[i]
+        std::uint8_t GetSignatureBits(std::span<const FormID> effects, std::span<const FormID> signature) {
+            std::uint8_t bits = 0;
+            for (std::size_t slot = 0; slot < effects.size() && slot < kMaxEffectSlots; slot++) {
+                auto it = std::lower_bound(signature.begin(), signature.end(), effects[slot]);
+                if (it != signature.end() && *it == effects[slot]) {
+                    bits |= static_cast<std::uint8_t>(1u << (it - signature.begin()));
+                }
+            }
+            return bits;
+        }
+
+        // Slots holding the signature effects selected by signatureBits, the first slot of an effect listed twice
+        // like the effect index
+        std::uint8_t GetSlotMask(std::span<const FormID> effects, std::span<const FormID> signature,
+                                 std::uint32_t signatureBits = ~0u) {
+            std::uint8_t mask = 0;
+            for (std::size_t slot = 0; slot < effects.size() && slot < kMaxEffectSlots; slot++) {
+                auto it = std::lower_bound(signature.begin(), signature.end(), effects[slot]);
+                auto selected = it != signature.end() && *it == effects[slot] &&
+                                ((signatureBits >> (it - signature.begin())) & 1);
+                if (selected &&
+                    std::find(effects.begin(), effects.begin() + slot, effects[slot]) == effects.begin() + slot) {
+                    mask |= static_cast<std::uint8_t>(1u << slot);
+                }
+            }
+            return mask;
+        }
+
+        static_assert(kMaxTiers <= 16, "PerkSnapshot keeps unlocked levels in 16 bits");
+        static_assert(kMaxEffectSlots <= 8, "recipes keep effect slots in a byte");
+
+        // Ingredients carrying every effect of a multi effect signature, per rarity. Effects of those signatures get
+        // dense bit ids and every ingredient a bitset of the ones it carries, so checking a candidate is a few word
+        // ANDs against the signature mask instead of a scan per effect. Single effect signatures are served by the
+        // effect index directly and have no lists in here.
+        class SignatureIngredients {
+        public:
+            // only signatures set in planned get lists, every signature if it is empty
+            SignatureIngredients(const LoadOrder& loadOrder, const Plan& plan, std::span<const std::uint8_t> planned)
+                : _rarityCount(plan.effectIngredients.GetRarityCount()) {
+                const auto& tiers = plan.potionTiers;
+                const auto& index = plan.effectIngredients;
+                std::vector<FormID> bitEffects;
+                for (Index signature = 0; signature < tiers.SignatureCount(); signature++) {
+                    auto effects = tiers.GetEffects(signature);
+                    if (effects.size() > 1 && (planned.empty() || planned[signature])) {
+                        bitEffects.insert(bitEffects.end(), effects.begin(), effects.end());
+                    }
+                }
+                _offsets.assign(tiers.SignatureCount() * _rarityCount + 1, 0);
+                if (bitEffects.empty()) {
+                    return;
+                }
+                std::sort(bitEffects.begin(), bitEffects.end());
+                bitEffects.erase(std::unique(bitEffects.begin(), bitEffects.end()), bitEffects.end());
+                auto findBit = [&](FormID effect) -> std::size_t {
+                    auto it = std::lower_bound(bitEffects.begin(), bitEffects.end(), effect);
+                    return it != bitEffects.end() && *it == effect ? static_cast<std::size_t>(it - bitEffects.begin())
+                                                                   : bitEffects.size();
+                };
+
+                const auto words = (bitEffects.size() + 63) / 64;
+                const auto& ingredients = loadOrder.ingredients;
+                std::vector<std::uint64_t> masks(ingredients.size() * words);
+                for (std::size_t i = 0; i < ingredients.size(); i++) {
+                    const auto& effects = ingredients[i].effects;
+                    for (std::size_t slot = 0; slot < effects.size() && slot < kMaxEffectSlots; slot++) {
+                        if (auto bit = findBit(effects[slot]); bit < bitEffects.size()) {
+                            masks[i * words + bit / 64] |= std::uint64_t{1} << (bit % 64);
+                        }
+                    }
+                }
+
+                std::vector<std::uint64_t> signatureMask(words);
+                for (Index signature = 0; signature < tiers.SignatureCount(); signature++) {
+                    auto effects = tiers.GetEffects(signature);
+                    const auto isPlanned = planned.empty() || planned[signature];
+                    if (effects.size() > 1 && isPlanned) {
+                        std::fill(signatureMask.begin(), signatureMask.end(), 0);
+                        for (auto effect : effects) {
+                            auto bit = findBit(effect);
+                            signatureMask[bit / 64] |= std::uint64_t{1} << (bit % 64);
+                        }
+                    }
+                    for (Rarity rarity = 0; rarity < _rarityCount; rarity++) {
+                        auto bucket = signature * _rarityCount + rarity;
+                        _offsets[bucket] = static_cast<Index>(_ingredients.size());
+                        if (effects.size() < 2 || !isPlanned) {
+                            continue;
+                        }
+                        // candidates come from the shortest list of any effect of the signature
+                        std::span<const Index> candidates;
+                        for (std::size_t k = 0; k < effects.size(); k++) {
+                            auto list = index.Get(index.Find(effects[k]), rarity);
+                            if (k == 0 || list.size() < candidates.size()) {
+                                candidates = list;
+                            }
+                        }
+                        for (auto ingredient : candidates) {
+                            const auto* mask = &masks[ingredient * words];
+                            bool covers = true;
+                            for (std::size_t word = 0; word < words && covers; word++) {
+                                covers = (mask[word] & signatureMask[word]) == signatureMask[word];
+                            }
+                            if (covers) {
+                                _ingredients.push_back(ingredient);
+                                _slotMasks.push_back(GetSlotMask(ingredients[ingredient].effects, effects));
+                            }
+                        }
+                    }
+                }
+                _offsets.back() = static_cast<Index>(_ingredients.size());
+            }
+
+            [[nodiscard]] std::span<const Index> Get(Index signature, Rarity rarity) const noexcept {
+                auto bucket = signature * _rarityCount + rarity;
+                return std::span<const Index>(_ingredients)
+                    .subspan(_offsets[bucket], _offsets[bucket + 1] - _offsets[bucket]);
+            }
+
+            [[nodiscard]] std::span<const std::uint8_t> GetSlotMasks(Index signature, Rarity rarity) const noexcept {
+                auto bucket = signature * _rarityCount + rarity;
+                return std::span<const std::uint8_t>(_slotMasks)
+                    .subspan(_offsets[bucket], _offsets[bucket + 1] - _offsets[bucket]);
+            }
+
+        private:
+            std::size_t _rarityCount;
+            // start of the (signature, rarity) list, SignatureCount() * rarityCount + 1 entries
+            std::vector<Index> _offsets;
+            std::vector<Index> _ingredients;
+            std::vector<std::uint8_t> _slotMasks;
+        };
+
+        // distinct unordered triples from three ingredient lists, secondSame/thirdSame mark a list that is the
+        // previous one again
+        constexpr std::size_t CountTriples(std::size_t first, std::size_t second, std::size_t third, bool secondSame,
+                                           bool thirdSame) noexcept {
+            auto choose2 = [](std::size_t n) { return n > 1 ? n * (n - 1) / 2 : 0; };
+            if (secondSame && thirdSame) {
+                return first > 2 ? first * (first - 1) * (first - 2) / 6 : 0;
+            }
+            if (secondSame) {
+                return choose2(first) * third;
+            }
+            if (thirdSame) {
+                return first * choose2(second);
+            }
+            return first * second * third;
+        }
+
+        // Ingredients of one rarity carrying the same effects of a signature (bit i = signature effect i)
+        struct TripleGroup {
+            Rarity rarity;
+            std::uint8_t bits;
+            std::span<const Index> ingredients;
+        };
+
+        // Recipes of one (signature, level, rule), every job gets a fixed slice of the table starting at offset
+        struct PairJob {
+            Index signature;
+            std::span<const Index> first;
+            std::span<const std::uint8_t> firstSlots;
+            std::span<const Index> second;
+            std::span<const std::uint8_t> secondSlots;
+            PairLists relation;
+            std::uint8_t level;
+            bool poison;
+            std::size_t offset;
+        };
+
+        struct TripleJob {
+            Index signature;
+            // ascending group ids, a group repeats when several ingredients come from it
+            std::array<Index, 3> groups;
+            // signature bits the ingredients of each group contribute to the potion
+            std::array<std::uint8_t, 3> contributed;
+            std::uint8_t level;
+            bool poison;
+            // first count triples of the groups, the per signature cap may cut a job short
+            std::size_t count;
+            std::size_t offset;
+        };
+
+        // Every pair and triple job of a planning run in the serial order, with the exact recipe counts.
+        //
+        // Triples are decided per group of ingredients sharing rarity and signature effects, never per ingredient,
+        // so pruning costs the group count cubed per signature instead of the ingredient count cubed. A triple of
+        // groups is kept only if every signature effect is on at least two of the three ingredients, every
+        // ingredient shares an effect with another one and either no pair of them crafts the signature on its own
+        // (the third ingredient adds the missing effect) or the triple level is above every level its pairs craft
+        // (the third ingredient bumps the tier).
+        class RecipeJobs {
+        public:
+            RecipeJobs(const LoadOrder& loadOrder, const RecipeRules& rules, const Plan& plan,
+                       std::uint32_t levelMask, std::span<const std::uint8_t> signatureMask = {})
+                : _signatureIngredients(loadOrder, plan, signatureMask),
+                  _levelMask(levelMask),
+                  _signatureMask(signatureMask) {
+                const auto& tiers = plan.potionTiers;
+                const auto& index = plan.effectIngredients;
+                const auto tierCount = static_cast<std::size_t>(tiers.GetTierCount());
+                const auto rarityCount = index.GetRarityCount();
+                const auto rarityPairs = GetRarityPairsByLevel(rules, tiers.GetTierCount(), rarityCount);
+                const auto rarityTriples = GetRarityTriplesByLevel(rules, tiers.GetTierCount(), rarityCount);
+                projection.pairs.assign(tierCount, 0);
+                projection.triples.assign(tierCount, 0);
+
+                bool planTriples = false;
+                if (rules.maxTriplesPerSignature > 0) {
+                    for (const auto& level : rarityTriples) {
+                        planTriples |= !level.empty();
+                    }
+                }
+                if (planTriples) {
+                    CollectTripleCandidates(loadOrder, plan, rarityTriples);
+                }
+
+                // ingredients of a signature and rarity that can be part of its pairs, with their slot masks
+                auto getIngredients = [&](Index signature, Rarity rarity) {
+                    auto effects = tiers.GetEffects(signature);
+                    if (effects.size() > 1) {
+                        return std::pair{_signatureIngredients.Get(signature, rarity),
+                                         _signatureIngredients.GetSlotMasks(signature, rarity)};
+                    }
+                    auto effect = index.Find(effects[0]);
+                    return std::pair{index.Get(effect, rarity), index.GetSlotMasks(effect, rarity)};
+                };
+
+                // highest level each rarity pair crafts the signature at, 0 if none
+                std::vector<std::uint8_t> pairLevels(rarityCount * rarityCount);
+                for (Index signature = 0; signature < tiers.SignatureCount(); signature++) {
+                    if (!IsPlanned(signature)) {
+                        continue;
+                    }
+                    std::fill(pairLevels.begin(), pairLevels.end(), std::uint8_t{0});
+                    for (int level = 1; level <= tiers.GetTierCount(); level++) {
+                        auto potion = tiers.Get(signature, level);
+                        if (potion == kNoIndex) {
+                            continue;
+                        }
+                        for (const auto& [first, second] : rarityPairs[level - 1]) {
+                            pairLevels[first * rarityCount + second] = static_cast<std::uint8_t>(level);
+                            if (!IsPlanned(level)) {
+                                continue;
+                            }
+                            auto relation = first == second ? PairLists::kSame : PairLists::kDisjoint;
+                            auto [firstList, firstSlots] = getIngredients(signature, first);
+                            auto [secondList, secondSlots] = getIngredients(signature, second);
+                            auto count = CountPairs(firstList.size(), secondList.size(), relation);
+                            if (!count) {
+                                continue;
+                            }
+                            pairs.push_back({signature, firstList, firstSlots, secondList, secondSlots, relation,
+                                             static_cast<std::uint8_t>(level), loadOrder.potions[potion].poison,
+                                             total});
+                            total += count;
+                            projection.pairs[level - 1] += count;
+                        }
+                    }
+                    if (planTriples) {
+                        AddTripleJobs(loadOrder, plan, rules, signature, rarityTriples, pairLevels);
+                    }
+                }
+            }
+
+            [[nodiscard]] bool IsPlanned(int level) const noexcept { return ((_levelMask >> (level - 1)) & 1) != 0; }
+
+            [[nodiscard]] bool IsPlanned(Index signature) const noexcept {
+                return _signatureMask.empty() || _signatureMask[signature];
+            }
+
+            [[nodiscard]] const TripleGroup& GetGroup(Index group) const noexcept { return _groups[group]; }
+
+            std::vector<PairJob> pairs;
+            std::vector<TripleJob> triples;
+            RecipeProjection projection;
+            std::size_t total = 0;
+
+        private:
+            struct CandidateRange {
+                Rarity rarity;
+                std::uint8_t bits;
+                Index begin;
+                Index end;
+            };
+
+            bool HasTripleLevel(const PotionTierTable& tiers, Index signature,
+                                const std::vector<std::vector<RarityTriple>>& rarityTriples) const {
+                for (int level = 1; level <= tiers.GetTierCount(); level++) {
+                    if (IsPlanned(level) && !rarityTriples[level - 1].empty() &&
+                        tiers.Get(signature, level) != kNoIndex) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            // Ingredients carrying any effect of a multi effect signature, grouped by rarity and carried effects.
+            // Collected for every signature upfront so the groups can point into one array.
+            void CollectTripleCandidates(const LoadOrder& loadOrder, const Plan& plan,
+                                         const std::vector<std::vector<RarityTriple>>& rarityTriples) {
+                const auto& tiers = plan.potionTiers;
+                const auto& index = plan.effectIngredients;
+                _rangeOffsets.assign(tiers.SignatureCount() + 1, 0);
+                std::vector<std::pair<std::uint8_t, Index>> candidates;
+                for (Index signature = 0; signature < tiers.SignatureCount(); signature++) {
+                    _rangeOffsets[signature] = static_cast<Index>(_ranges.size());
+                    auto effects = tiers.GetEffects(signature);
+                    if (effects.size() < 2 || effects.size() > kMaxEffectSlots || !IsPlanned(signature) ||
+                        !HasTripleLevel(tiers, signature, rarityTriples)) {
+                        continue;
+                    }
+                    for (Rarity rarity = 0; rarity < index.GetRarityCount(); rarity++) {
+                        candidates.clear();
+                        for (auto effect : effects) {
+                            for (auto ingredient : index.Get(index.Find(effect), rarity)) {
+                                candidates.emplace_back(std::uint8_t{0}, ingredient);
+                            }
+                        }
+                        std::sort(candidates.begin(), candidates.end(),
+                                  [](const auto& a, const auto& b) { return a.second < b.second; });
+                        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+                        for (auto& [bits, ingredient] : candidates) {
+                            bits = GetSignatureBits(loadOrder.ingredients[ingredient].effects, effects);
+                        }
+                        std::sort(candidates.begin(), candidates.end());
+                        for (std::size_t i = 0; i < candidates.size(); i++) {
+                            if (i == 0 || candidates[i].first != candidates[i - 1].first) {
+                                auto begin = static_cast<Index>(_tripleIngredients.size());
+                                _ranges.push_back({rarity, candidates[i].first, begin, begin});
+                            }
+                            _tripleIngredients.push_back(candidates[i].second);
+                            _ranges.back().end = static_cast<Index>(_tripleIngredients.size());
+                        }
+                    }
+                }
+                _rangeOffsets.back() = static_cast<Index>(_ranges.size());
+            }
+
+            void AddTripleJobs(const LoadOrder& loadOrder, const Plan& plan, const RecipeRules& rules,
+                               Index signature, const std::vector<std::vector<RarityTriple>>& rarityTriples,
+                               std::span<const std::uint8_t> pairLevels) {
+                const auto& tiers = plan.potionTiers;
+                const auto& index = plan.effectIngredients;
+                const auto rarityCount = index.GetRarityCount();
+                auto effects = tiers.GetEffects(signature);
+                if (effects.size() > kMaxEffectSlots || !HasTripleLevel(tiers, signature, rarityTriples)) {
+                    return;
+                }
+
+                // groups of this signature sorted by rarity, then by carried effects
+                auto firstGroup = static_cast<Index>(_groups.size());
+                if (effects.size() == 1) {
+                    auto effect = index.Find(effects[0]);
+                    for (Rarity rarity = 0; rarity < rarityCount; rarity++) {
+                        if (auto ingredients = index.Get(effect, rarity); !ingredients.empty()) {
+                            _groups.push_back({rarity, 1, ingredients});
+                        }
+                    }
+                } else {
+                    for (auto i = _rangeOffsets[signature]; i < _rangeOffsets[signature + 1]; i++) {
+                        const auto& range = _ranges[i];
+                        _groups.push_back({range.rarity, range.bits,
+                                           std::span<const Index>(_tripleIngredients)
+                                               .subspan(range.begin, range.end - range.begin)});
+                    }
+                }
+                auto lastGroup = static_cast<Index>(_groups.size());
+                const auto full = static_cast<std::uint8_t>((1u << effects.size()) - 1);
+
+                for (int level = 1; level <= tiers.GetTierCount(); level++) {
+                    auto potion = tiers.Get(signature, level);
+                    if (potion == kNoIndex || !IsPlanned(level)) {
+                        continue;
+                    }
+                    auto remaining = rules.maxTriplesPerSignature;
+                    for (const auto& rarities : rarityTriples[level - 1]) {
+                        for (auto g1 = firstGroup; g1 < lastGroup && remaining; g1++) {
+                            if (_groups[g1].rarity != rarities[0]) {
+                                continue;
+                            }
+                            for (auto g2 = rarities[1] == rarities[0] ? g1 : firstGroup; g2 < lastGroup && remaining;
+                                 g2++) {
+                                if (_groups[g2].rarity != rarities[1]) {
+                                    continue;
+                                }
+                                for (auto g3 = rarities[2] == rarities[1] ? g2 : firstGroup;
+                                     g3 < lastGroup && remaining; g3++) {
+                                    if (_groups[g3].rarity != rarities[2]) {
+                                        continue;
+                                    }
+                                    std::array<Index, 3> groups{g1, g2, g3};
+                                    auto count = EvaluateTriple(groups, full, level, pairLevels, rarityCount);
+                                    count = std::min(count, remaining);
+                                    if (!count) {
+                                        continue;
+                                    }
+                                    auto [b1, b2, b3] = std::array{_groups[g1].bits, _groups[g2].bits,
+                                                                   _groups[g3].bits};
+                                    triples.push_back({signature,
+                                                       groups,
+                                                       {static_cast<std::uint8_t>(b1 & (b2 | b3)),
+                                                        static_cast<std::uint8_t>(b2 & (b1 | b3)),
+                                                        static_cast<std::uint8_t>(b3 & (b1 | b2))},
+                                                       static_cast<std::uint8_t>(level),
+                                                       loadOrder.potions[potion].poison,
+                                                       count,
+                                                       total});
+                                    total += count;
+                                    remaining -= count;
+                                    projection.triples[level - 1] += count;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+
+            // Triples the groups give at level after pruning, 0 if the third ingredient adds nothing
+            std::size_t EvaluateTriple(const std::array<Index, 3>& groups, std::uint8_t full, int level,
+                                       std::span<const std::uint8_t> pairLevels, std::size_t rarityCount) const {
+                const auto& a = _groups[groups[0]];
+                const auto& b = _groups[groups[1]];
+                const auto& c = _groups[groups[2]];
+                // the game keeps effects at least two ingredients share
+                if (((a.bits & b.bits) | (a.bits & c.bits) | (b.bits & c.bits)) != full) {
+                    return 0;
+                }
+                if (!(a.bits & (b.bits | c.bits)) || !(b.bits & (a.bits | c.bits)) || !(c.bits & (a.bits | b.bits))) {
+                    return 0;
+                }
+                int bestPair = 0;
+                for (auto [x, y] : {std::pair{&a, &b}, std::pair{&a, &c}, std::pair{&b, &c}}) {
+                    if (x->bits == full && y->bits == full) {
+                        auto pair = MakeRarityPair(x->rarity, y->rarity);
+                        bestPair = std::max<int>(bestPair, pairLevels[pair.first * rarityCount + pair.second]);
+                    }
+                }
+                if (level <= bestPair) {
+                    return 0;
+                }
+                return CountTriples(a.ingredients.size(), b.ingredients.size(), c.ingredients.size(),
+                                    groups[1] == groups[0], groups[2] == groups[1]);
+            }
+
+            SignatureIngredients _signatureIngredients;
+            std::vector<Index> _tripleIngredients;
+            std::vector<CandidateRange> _ranges;
+            // ranges of signature i are _ranges[_rangeOffsets[i].._rangeOffsets[i + 1]]
+            std::vector<Index> _rangeOffsets;
+            std::vector<TripleGroup> _groups;
+            std::uint32_t _levelMask;
+            std::span<const std::uint8_t> _signatureMask;
+        };
+    }
+
+    void RecipeTable::Reserve(std::size_t count) {
+        signature.reserve(count);
+        ingr1.reserve(count);
+        ingr2.reserve(count);
+        ingr3.reserve(count);
+        slots1.reserve(count);
+        slots2.reserve(count);
+        slots3.reserve(count);
+        potionMinLevel.reserve(count);
+        targetIngredientLevel.reserve(count);
+        poison.reserve(count);
+    }
+
+    void RecipeTable::Resize(std::size_t count) {
+        signature.resize(count);
+        ingr1.resize(count);
+        ingr2.resize(count);
+        ingr3.resize(count);
+        slots1.resize(count);
+        slots2.resize(count);
+        slots3.resize(count);
+        potionMinLevel.resize(count);
+        targetIngredientLevel.resize(count);
+        poison.resize(count);
+    }
+
+    void RecipeTable::Set(std::size_t row, Index signatureId, Index first, std::uint8_t firstSlots, Index second,
+                          std::uint8_t secondSlots, int minLevel, int targetLevel, bool isPoison, Index third,
+                          std::uint8_t thirdSlots) noexcept {
+        signature[row] = signatureId;
+        ingr1[row] = first;
+        ingr2[row] = second;
+        ingr3[row] = third;
+        slots1[row] = firstSlots;
+        slots2[row] = secondSlots;
+        slots3[row] = thirdSlots;
+        potionMinLevel[row] = static_cast<std::uint8_t>(minLevel);
+        targetIngredientLevel[row] = static_cast<std::uint8_t>(targetLevel);
+        poison[row] = isPoison ? 1 : 0;
+    }
+
+    void RecipeTable::Add(Index signatureId, Index first, std::uint8_t firstSlots, Index second,
+                          std::uint8_t secondSlots, int minLevel, int targetLevel, bool isPoison, Index third,
+                          std::uint8_t thirdSlots) {
+        signature.push_back(signatureId);
+        ingr1.push_back(first);
+        ingr2.push_back(second);
+        ingr3.push_back(third);
+        slots1.push_back(firstSlots);
+        slots2.push_back(secondSlots);
+        slots3.push_back(thirdSlots);
+        potionMinLevel.push_back(static_cast<std::uint8_t>(minLevel));
+        targetIngredientLevel.push_back(static_cast<std::uint8_t>(targetLevel));
+        poison.push_back(isPoison ? 1 : 0);
+    }
+
+    void RecipeTable::ShrinkToFit() {
+        signature.shrink_to_fit();
+        ingr1.shrink_to_fit();
+        ingr2.shrink_to_fit();
+        ingr3.shrink_to_fit();
+        slots1.shrink_to_fit();
+        slots2.shrink_to_fit();
+        slots3.shrink_to_fit();
+        potionMinLevel.shrink_to_fit();
+        targetIngredientLevel.shrink_to_fit();
+        poison.shrink_to_fit();
+    }
+
+    std::optional<RarityPair> ParseRarityPair(std::string_view rule,
+                                              std::span<const std::string> rarityNames) noexcept {
+        std::array<Rarity, 2> rarities;
+        if (!ParseRarities(rule, rarityNames, rarities)) {
+            return std::nullopt;
+        }
+        return MakeRarityPair(rarities[0], rarities[1]);
+    }
+
+    std::optional<RarityTriple> ParseRarityTriple(std::string_view rule,
+                                                  std::span<const std::string> rarityNames) noexcept {
+        std::array<Rarity, 3> rarities;
+        if (!ParseRarities(rule, rarityNames, rarities)) {
+            return std::nullopt;
+        }
+        return MakeRarityTriple(rarities[0], rarities[1], rarities[2]);
+    }
+
+    std::vector<FormID> MakeEffectSignature(std::span<const FormID> effects) {
+        std::vector<FormID> signature;
+        signature.reserve(effects.size());
+        for (auto effect : effects) {
+            if (effect != 0) {
+                signature.push_back(effect);
+            }
+        }
+        std::sort(signature.begin(), signature.end());
+        signature.erase(std::unique(signature.begin(), signature.end()), signature.end());
+        return signature;
+    }
+
+    void PotionTierTable::Reset(std::vector<FormID> effects, std::vector<Index> offsets, int tierCount,
+                                std::vector<Index> potions) {
+        _effects = std::move(effects);
+        _offsets = std::move(offsets);
+        if (_offsets.empty()) {
+            _offsets.push_back(0);
+        }
+        _tierCount = tierCount;
+        _potions = std::move(potions);
+        _potions.resize(SignatureCount() * static_cast<std::size_t>(tierCount), kNoIndex);
+        _fallbacks.clear();
+    }
+
+    void PotionTierTable::Finalize() {
+        _fallbacks.resize(_potions.size());
+        for (Index signature = 0; signature < SignatureCount(); signature++) {
+            // level1 is taken as is, every higher level inherits the closest lower potion when it has none
+            auto fallback = _tierCount > 0 ? Get(signature, 1) : kNoIndex;
+            for (int level = 1; level <= _tierCount; level++) {
+                if (level > 1 && Get(signature, level) != kNoIndex) {
+                    fallback = Get(signature, level);
+                }
+                _fallbacks[Slot(signature, level)] = fallback;
+            }
+        }
+    }
+
+    Index PotionTierTable::Find(std::span<const FormID> signature) const noexcept {
+        // lower bound over the signatures
+        Index low = 0;
+        auto high = static_cast<Index>(SignatureCount());
+        while (low < high) {
+            auto middle = low + (high - low) / 2;
+            auto effects = GetEffects(middle);
+            if (std::lexicographical_compare(effects.begin(), effects.end(), signature.begin(), signature.end())) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return low < SignatureCount() && std::ranges::equal(GetEffects(low), signature) ? low : kNoIndex;
+    }
+
+    Index EffectIngredientIndex::Find(FormID effect) const noexcept {
+        auto it = _effectIds.find(effect);
+        return it != _effectIds.end() ? it->second : kNoIndex;
+    }
+
+    std::span<const Index> EffectIngredientIndex::Get(Index effect, Rarity rarity) const noexcept {
+        if (effect == kNoIndex || effect >= EffectCount()) {
+            return {};
+        }
+        auto bucket = effect * _rarityCount + rarity;
+        return std::span<const Index>(_ingredients).subspan(_offsets[bucket], _offsets[bucket + 1] - _offsets[bucket]);
+    }
+
+    std::span<const std::uint8_t> EffectIngredientIndex::GetSlotMasks(Index effect, Rarity rarity) const noexcept {
+        if (effect == kNoIndex || effect >= EffectCount()) {
+            return {};
+        }
+        auto bucket = effect * _rarityCount + rarity;
+        return std::span<const std::uint8_t>(_slots).subspan(_offsets[bucket], _offsets[bucket + 1] - _offsets[bucket]);
+    }
+
+    void EffectIngredientIndex::Add(Index ingredient, Rarity rarity, std::span<const FormID> effects) {
+        for (std::size_t slot = 0; slot < effects.size() && slot < kMaxEffectSlots; slot++) {
+            auto effect = effects[slot];
+            if (effect == 0) {
+                continue;
+            }
+            auto [it, inserted] = _effectIds.try_emplace(effect, static_cast<Index>(_effectIds.size()));
+            if (inserted) {
+                _buckets.resize(_buckets.size() + _rarityCount);
+                _bucketSlots.resize(_bucketSlots.size() + _rarityCount);
+            }
+            auto id = it->second * _rarityCount + rarity;
+            auto& bucket = _buckets[id];
+            // same effect listed twice on one ingredient, the first slot is the one the game reports as known
+            if (bucket.empty() || bucket.back() != ingredient) {
+                bucket.push_back(ingredient);
+                _bucketSlots[id].push_back(static_cast<std::uint8_t>(1u << slot));
+            }
+        }
+    }
+
+    void EffectIngredientIndex::Finalize() {
+        _offsets.clear();
+        _offsets.reserve(_buckets.size() + 1);
+        std::size_t total = 0;
+        for (const auto& bucket : _buckets) {
+            total += bucket.size();
+        }
+        _ingredients.clear();
+        _ingredients.reserve(total);
+        _slots.clear();
+        _slots.reserve(total);
+        for (std::size_t i = 0; i < _buckets.size(); i++) {
+            _offsets.push_back(static_cast<Index>(_ingredients.size()));
+            _ingredients.insert(_ingredients.end(), _buckets[i].begin(), _buckets[i].end());
+            _slots.insert(_slots.end(), _bucketSlots[i].begin(), _bucketSlots[i].end());
+        }
+        _offsets.push_back(static_cast<Index>(_ingredients.size()));
+        std::vector<std::vector<Index>>().swap(_buckets);
+        std::vector<std::vector<std::uint8_t>>().swap(_bucketSlots);
+    }
+
+    void EffectIngredientIndex::Reclassify(std::span<const Rarity> ingredientRarity, std::span<const FormID> effects) {
+        // an effect keeps its range of _ingredients, only the rarity buckets inside it move
+        std::vector<std::pair<Index, std::uint8_t>> entries;
+        for (auto effect : effects) {
+            auto id = Find(effect);
+            if (id == kNoIndex) {
+                continue;
+            }
+            const auto first = id * _rarityCount;
+            const auto begin = _offsets[first];
+            const auto end = _offsets[first + _rarityCount];
+            entries.clear();
+            for (auto i = begin; i < end; i++) {
+                entries.emplace_back(_ingredients[i], _slots[i]);
+            }
+            std::sort(entries.begin(), entries.end());
+            auto row = begin;
+            for (Rarity rarity = 0; rarity < _rarityCount; rarity++) {
+                _offsets[first + rarity] = row;
+                for (auto [ingredient, slot] : entries) {
+                    if (ingredientRarity[ingredient] == rarity) {
+                        _ingredients[row] = ingredient;
+                        _slots[row++] = slot;
+                    }
+                }
+            }
+        }
+    }
+
+    bool HasKeyword(std::span<const FormID> keywords, FormID keyword) noexcept {
+        return keyword != 0 && std::find(keywords.begin(), keywords.end(), keyword) != keywords.end();
+    }
+
+    Rarity GetIngredientRarity(const IngredientRecord& ingredient, const Keywords& keywords) noexcept {
+        for (auto [keyword, rarity] : keywords.rarities) {
+            if (HasKeyword(ingredient.keywords, keyword)) {
+                return rarity;
+            }
+        }
+        return keywords.defaultRarity;
+    }
+
+    int GetPotionLevel(const PotionRecord& potion, const Keywords& keywords) noexcept {
+        if (!HasKeyword(potion.keywords, keywords.craftable) ||
+            std::ranges::all_of(potion.effects, [](FormID effect) { return effect == 0; })) {
+            return -1;
+        }
+        for (int level = 1; level <= keywords.GetTierCount(); level++) {
+            if (HasKeyword(potion.keywords, keywords.levels[level - 1])) {
+                return level;
+            }
+        }
+        return 0;
+    }
+
+    namespace {
+        // ingredientsByRarity and the effect index from plan.ingredientRarity
+        void IndexIngredients(const LoadOrder& loadOrder, std::size_t rarityCount, Plan& plan) {
+            const auto& ingredients = loadOrder.ingredients;
+            plan.ingredientsByRarity.assign(rarityCount, {});
+            plan.effectIngredients = EffectIngredientIndex(rarityCount);
+            for (Index i = 0; i < ingredients.size(); i++) {
+                auto rarity = plan.ingredientRarity[i];
+                plan.ingredientsByRarity[rarity].push_back(i);
+                plan.effectIngredients.Add(i, rarity, ingredients[i].effects);
+            }
+            plan.effectIngredients.Finalize();
+        }
+
+        // potion lines and their tiers from plan.potionLevel
+        void BuildPotionTiers(const LoadOrder& loadOrder, int tierCount, Plan& plan) {
+            const auto& potions = loadOrder.potions;
+
+            // signature of every levelled potion, potions with the same effects form one potion line
+            std::vector<std::vector<FormID>> potionSignatures(potions.size());
+            std::vector<Index> levelled;
+            for (Index i = 0; i < potions.size(); i++) {
+                if (plan.potionLevel[i] > 0) {
+                    potionSignatures[i] = MakeEffectSignature(potions[i].effects);
+                    levelled.push_back(i);
+                }
+            }
+
+            // sorted dense ids keep the recipe order independent of the record order
+            std::vector<Index> order = levelled;
+            std::sort(order.begin(), order.end(),
+                      [&](Index a, Index b) { return potionSignatures[a] < potionSignatures[b]; });
+            order.erase(std::unique(order.begin(), order.end(),
+                                    [&](Index a, Index b) { return potionSignatures[a] == potionSignatures[b]; }),
+                        order.end());
+            std::vector<FormID> effects;
+            std::vector<Index> offsets = {0};
+            for (auto potion : order) {
+                effects.insert(effects.end(), potionSignatures[potion].begin(), potionSignatures[potion].end());
+                offsets.push_back(static_cast<Index>(effects.size()));
+            }
+            plan.potionTiers.Reset(std::move(effects), std::move(offsets), tierCount);
+            for (auto i : levelled) {
+                // later records of the same signature and level win
+                plan.potionTiers.Set(plan.potionTiers.Find(potionSignatures[i]), plan.potionLevel[i], i);
+            }
+            plan.potionTiers.Finalize();
+        }
+    }
+
+    void ClassifyIngredients(const LoadOrder& loadOrder, const Keywords& keywords, Plan& plan) {
+        const auto& ingredients = loadOrder.ingredients;
+        plan.ingredientRarity.resize(ingredients.size());
+        for (Index i = 0; i < ingredients.size(); i++) {
+            plan.ingredientRarity[i] = GetIngredientRarity(ingredients[i], keywords);
+        }
+        IndexIngredients(loadOrder, keywords.rarityCount, plan);
+    }
+
+    void ClassifyPotions(const LoadOrder& loadOrder, const Keywords& keywords, Plan& plan) {
+        const auto& potions = loadOrder.potions;
+        plan.potionLevel.resize(potions.size());
+        for (Index i = 0; i < potions.size(); i++) {
+            plan.potionLevel[i] = GetPotionLevel(potions[i], keywords);
+        }
+        BuildPotionTiers(loadOrder, keywords.GetTierCount(), plan);
+    }
+
+    RecipeProjection ProjectRecipes(const LoadOrder& loadOrder, const RecipeRules& rules, const Plan& plan) {
+        return RecipeJobs(loadOrder, rules, plan, ~0u).projection;
+    }
+
+    void PlanRecipes(const LoadOrder& loadOrder, const RecipeRules& rules, Plan& plan, unsigned threads,
+                     std::uint32_t levelMask, std::span<const std::uint8_t> signatureMask) {
+        // ingredient rules:
+        // common + common = level 1
+        // common + uncommon = level 2
+        // common + rare = level 3
+        // uncommon + uncommon = level 3
+        // uncommon + rare = level 4
+        // rare + rare = level 5
+        const RecipeJobs jobs(loadOrder, rules, plan, levelMask, signatureMask);
+        plan.projection = jobs.projection;
+
+        auto& recipes = plan.recipes;
+        auto base = recipes.Size();
+        recipes.Resize(base + jobs.total);
+        // thread startup costs more than planning a vanilla sized load order
+        if (jobs.total < kMinParallelRecipes) {
+            threads = 1;
+        }
+        ParallelFor(jobs.pairs.size() + jobs.triples.size(), threads, [&](std::size_t i) {
+            if (i < jobs.pairs.size()) {
+                const auto& job = jobs.pairs[i];
+                auto row = base + job.offset;
+                EnumeratePairs(job.first, job.second, job.relation, nullptr, [&](std::size_t i, std::size_t k) {
+                    recipes.Set(row++, job.signature, job.first[i], job.firstSlots[i], job.second[k],
+                                job.secondSlots[k], job.level, job.level, job.poison);
+                });
+                return;
+            }
+            const auto& job = jobs.triples[i - jobs.pairs.size()];
+            const auto& ingredients = loadOrder.ingredients;
+            auto effects = plan.potionTiers.GetEffects(job.signature);
+            auto first = jobs.GetGroup(job.groups[0]).ingredients;
+            auto second = jobs.GetGroup(job.groups[1]).ingredients;
+            auto third = jobs.GetGroup(job.groups[2]).ingredients;
+            const bool secondSame = job.groups[1] == job.groups[0];
+            const bool thirdSame = job.groups[2] == job.groups[1];
+            auto row = base + job.offset;
+            const auto end = row + job.count;
+            for (std::size_t a = 0; a < first.size() && row < end; a++) {
+                for (std::size_t b = secondSame ? a + 1 : 0; b < second.size() && row < end; b++) {
+                    for (std::size_t c = thirdSame ? b + 1 : 0; c < third.size() && row < end; c++) {
+                        recipes.Set(row++, job.signature, first[a],
+                                    GetSlotMask(ingredients[first[a]].effects, effects, job.contributed[0]),
+                                    second[b], GetSlotMask(ingredients[second[b]].effects, effects, job.contributed[1]),
+                                    job.level, job.level, job.poison, third[c],
+                                    GetSlotMask(ingredients[third[c]].effects, effects, job.contributed[2]));
+                    }
+                }
+            }
+        });
+    }
+
+    Plan BuildPlan(const LoadOrder& loadOrder, const Keywords& keywords, const RecipeRules& rules, unsigned threads) {
+        ScopedTimer timer("plan.total");
+        Plan plan;
+        auto classifyIngredients = [&]() {
+            ScopedTimer timer("plan.classifyIngredients");
+            ClassifyIngredients(loadOrder, keywords, plan);
+        };
+        auto classifyPotions = [&]() {
+            ScopedTimer timer("plan.classifyPotions");
+            ClassifyPotions(loadOrder, keywords, plan);
+        };
+        // both classifications write to disjoint members of the plan
+        if (ResolveThreadCount(threads) > 1) {
+            auto potions = std::async(std::launch::async, classifyPotions);
+            classifyIngredients();
+            potions.get();
+        } else {
+            classifyIngredients();
+            classifyPotions();
+        }
+        {
+            ScopedTimer timer("plan.recipes");
+            PlanRecipes(loadOrder, rules, plan, threads);
+        }
+
+        auto& metrics = Metrics::GetSingleton();
+        metrics.Add("plan.ingredients", loadOrder.ingredients.size());
+        metrics.Add("plan.alchemyItems", loadOrder.potions.size());
+        metrics.Add("plan.effectSignatures", plan.potionTiers.SignatureCount());
+        metrics.Add("plan.recipesPlanned", plan.recipes.Size());
+        for (auto count : plan.projection.pairs) {
+            metrics.Add("plan.projectedPairs", count);
+        }
+        for (auto count : plan.projection.triples) {
+            metrics.Add("plan.projectedTriples", count);
+        }
+        return plan;
+    }
+
+    std::vector<Index> ReplanLevels(const LoadOrder& loadOrder, const RecipeRules& rules, Plan& plan,
+                                    std::uint32_t levelMask, unsigned threads) {
+        auto isReplanned = [levelMask](int level) { return ((levelMask >> (level - 1)) & 1) != 0; };
+
+        const auto& previous = plan.recipes;
+        std::vector<Index> previousRows;
+        RecipeTable kept;
+        for (Index i = 0; i < previous.Size(); i++) {
+            if (!isReplanned(previous.targetIngredientLevel[i])) {
+                previousRows.push_back(i);
+            }
+        }
+        kept.Reserve(previousRows.size());
+        for (auto i : previousRows) {
+            kept.Add(previous.signature[i], previous.ingr1[i], previous.slots1[i], previous.ingr2[i],
+                     previous.slots2[i], previous.potionMinLevel[i], previous.targetIngredientLevel[i],
+                     previous.poison[i] != 0, previous.ingr3[i], previous.slots3[i]);
+        }
+        plan.recipes = std::move(kept);
+
+        // every level's rules stay visible so triples of the replanned levels are pruned against all pairs
+        PlanRecipes(loadOrder, rules, plan, threads, levelMask);
+        previousRows.resize(plan.recipes.Size(), kNoIndex);
+        return previousRows;
+    }
+
+    ReconcileResult ReconcilePlan(const LoadOrder& loadOrder, const Keywords& keywords, const RecipeRules& rules,
+                                  Plan& plan, unsigned threads) {
+        ScopedTimer timer("plan.reconcile");
+        ReconcileResult result;
+        const auto tierCount = keywords.GetTierCount();
+        if (plan.ingredientRarity.size() != loadOrder.ingredients.size() ||
+            plan.potionLevel.size() != loadOrder.potions.size() || plan.potionTiers.GetTierCount() != tierCount) {
+            plan = BuildPlan(loadOrder, keywords, rules, threads);
+            result.signatures = plan.potionTiers.SignatureCount();
+            result.rebuilt = true;
+            return result;
+        }
+
+        // effects of ingredients that changed rarity, every potion line with one of them has other pairs now
+        std::vector<FormID> changedEffects;
+        std::vector<std::pair<Index, Rarity>> previousRarities;
+        for (Index i = 0; i < loadOrder.ingredients.size(); i++) {
+            auto rarity = GetIngredientRarity(loadOrder.ingredients[i], keywords);
+            if (rarity != plan.ingredientRarity[i]) {
+                previousRarities.emplace_back(i, plan.ingredientRarity[i]);
+                plan.ingredientRarity[i] = rarity;
+                const auto& effects = loadOrder.ingredients[i].effects;
+                changedEffects.insert(changedEffects.end(), effects.begin(), effects.end());
+                result.ingredients++;
+            }
+        }
+        std::sort(changedEffects.begin(), changedEffects.end());
+        changedEffects.erase(std::unique(changedEffects.begin(), changedEffects.end()), changedEffects.end());
+        // potions moved between tiers, potions outside the tiers (-1 and 0) don't change any recipe
+        std::vector<Index> changedPotions;
+        for (Index i = 0; i < loadOrder.potions.size(); i++) {
+            auto level = GetPotionLevel(loadOrder.potions[i], keywords);
+            if (level == plan.potionLevel[i]) {
+                continue;
+            }
+            if (level > 0 || plan.potionLevel[i] > 0) {
+                changedPotions.push_back(i);
+            }
+            plan.potionLevel[i] = level;
+            result.potions++;
+        }
+        if (changedEffects.empty() && changedPotions.empty()) {
+            return result;
+        }
+        auto& metrics = Metrics::GetSingleton();
+        metrics.Add("plan.reconciledIngredients", result.ingredients);
+        metrics.Add("plan.reconciledPotions", result.potions);
+
+        // plans loaded from the cache have no planning scratch, it is rebuilt from the rarities. Otherwise only the
+        // changed ingredients move.
+        if (plan.ingredientsByRarity.size() != keywords.rarityCount) {
+            IndexIngredients(loadOrder, keywords.rarityCount, plan);
+        } else if (result.ingredients) {
+            for (auto [ingredient, previous] : previousRarities) {
+                auto& from = plan.ingredientsByRarity[previous];
+                from.erase(std::lower_bound(from.begin(), from.end(), ingredient));
+                auto& to = plan.ingredientsByRarity[plan.ingredientRarity[ingredient]];
+                to.insert(std::lower_bound(to.begin(), to.end(), ingredient), ingredient);
+            }
+            plan.effectIngredients.Reclassify(plan.ingredientRarity, changedEffects);
+        }
+        if (!changedPotions.empty()) {
+            auto effects = plan.potionTiers.GetEffectFormIds();
+            auto offsets = plan.potionTiers.GetSignatureOffsets();
+            std::vector<FormID> previousEffects(effects.begin(), effects.end());
+            std::vector<Index> previousOffsets(offsets.begin(), offsets.end());
+            BuildPotionTiers(loadOrder, tierCount, plan);
+            if (!std::ranges::equal(previousEffects, plan.potionTiers.GetEffectFormIds()) ||
+                !std::ranges::equal(previousOffsets, plan.potionTiers.GetSignatureOffsets())) {
+                // potion lines were added or removed, the dense ids every recipe refers to moved
+                plan.recipes = {};
+                PlanRecipes(loadOrder, rules, plan, threads);
+                result.signatures = plan.potionTiers.SignatureCount();
+                result.rebuilt = true;
+                return result;
+            }
+        }
+
+        const auto& tiers = plan.potionTiers;
+        std::vector<std::uint8_t> signatureMask(tiers.SignatureCount());
+        for (auto potion : changedPotions) {
+            signatureMask[tiers.Find(MakeEffectSignature(loadOrder.potions[potion].effects))] = 1;
+        }
+        for (Index signature = 0; signature < tiers.SignatureCount(); signature++) {
+            for (auto effect : tiers.GetEffects(signature)) {
+                if (std::binary_search(changedEffects.begin(), changedEffects.end(), effect)) {
+                    signatureMask[signature] = 1;
+                    break;
+                }
+            }
+        }
+        result.signatures = static_cast<std::size_t>(std::count(signatureMask.begin(), signatureMask.end(), 1));
+
+        // recipes of the other potion lines keep their order and are compacted in place, the replanned ones are
+        // appended. Rows are grouped by potion line, so the kept rows are a few long runs.
+        auto& recipes = plan.recipes;
+        std::vector<std::pair<Index, Index>> keptRuns;
+        for (Index i = 0; i < recipes.Size(); i++) {
+            if (signatureMask[recipes.signature[i]]) {
+                continue;
+            }
+            if (keptRuns.empty() || keptRuns.back().second != i) {
+                keptRuns.emplace_back(i, i);
+            }
+            keptRuns.back().second = i + 1;
+        }
+        auto compact = [&keptRuns](auto& column) {
+            std::size_t kept = 0;
+            for (auto [begin, end] : keptRuns) {
+                if (kept != begin) {
+                    std::copy(column.begin() + begin, column.begin() + end, column.begin() + kept);
+                }
+                kept += end - begin;
+            }
+            column.resize(kept);
+        };
+        compact(recipes.signature);
+        compact(recipes.ingr1);
+        compact(recipes.ingr2);
+        compact(recipes.ingr3);
+        compact(recipes.slots1);
+        compact(recipes.slots2);
+        compact(recipes.slots3);
+        compact(recipes.potionMinLevel);
+        compact(recipes.targetIngredientLevel);
+        compact(recipes.poison);
+        PlanRecipes(loadOrder, rules, plan, threads, ~0u, signatureMask);
+        return result;
+    }
+
+    void ReleasePlanningScratch(Plan& plan) {
+        plan.ingredientsByRarity = {};
+        plan.effectIngredients = {};
+        plan.recipes.ShrinkToFit();
+    }
+
+    Index GetRecipePotion(const Plan& plan, Index recipe) noexcept {
+        return plan.potionTiers.Get(plan.recipes.signature[recipe], plan.recipes.targetIngredientLevel[recipe]);
+    }
+
+    void PerkSnapshot::UnlockLevel(int level) noexcept {
+        if (level < 1 || level > kMaxTiers) {
+            return;
+        }
+        _unlockedLevels |= static_cast<std::uint16_t>(1u << (level - 1));
+        _maxLevel = static_cast<std::uint8_t>(std::max<int>(_maxLevel, level));
+    }
+
+    int PerkSnapshot::GetQualityBonus(bool poison) const noexcept {
+        int increaseLevel = 0;
+        if (Has(poison ? kPoisonQuality : kPotionQuality)) {
+            increaseLevel++;
+        }
+        if (Has(kAllQuality)) {
+            increaseLevel++;
+        }
+        return increaseLevel;
+    }
+
+    RecipeOutcome EvaluateRecipe(const Plan& plan, Index recipe, const PerkSnapshot& perks) noexcept {
+        RecipeOutcome outcome;
+        int potionMinLevel = plan.recipes.potionMinLevel[recipe];
+        // must have perk to access it
+        if (!perks.IsLevelUnlocked(potionMinLevel)) {
+            return outcome;
+        }
+        outcome.unlocked = true;
+        outcome.doubleItems = perks.Has(PerkSnapshot::kDoubleItems);
+
+        int increaseLevel = perks.GetQualityBonus(plan.recipes.poison[recipe] != 0);
+        if (increaseLevel > 0) {
+            int newLevel = std::min({potionMinLevel + increaseLevel, perks.GetMaxAllowedPotionLevel(),
+                                     plan.potionTiers.GetTierCount()});
+            if (newLevel > potionMinLevel) {
+                outcome.upgradedPotion = plan.potionTiers.Resolve(plan.recipes.signature[recipe], newLevel);
+            }
+        }
+        return outcome;
+    }
+
+    RecipeOutputs::RecipeOutputs(const PerkSnapshot& perks, int tierCount) noexcept
+        : _doubleItems(perks.Has(PerkSnapshot::kDoubleItems)) {
+        for (int poison = 0; poison < 2; poison++) {
+            int increaseLevel = perks.GetQualityBonus(poison != 0);
+            for (int level = 1; level <= std::min(tierCount, kMaxTiers); level++) {
+                if (perks.IsLevelUnlocked(level)) {
+                    auto newLevel = std::min({level + increaseLevel, perks.GetMaxAllowedPotionLevel(), tierCount});
+                    _levels[poison][level] = static_cast<std::uint8_t>(std::max(newLevel, level));
+                }
+            }
+        }
+    }
+
+    Index RecipeOutputs::GetPotion(const Plan& plan, Index recipe) const noexcept {
+        auto level = GetLevel(plan.recipes, recipe);
+        if (level <= plan.recipes.potionMinLevel[recipe]) {
+            return GetRecipePotion(plan, recipe);
+        }
+        return plan.potionTiers.Resolve(plan.recipes.signature[recipe], level);
+    }
+
+    void RecipesByIngredient::Build(const RecipeTable& recipes, std::size_t ingredientCount) {
+        _offsets.assign(ingredientCount + 1, 0);
+        for (std::size_t i = 0; i < recipes.Size(); i++) {
+            _offsets[recipes.ingr1[i] + 1]++;
+            _offsets[recipes.ingr2[i] + 1]++;
+            if (recipes.ingr3[i] != kNoIndex) {
+                _offsets[recipes.ingr3[i] + 1]++;
+            }
+        }
+        for (std::size_t i = 0; i < ingredientCount; i++) {
+            _offsets[i + 1] += _offsets[i];
+        }
+        _recipes.resize(_offsets.back());
+        auto next = std::vector<Index>(_offsets.begin(), _offsets.end() - 1);
+        for (Index i = 0; i < recipes.Size(); i++) {
+            _recipes[next[recipes.ingr1[i]]++] = i;
+            _recipes[next[recipes.ingr2[i]]++] = i;
+            if (recipes.ingr3[i] != kNoIndex) {
+                _recipes[next[recipes.ingr3[i]]++] = i;
+            }
+        }
+    }
+
+    std::size_t SelectCraftableRecipes(const RecipeTable& recipes, const RecipesByIngredient& byIngredient,
+                                       std::span<const Index> heldIngredients, std::span<const std::uint8_t> held,
+                                       std::span<const std::uint8_t> allowed, std::size_t limit,
+                                       std::vector<Index>& out) {
+        std::size_t skipped = 0;
+        for (auto ingr : heldIngredients) {
+            for (auto recipe : byIngredient.Get(ingr)) {
+                // a recipe is reached through each of its ingredients, only its first one counts it
+                if (recipes.ingr1[recipe] != ingr) {
+                    continue;
+                }
+                auto third = recipes.ingr3[recipe];
+                if (!allowed[recipe] || !held[recipes.ingr2[recipe]] || (third != kNoIndex && !held[third])) {
+                    continue;
+                }
+                if (out.size() < limit) {
+                    out.push_back(recipe);
+                } else {
+                    skipped++;
+                }
+            }
+        }
+        return skipped;
+    }
+
+    void KnownRecipeTracker::Build(const RecipeTable& recipes, std::size_t ingredientCount) {
+        _byIngredient.Build(recipes, ingredientCount);
+        _pending.assign(recipes.Size(), 0);
+        _pendingCount = 0;
+        _snapshot.clear();
+    }
+
+    void KnownRecipeTracker::Reset(const RecipeTable& recipes, std::span<const Index> candidates,
+                                   std::span<const std::uint32_t> knownEffects, std::vector<Index>& known) {
+        std::fill(_pending.begin(), _pending.end(), std::uint8_t{0});
+        _pendingCount = 0;
+        for (auto recipe : candidates) {
+            if (IsRecipeKnown(recipes, recipe, knownEffects)) {
+                known.push_back(recipe);
+            } else {
+                _pending[recipe] = 1;
+                _pendingCount++;
+            }
+        }
+        _snapshot.assign(knownEffects.begin(), knownEffects.end());
+    }
+
+    std::size_t KnownRecipeTracker::Update(const RecipeTable& recipes, std::span<const std::uint32_t> knownEffects,
+                                           std::vector<Index>& known) {
+        auto before = known.size();
+        _snapshot.resize(knownEffects.size());
+        for (Index ingr = 0; ingr < knownEffects.size(); ingr++) {
+            auto learned = knownEffects[ingr] & ~_snapshot[ingr];
+            _snapshot[ingr] = knownEffects[ingr];
+            if (!learned || !_pendingCount) {
+                continue;
+            }
+            for (auto recipe : _byIngredient.Get(ingr)) {
+                auto slots = recipes.ingr1[recipe] == ingr   ? recipes.slots1[recipe]
+                             : recipes.ingr2[recipe] == ingr ? recipes.slots2[recipe]
+                                                             : recipes.slots3[recipe];
+                if (!_pending[recipe] || !(learned & slots) || !IsRecipeKnown(recipes, recipe, knownEffects)) {
+                    continue;
+                }
+                _pending[recipe] = 0;
+                _pendingCount--;
+                known.push_back(recipe);
+            }
+        }
+        return known.size() - before;
+    }
+
+    void MoveKnownRecipes(const RecipeTable& recipes, std::span<const std::uint32_t> knownEffects,
+                          std::vector<Index>& candidates, std::vector<Index>& known) {
+        std::erase_if(candidates, [&](Index recipe) {
+            if (!IsRecipeKnown(recipes, recipe, knownEffects)) {
+                return false;
+            }
+            known.push_back(recipe);
+            return true;
+        });
+    }
+}
@@ -0,0 +1,481 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Game-independent recipe planning. Everything in here works on plain FormIDs and indices into a LoadOrder so it can
+// be driven by the SKSE plugin as well as by the standalone tools.
+namespace AlchemyPlanner {
+    using FormID = std::uint32_t;
+    using Index = std::uint32_t;
+
+    inline constexpr Index kNoIndex = std::numeric_limits<Index>::max();
+    // potion levels ("tiers") are configurable, AlchemyReworked.esp ships five
+    inline constexpr int kDefaultTierCount = 5;
+    inline constexpr int kMaxTiers = 16;
+
+    // ingredient rarity tier, dense id in the order the tiers are configured (common, uncommon, rare by default)
+    using Rarity = std::uint8_t;
+    inline constexpr std::size_t kMaxRarities = 16;
+    // knownEffectFlags bits a recipe can depend on, recipes keep the slots of an ingredient as a byte mask. Game
+    // ingredients have four effects.
+    inline constexpr std::size_t kMaxEffectSlots = 8;
+
+    // unordered rarity pair of a crafting rule, smaller rarity first
+    using RarityPair = std::pair<Rarity, Rarity>;
+
+    [[nodiscard]] constexpr RarityPair MakeRarityPair(Rarity a, Rarity b) noexcept {
+        return a < b ? RarityPair{a, b} : RarityPair{b, a};
+    }
+
+    // unordered rarity triple of a three ingredient rule, sorted ascending
+    using RarityTriple = std::array<Rarity, 3>;
+
+    [[nodiscard]] constexpr RarityTriple MakeRarityTriple(Rarity a, Rarity b, Rarity c) noexcept {
+        RarityTriple triple{a, b, c};
+        std::sort(triple.begin(), triple.end());
+        return triple;
+    }
+
+    struct IngredientRecord {
+        FormID formId = 0;
+        std::string name;
+        std::vector<FormID> keywords;
+        // base effects in slot order, slot index matches knownEffectFlags bits
+        std::vector<FormID> effects;
+    };
+
+    struct PotionRecord {
+        FormID formId = 0;
+        std::string name;
+        std::vector<FormID> keywords;
+        std::vector<FormID> effects;
+        bool poison = false;
+    };
+
+    struct LoadOrder {
+        std::vector<IngredientRecord> ingredients;
+        std::vector<PotionRecord> potions;
+    };
+
+    struct Keywords {
+        FormID craftable = 0;
+        // level keyword per tier (level1 at [0]), the number of keywords is the tier count
+        std::vector<FormID> levels;
+        // keyword -> rarity entries, an ingredient gets the rarity of the first entry whose keyword it has
+        std::vector<std::pair<FormID, Rarity>> rarities;
+        // rarity of ingredients without any rarity keyword, must be below rarityCount
+        Rarity defaultRarity = 0;
+        std::size_t rarityCount = 0;
+
+        [[nodiscard]] int GetTierCount() const noexcept {
+            return static_cast<int>(std::min<std::size_t>(levels.size(), kMaxTiers));
+        }
+    };
+
+    // Ingredient rarity pairs crafting each level (level1 at [0]), a level may be crafted from several pairs
+    struct RecipeRules {
+        std::vector<std::vector<RarityPair>> levels;
+        // Rarity triples crafting each level with three ingredients, empty when three ingredient recipes are off.
+        // A triple only becomes a recipe if its third ingredient adds an effect no pair of the three shares or
+        // crafts a higher level than any of its pairs does.
+        std::vector<std::vector<RarityTriple>> tripleLevels;
+        // most three ingredient recipes per effect signature and level
+        std::size_t maxTriplesPerSignature = 0;
+    };
+
+    // Parses a "rarity|rarity" crafting rule, rarities are looked up by name. nullopt if the rule is malformed or
+    // names an unknown rarity.
+    [[nodiscard]] std::optional<RarityPair> ParseRarityPair(std::string_view rule,
+                                                            std::span<const std::string> rarityNames) noexcept;
+    // Same for a "rarity|rarity|rarity" three ingredient rule
+    [[nodiscard]] std::optional<RarityTriple> ParseRarityTriple(std::string_view rule,
+                                                                std::span<const std::string> rarityNames) noexcept;
+
+    // Sorted effects of a potion without duplicates, the potion line it belongs to. Single effect potions have a
+    // signature of one effect.
+    [[nodiscard]] std::vector<FormID> MakeEffectSignature(std::span<const FormID> effects);
+
+    // Craftable potions of every (effect signature, tier) in one flat array over dense signature ids. A second table
+    // of the same shape holds the potion a request for a tier falls back to, so resolving a quality upgrade is a
+    // single load.
+    class PotionTierTable {
+    public:
+        // Signature i is effects[offsets[i], offsets[i + 1]), signatures must be sorted lexicographically and their
+        // position is the dense signature id. potions is the flat signature * tier table, every potion starts out
+        // missing if it is empty.
+        void Reset(std::vector<FormID> effects, std::vector<Index> offsets, int tierCount,
+                   std::vector<Index> potions = {});
+        void Set(Index signature, int level, Index potion) noexcept { _potions[Slot(signature, level)] = potion; }
+        // Precomputes the fallbacks, needed after the last Set()
+        void Finalize();
+
+        // dense signature id, kNoIndex if no craftable potion has exactly these effects
+        [[nodiscard]] Index Find(std::span<const FormID> signature) const noexcept;
+        [[nodiscard]] std::size_t SignatureCount() const noexcept { return _offsets.size() - 1; }
+        [[nodiscard]] int GetTierCount() const noexcept { return _tierCount; }
+        [[nodiscard]] std::span<const FormID> GetEffects(Index signature) const noexcept {
+            return std::span<const FormID>(_effects).subspan(_offsets[signature],
+                                                             _offsets[signature + 1] - _offsets[signature]);
+        }
+        // every signature back to back, see Reset()
+        [[nodiscard]] std::span<const FormID> GetEffectFormIds() const noexcept { return _effects; }
+        [[nodiscard]] std::span<const Index> GetSignatureOffsets() const noexcept { return _offsets; }
+        [[nodiscard]] std::span<const Index> GetPotions() const noexcept { return _potions; }
+
+        // level in [1, GetTierCount()]
+        // potion of exactly this level, kNoIndex if missing
+        [[nodiscard]] Index Get(Index signature, int level) const noexcept {
+            return _potions[Slot(signature, level)];
+        }
+        // potion of the level or the closest lower one, level1 is returned as is even when missing
+        [[nodiscard]] Index Resolve(Index signature, int level) const noexcept {
+            return _fallbacks[Slot(signature, level)];
+        }
+
+    private:
+        [[nodiscard]] std::size_t Slot(Index signature, int level) const noexcept {
+            return std::size_t{signature} * static_cast<std::size_t>(_tierCount) +
+                   static_cast<std::size_t>(level - 1);
+        }
+
+        int _tierCount = 0;
+        std::vector<FormID> _effects;
+        std::vector<Index> _offsets = {0};
+        std::vector<Index> _potions;
+        std::vector<Index> _fallbacks;
+    };
+
+    // Planned recipes stored column-wise, row i of every column describes recipe i
+    struct RecipeTable {
+        // dense effect signature id, see Plan::potionTiers
+        std::vector<Index> signature;
+        std::vector<Index> ingr1;
+        std::vector<Index> ingr2;
+        // kNoIndex for two ingredient recipes
+        std::vector<Index> ingr3;
+        // effect slots of the signature effects an ingredient contributes, mask over its knownEffectFlags
+        std::vector<std::uint8_t> slots1;
+        std::vector<std::uint8_t> slots2;
+        std::vector<std::uint8_t> slots3;
+        std::vector<std::uint8_t> potionMinLevel;
+        std::vector<std::uint8_t> targetIngredientLevel;
+        std::vector<std::uint8_t> poison;
+
+        [[nodiscard]] std::size_t Size() const noexcept { return signature.size(); }
+        void Reserve(std::size_t count);
+        void Resize(std::size_t count);
+        void Add(Index signatureId, Index first, std::uint8_t firstSlots, Index second, std::uint8_t secondSlots,
+                 int minLevel, int targetLevel, bool isPoison, Index third = kNoIndex, std::uint8_t thirdSlots = 0);
+        void Set(std::size_t row, Index signatureId, Index first, std::uint8_t firstSlots, Index second,
+                 std::uint8_t secondSlots, int minLevel, int targetLevel, bool isPoison, Index third = kNoIndex,
+                 std::uint8_t thirdSlots = 0) noexcept;
+        void ShrinkToFit();
+    };
+
+    // Inverted index from magic effect to the ingredients carrying it, grouped by rarity. Buckets are stored
+    // contiguously so every (effect, rarity) lookup is a span over a single array.
+    class EffectIngredientIndex {
+    public:
+        EffectIngredientIndex() = default;
+        explicit EffectIngredientIndex(std::size_t rarityCount) noexcept : _rarityCount(rarityCount) {}
+
+        // dense effect id, kNoIndex if no ingredient has the effect
+        [[nodiscard]] Index Find(FormID effect) const noexcept;
+        [[nodiscard]] std::span<const Index> Get(Index effect, Rarity rarity) const noexcept;
+        // knownEffectFlags mask of the effect slot in every ingredient returned by Get(), same order
+        [[nodiscard]] std::span<const std::uint8_t> GetSlotMasks(Index effect, Rarity rarity) const noexcept;
+        [[nodiscard]] std::size_t EffectCount() const noexcept { return _effectIds.size(); }
+        [[nodiscard]] std::size_t GetRarityCount() const noexcept { return _rarityCount; }
+
+        // Ingredients must be added in ascending index order, Finalize() packs the buckets afterwards. Effects past
+        // kMaxEffectSlots are left out.
+        void Add(Index ingredient, Rarity rarity, std::span<const FormID> effects);
+        void Finalize();
+        // Moves the ingredients of the given effects to the buckets of their rarity in ingredientRarity, after
+        // Finalize(). Buckets of other effects are left as they are.
+        void Reclassify(std::span<const Rarity> ingredientRarity, std::span<const FormID> effects);
+
+    private:
+        std::size_t _rarityCount = 0;
+        std::unordered_map<FormID, Index> _effectIds;
+        // start of the (effect, rarity) bucket in _ingredients, EffectCount() * GetRarityCount() + 1 entries
+        std::vector<Index> _offsets;
+        std::vector<Index> _ingredients;
+        std::vector<std::uint8_t> _slots;
+        // per (effect, rarity) buckets while building
+        std::vector<std::vector<Index>> _buckets;
+        std::vector<std::vector<std::uint8_t>> _bucketSlots;
+    };
+
+    // Recipes a planning run adds per level (level1 at [0]), known before any row of the table is written
+    struct RecipeProjection {
+        std::vector<std::size_t> pairs;
+        std::vector<std::size_t> triples;
+    };
+
+    struct Plan {
+        // per ingredient of the load order
+        std::vector<Rarity> ingredientRarity;
+        std::vector<std::vector<Index>> ingredientsByRarity;
+        EffectIngredientIndex effectIngredients;
+        // per potion of the load order: level, 0 if craftable without level keyword, -1 if not part of the system
+        std::vector<int> potionLevel;
+        // recipes refer to effect signatures by their dense id in here
+        PotionTierTable potionTiers;
+        RecipeTable recipes;
+        // what the last PlanRecipes() call added to recipes
+        RecipeProjection projection;
+    };
+
+    // Compact view of the alchemy perks the player has, captured once and shared by every recipe evaluation
+    class PerkSnapshot {
+    public:
+        enum Flag : std::uint8_t {
+            kPotionQuality = 1 << 0,
+            kPoisonQuality = 1 << 1,
+            kAllQuality = 1 << 2,
+            kDoubleItems = 1 << 3,
+        };
+
+        // level 1 is always unlocked, other levels require their own perk
+        void UnlockLevel(int level) noexcept;
+        void Set(Flag flag) noexcept { _flags |= flag; }
+
+        [[nodiscard]] bool IsLevelUnlocked(int level) const noexcept {
+            return level <= 1 || (level <= kMaxTiers && (_unlockedLevels & (1u << (level - 1))) != 0);
+        }
+        [[nodiscard]] int GetMaxAllowedPotionLevel() const noexcept { return _maxLevel; }
+        [[nodiscard]] bool Has(Flag flag) const noexcept { return (_flags & flag) != 0; }
+        // number of levels quality perks add to a potion or poison
+        [[nodiscard]] int GetQualityBonus(bool poison) const noexcept;
+
+        bool operator==(const PerkSnapshot&) const noexcept = default;
+
+    private:
+        std::uint16_t _unlockedLevels = 1;
+        std::uint8_t _maxLevel = 1;
+        std::uint8_t _flags = 0;
+    };
+
+    // Result of applying the perk rules to a single recipe
+    struct RecipeOutcome {
+        // false if the player lacks the perk for the recipe level, nothing else applies then
+        bool unlocked = false;
+        bool doubleItems = false;
+        // higher level potion granted by quality perks, kNoIndex if none
+        Index upgradedPotion = kNoIndex;
+    };
+
+    // Packs an unordered ingredient pair into one key, (a, b) and (b, a) map to the same value
+    [[nodiscard]] constexpr std::uint64_t MakePairKey(Index a, Index b) noexcept {
+        return a < b ? (std::uint64_t{a} << 32) | b : (std::uint64_t{b} << 32) | a;
+    }
+
+    enum class PairLists : std::uint8_t {
+        // both sides are the same list, e.g. common|common
+        kSame,
+        // no ingredient is on both sides, e.g. common|rare
+        kDisjoint,
+        // anything else, pairs have to be deduplicated
+        kOverlapping,
+    };
+
+    // Number of pairs EnumeratePairs emits for same or disjoint lists
+    [[nodiscard]] constexpr std::size_t CountPairs(std::size_t first, std::size_t second,
+                                                   PairLists relation) noexcept {
+        return relation == PairLists::kSame ? (first > 1 ? first * (first - 1) / 2 : 0) : first * second;
+    }
+
+    // Calls emit(i, k) exactly once for every unordered pair of distinct ingredients first[i], second[k]. Same lists
+    // are walked as a triangle and disjoint lists as a plain rectangle, only overlapping lists need the seen set so it
+    // may be null otherwise.
+    template <class Emit>
+    void EnumeratePairs(std::span<const Index> first, std::span<const Index> second, PairLists relation,
+                        std::unordered_set<std::uint64_t>* seen, Emit&& emit) {
+        switch (relation) {
+            case PairLists::kSame:
+                for (std::size_t i = 0; i < first.size(); i++) {
+                    for (std::size_t k = i + 1; k < first.size(); k++) {
+                        emit(i, k);
+                    }
+                }
+                break;
+            case PairLists::kDisjoint:
+                for (std::size_t i = 0; i < first.size(); i++) {
+                    for (std::size_t k = 0; k < second.size(); k++) {
+                        emit(i, k);
+                    }
+                }
+                break;
+            case PairLists::kOverlapping:
+                for (std::size_t i = 0; i < first.size(); i++) {
+                    for (std::size_t k = 0; k < second.size(); k++) {
+                        if (first[i] != second[k] && seen->insert(MakePairKey(first[i], second[k])).second) {
+                            emit(i, k);
+                        }
+                    }
+                }
+                break;
+        }
+    }
+
+    [[nodiscard]] bool HasKeyword(std::span<const FormID> keywords, FormID keyword) noexcept;
+
+    // Rarity of the first rarity keyword the ingredient has, the default rarity without one
+    [[nodiscard]] Rarity GetIngredientRarity(const IngredientRecord& ingredient, const Keywords& keywords) noexcept;
+    // Plan::potionLevel of a potion: its level, 0 if craftable without level keyword, -1 if not part of the system
+    [[nodiscard]] int GetPotionLevel(const PotionRecord& potion, const Keywords& keywords) noexcept;
+
+    void ClassifyIngredients(const LoadOrder& loadOrder, const Keywords& keywords, Plan& plan);
+    void ClassifyPotions(const LoadOrder& loadOrder, const Keywords& keywords, Plan& plan);
+    // Counts the recipes PlanRecipes() would add without planning them, needs both classifications
+    [[nodiscard]] RecipeProjection ProjectRecipes(const LoadOrder& loadOrder, const RecipeRules& rules,
+                                                  const Plan& plan);
+    // Needs both classifications. Pairs and triples are planned on up to `threads` threads (0 = hardware threads),
+    // the resulting table has the same order regardless of the thread count. Only the levels in levelMask
+    // (bit level - 1) get recipes, the rules of the other levels still prune the triples. A non-empty signatureMask
+    // (one entry per potion line) limits planning to the potion lines set in it.
+    void PlanRecipes(const LoadOrder& loadOrder, const RecipeRules& rules, Plan& plan, unsigned threads = 1,
+                     std::uint32_t levelMask = ~0u, std::span<const std::uint8_t> signatureMask = {});
+
+    // Plans the levels in levelMask (bit level - 1) again with new rules, needs the ingredient classification. Recipes
+    // of those levels are dropped, recipes of other levels keep their relative order and the new ones are appended.
+    // Returns the previous row of every row of the new table, kNoIndex for the newly planned recipes.
+    [[nodiscard]] std::vector<Index> ReplanLevels(const LoadOrder& loadOrder, const RecipeRules& rules, Plan& plan,
+                                                  std::uint32_t levelMask, unsigned threads = 1);
+
+    // Runs the planning stages as a small dependency graph: ingredient and potion classification run concurrently,
+    // recipe planning starts once both are done.
+    [[nodiscard]] Plan BuildPlan(const LoadOrder& loadOrder, const Keywords& keywords, const RecipeRules& rules,
+                                 unsigned threads = 1);
+
+    struct ReconcileResult {
+        // records classified differently than in the plan
+        std::size_t ingredients = 0;
+        std::size_t potions = 0;
+        // potion lines planned again
+        std::size_t signatures = 0;
+        // every recipe was planned again, the records or the potion lines differ from the plan's
+        bool rebuilt = false;
+    };
+
+    // Updates a plan built from predicted keywords (or loaded for them) to the keywords the records have now. Only
+    // records classified differently are updated and only the potion lines they take part in are planned again, their
+    // recipes move to the end of the table. Works on plans without planning scratch.
+    [[nodiscard]] ReconcileResult ReconcilePlan(const LoadOrder& loadOrder, const Keywords& keywords,
+                                                const RecipeRules& rules, Plan& plan, unsigned threads = 1);
+
+    // Frees the data only needed while planning (rarity lists, effect index)
+    void ReleasePlanningScratch(Plan& plan);
+
+    // Potion the recipe was planned for, before any perk upgrade
+    [[nodiscard]] Index GetRecipePotion(const Plan& plan, Index recipe) noexcept;
+
+    [[nodiscard]] RecipeOutcome EvaluateRecipe(const Plan& plan, Index recipe, const PerkSnapshot& perks) noexcept;
+
+    // EvaluateRecipe() for every recipe at once: the level each (poison, potionMinLevel) crafts at under one perk
+    // state, built once per perk snapshot. A recipe's output is then one lookup here and one in the potion tier
+    // table, whose fallbacks are resolved at plan time. Locked recipes and recipes without an upgrade report their
+    // base output, so applying the outputs again after perks are lost restores the planned potion and count.
+    class RecipeOutputs {
+    public:
+        RecipeOutputs() = default;
+        RecipeOutputs(const PerkSnapshot& perks, int tierCount) noexcept;
+
+        [[nodiscard]] bool IsUnlocked(const RecipeTable& recipes, Index recipe) const noexcept {
+            return GetLevel(recipes, recipe) != 0;
+        }
+        [[nodiscard]] Index GetPotion(const Plan& plan, Index recipe) const noexcept;
+        [[nodiscard]] std::uint16_t GetCount(const RecipeTable& recipes, Index recipe) const noexcept {
+            return _doubleItems && IsUnlocked(recipes, recipe) ? 2 : 1;
+        }
+
+    private:
+        [[nodiscard]] std::uint8_t GetLevel(const RecipeTable& recipes, Index recipe) const noexcept {
+            return _levels[recipes.poison[recipe] != 0][recipes.potionMinLevel[recipe]];
+        }
+
+        // [poison][potionMinLevel], 0 while the level is locked
+        std::array<std::array<std::uint8_t, kMaxTiers + 1>, 2> _levels{};
+        bool _doubleItems = false;
+    };
+
+    // Player knows every effect each ingredient contributes to the recipe signature. knownEffects holds the
+    // knownEffectFlags of every ingredient of the load order.
+    [[nodiscard]] inline bool IsRecipeKnown(const RecipeTable& recipes, Index recipe,
+                                            std::span<const std::uint32_t> knownEffects) noexcept {
+        auto slots1 = recipes.slots1[recipe];
+        auto slots2 = recipes.slots2[recipe];
+        auto slots3 = recipes.slots3[recipe];
+        auto ingr3 = recipes.ingr3[recipe];
+        return (knownEffects[recipes.ingr1[recipe]] & slots1) == slots1 &&
+               (knownEffects[recipes.ingr2[recipe]] & slots2) == slots2 &&
+               (ingr3 == kNoIndex || (knownEffects[ingr3] & slots3) == slots3);
+    }
+
+    // Moves every known recipe from candidates to known, both keep their relative order
+    void MoveKnownRecipes(const RecipeTable& recipes, std::span<const std::uint32_t> knownEffects,
+                          std::vector<Index>& candidates, std::vector<Index>& known);
+
+    // Rows of a recipe table by ingredient, every recipe is listed under each of its ingredients
+    class RecipesByIngredient {
+    public:
+        void Build(const RecipeTable& recipes, std::size_t ingredientCount);
+
+        [[nodiscard]] std::span<const Index> Get(Index ingredient) const noexcept {
+            return std::span<const Index>(_recipes).subspan(_offsets[ingredient],
+                                                            _offsets[ingredient + 1] - _offsets[ingredient]);
+        }
+
+    private:
+        // recipes using ingredient i are _recipes[_offsets[i].._offsets[i + 1]]
+        std::vector<Index> _offsets;
+        std::vector<Index> _recipes;
+    };
+
+    // Recipes marked in allowed whose ingredients are all marked in held. Walks the recipes of the held ingredients
+    // only, so the cost follows the inventory instead of the table. Rows are appended in heldIngredients order until
+    // out holds limit of them, returns how many more would have matched.
+    std::size_t SelectCraftableRecipes(const RecipeTable& recipes, const RecipesByIngredient& byIngredient,
+                                       std::span<const Index> heldIngredients, std::span<const std::uint8_t> held,
+                                       std::span<const std::uint8_t> allowed, std::size_t limit,
+                                       std::vector<Index>& out);
+
+    // Recipes waiting for the player to learn their effects. Known effects are compared against the previous snapshot
+    // and only recipes of ingredients that learned an effect of the recipe are checked again, so an update costs a
+    // pass over the flags plus the recipes touched by newly learned effects.
+    class KnownRecipeTracker {
+    public:
+        // Indexes recipes by ingredient, needed once per plan
+        void Build(const RecipeTable& recipes, std::size_t ingredientCount);
+
+        // Starts over with candidates as the pending recipes, the ones already known go to known right away
+        void Reset(const RecipeTable& recipes, std::span<const Index> candidates,
+                   std::span<const std::uint32_t> knownEffects, std::vector<Index>& known);
+
+        // Appends pending recipes that became known since the last Reset/Update to known, returns how many
+        std::size_t Update(const RecipeTable& recipes, std::span<const std::uint32_t> knownEffects,
+                           std::vector<Index>& known);
+
+        [[nodiscard]] std::size_t GetPendingCount() const noexcept { return _pendingCount; }
+        [[nodiscard]] const RecipesByIngredient& GetRecipesByIngredient() const noexcept { return _byIngredient; }
+
+    private:
+        RecipesByIngredient _byIngredient;
+        // per recipe, 1 while waiting for the effect to be known
+        std::vector<std::uint8_t> _pending;
+        std::size_t _pendingCount = 0;
+        std::vector<std::uint32_t> _snapshot;
+    };
+}
@@ -0,0 +1,312 @@
+// Plans the recipes of a fixed load order outside the game. Reads the load order the plugin exports
+// (performance.exportLoadOrder), applies KID keyword rules to it and plans with the crafting rules of
+// AlchemyReworked.yaml. The plan is written in the plan cache format and loaded by the plugin when
+// performance.prebuiltPlan is on, together with a summary of the recipes per potion line and level.
+//
+// Usage: AlchemyPlanCompiler LOADORDER --config AlchemyReworked.yaml [--kid FILE.ini]... [--out FILE]
+//                            [--summary FILE] [--threads N]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Planner/CraftingRules.h"
+#include "Planner/KidIni.h"
+#include "Planner/LoadOrderFile.h"
+#include "Planner/PlanCache.h"
+#include "Planner/Planner.h"
+
+using namespace AlchemyPlanner;
+
+namespace {
+    std::string_view Trim(std::string_view value) {
+        auto begin = value.find_first_not_of(" \t\r");
+        if (begin == std::string_view::npos) {
+            return {};
+        }
+        return value.substr(begin, value.find_last_not_of(" \t\r") - begin + 1);
+    }
+
+    // The two level "section: / key: value" layout of AlchemyReworked.yaml, keyed "section.key"
+    std::optional<std::map<std::string, std::string, std::less<>>> ReadConfig(const std::filesystem::path& path) {
+        std::ifstream in(path);
+        if (!in) {
+            return std::nullopt;
+        }
+        std::map<std::string, std::string, std::less<>> values;
+        std::string section;
+        std::string line;
+        while (std::getline(in, line)) {
+            auto content = Trim(line);
+            auto colon = content.find(':');
+            if (content.empty() || content.starts_with('#') || colon == std::string_view::npos) {
+                continue;
+            }
+            auto key = Trim(content.substr(0, colon));
+            auto value = Trim(content.substr(colon + 1));
+            if (value.size() >= 2 && (value.front() == '"' || value.front() == '\'') && value.back() == value.front()) {
+                value = value.substr(1, value.size() - 2);
+            }
+            if (line.find_first_not_of(" \t") == 0) {
+                section = key;
+            } else {
+                values[section + "." + std::string(key)] = value;
+            }
+        }
+        return values;
+    }
+
+    std::string FormatLine(const char* format, auto... args) {
+        char buffer[512];
+        auto length = std::snprintf(buffer, sizeof(buffer), format, args...);
+        return std::string(buffer, static_cast<std::size_t>(std::clamp<int>(length, 0, sizeof(buffer) - 1)));
+    }
+
+    // Rarities and crafting sections of the config, keys the config doesn't have keep the plugin defaults
+    CraftingRulesText GetRulesText(const std::map<std::string, std::string, std::less<>>& config) {
+        auto get = [&config](const std::string& key) -> std::optional<std::string> {
+            auto it = config.find(key);
+            return it == config.end() ? std::nullopt : std::optional<std::string>(it->second);
+        };
+        CraftingRulesText text;
+        // rarity tiers are numbered without gaps, the first missing one ends the list
+        if (get("rarities.rarity1")) {
+            text.rarityNames.clear();
+            text.raritySuffixes.clear();
+            text.rarityKeywords.clear();
+            for (std::size_t i = 1; i <= kMaxRarities; i++) {
+                auto key = "rarities.rarity" + std::to_string(i);
+                auto name = get(key);
+                if (!name) {
+                    break;
+                }
+                text.rarityNames.push_back(*name);
+                text.raritySuffixes.push_back(get(key + "Suffix").value_or(""));
+                text.rarityKeywords.push_back(get(key + "Keywords").value_or(""));
+            }
+        }
+        text.defaultRarity = get("rarities.default").value_or(text.defaultRarity);
+        if (auto levels = get("crafting.levels")) {
+            text.levelCount = std::atoi(levels->c_str());
+        }
+        text.level3Alt = get("crafting.level3Alt").value_or("");
+        for (int level = 1; level <= kMaxTiers; level++) {
+            auto key = "crafting.level" + std::to_string(level);
+            text.levelRecipes.push_back(get(key).value_or(""));
+            text.levelKeywords.push_back(get(key + "Keyword").value_or(""));
+            text.levelTriples.push_back(get(key + "Triples").value_or(""));
+        }
+        auto triples = get("crafting.threeIngredientRecipes").value_or("false");
+        text.threeIngredientRecipes = triples == "true" || triples == "1";
+        if (auto maxTriples = get("crafting.maxTriplesPerEffect")) {
+            text.maxTriplesPerEffect = std::atoi(maxTriples->c_str());
+        }
+        return text;
+    }
+
+    // Runtime FormID of a keyword, 0 if the load order doesn't list it
+    FormID ResolveKeyword(const LoadOrderFile& file, const FormRef& ref) {
+        auto id = file.Resolve(ref.plugin, ref.localId);
+        auto listed = std::ranges::any_of(file.keywords, [&](const auto& keyword) { return keyword.first == id; });
+        return id && listed ? id : 0;
+    }
+
+    // Keywords and recipe rules the plugin would build from the same config, see Config::Compile() and
+    // AlchmeyDistributor::Initialize(). Keywords only resolve if the load order lists them. False if the craftable
+    // keyword or a configured level keyword doesn't resolve.
+    bool CompileRules(const std::map<std::string, std::string, std::less<>>& config, const LoadOrderFile& file,
+                      Keywords& keywords, RecipeRules& rules, std::vector<std::string>& errors) {
+        keywords = {};
+        auto text = GetRulesText(config);
+        auto compiled = CompileCraftingRules(text, errors);
+        rules = std::move(compiled.recipeRules);
+
+        keywords.craftable = ResolveKeyword(file, {"AlchemyReworked.esp", 0x800});
+        if (!keywords.craftable) {
+            errors.push_back("AlchemyReworked.esp|800 craftable keyword is not in the load order");
+            return false;
+        }
+        for (std::size_t rarity = 0; rarity < compiled.rarities.size(); rarity++) {
+            for (const auto& ref : compiled.rarities[rarity].keywords) {
+                if (auto id = ResolveKeyword(file, ref)) {
+                    keywords.rarities.emplace_back(id, static_cast<Rarity>(rarity));
+                } else {
+                    errors.push_back(FormatLine("rarities.rarity%zuKeywords: keyword %s|%X is not in the load order",
+                                                rarity + 1, ref.plugin.c_str(), ref.localId));
+                }
+            }
+        }
+        keywords.defaultRarity = compiled.defaultRarity;
+        keywords.rarityCount = compiled.rarities.size();
+
+        for (std::size_t i = 0; i < compiled.levelKeywords.size(); i++) {
+            const auto& ref = compiled.levelKeywords[i];
+            auto id = ref.IsSet() ? ResolveKeyword(file, ref) : 0;
+            // the default keywords may be missing, the level has no potions then
+            if (!id && (!ref.IsSet() || !Trim(text.levelKeywords[i]).empty())) {
+                if (ref.IsSet()) {
+                    errors.push_back(FormatLine("crafting.level%zuKeyword: keyword %s|%X is not in the load order",
+                                                i + 1, ref.plugin.c_str(), ref.localId));
+                }
+                return false;
+            }
+            keywords.levels.push_back(id);
+        }
+        return true;
+    }
+
+    // Recipe counts per potion line and level, lines named after their lowest level potion
+    std::string Summarize(const LoadOrderFile& file, const Keywords& keywords, const Plan& plan,
+                          std::uint64_t fingerprint) {
+        const auto& loadOrder = file.loadOrder;
+        const auto& tiers = plan.potionTiers;
+        const auto tierCount = tiers.GetTierCount();
+        std::vector<std::size_t> rarityCounts(keywords.rarityCount);
+        for (auto rarity : plan.ingredientRarity) {
+            rarityCounts[rarity]++;
+        }
+        std::vector<std::size_t> counts(tiers.SignatureCount() * static_cast<std::size_t>(tierCount));
+        std::size_t triples = 0;
+        for (Index i = 0; i < plan.recipes.Size(); i++) {
+            counts[std::size_t{plan.recipes.signature[i]} * static_cast<std::size_t>(tierCount) +
+                   plan.recipes.potionMinLevel[i] - 1]++;
+            triples += plan.recipes.ingr3[i] != kNoIndex;
+        }
+
+        auto out = FormatLine("AlchemyReworked plan %s, fingerprint %016llx\n", ALCHEMY_REWORKED_VERSION,
+                              static_cast<unsigned long long>(fingerprint));
+        out += FormatLine("ingredients: %zu (by rarity:", loadOrder.ingredients.size());
+        for (auto count : rarityCounts) {
+            out += FormatLine(" %zu", count);
+        }
+        out += FormatLine("), alchemy items: %zu, potion lines: %zu, recipes: %zu (%zu with three ingredients)\n\n",
+                          loadOrder.potions.size(), tiers.SignatureCount(), plan.recipes.Size(), triples);
+
+        out += FormatLine("%-48s", "potion line");
+        for (int level = 1; level <= tierCount; level++) {
+            out += FormatLine(" %7s", ("level" + std::to_string(level)).c_str());
+        }
+        out += "  effects\n";
+        for (Index signature = 0; signature < tiers.SignatureCount(); signature++) {
+            std::string name = "?";
+            for (int level = 1; level <= tierCount; level++) {
+                if (auto potion = tiers.Get(signature, level); potion != kNoIndex) {
+                    name = loadOrder.potions[potion].name;
+                    break;
+                }
+            }
+            out += FormatLine("%-48.48s", name.c_str());
+            for (int level = 1; level <= tierCount; level++) {
+                out += FormatLine(" %7zu",
+                                  counts[std::size_t{signature} * static_cast<std::size_t>(tierCount) + level - 1]);
+            }
+            out += " ";
+            for (auto effect : tiers.GetEffects(signature)) {
+                out += FormatLine(" %08X", effect);
+            }
+            out += "\n";
+        }
+        return out;
+    }
+}
+
+int main(int argc, char** argv) {
+    std::filesystem::path loadOrderPath;
+    std::filesystem::path configPath;
+    std::vector<std::filesystem::path> kidPaths;
+    std::filesystem::path outPath = "AlchemyReworked.plan";
+    std::filesystem::path summaryPath;
+    unsigned threads = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "--config" && i + 1 < argc) {
+            configPath = argv[++i];
+        } else if (arg == "--kid" && i + 1 < argc) {
+            kidPaths.emplace_back(argv[++i]);
+        } else if (arg == "--out" && i + 1 < argc) {
+            outPath = argv[++i];
+        } else if (arg == "--summary" && i + 1 < argc) {
+            summaryPath = argv[++i];
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 0));
+        } else if (!arg.starts_with("--") && loadOrderPath.empty()) {
+            loadOrderPath = argv[i];
+        } else {
+            loadOrderPath.clear();
+            break;
+        }
+    }
+    if (loadOrderPath.empty() || configPath.empty()) {
+        std::fprintf(stderr,
+                     "Usage: %s LOADORDER --config AlchemyReworked.yaml [--kid FILE.ini]... [--out FILE] "
+                     "[--summary FILE] [--threads N]\n",
+                     argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::string> errors;
+    auto report = [&errors](const char* what) {
+        for (const auto& error : errors) {
+            std::fprintf(stderr, "%s: %s\n", what, error.c_str());
+        }
+        errors.clear();
+    };
+
+    LoadOrderFile file;
+    if (!ReadLoadOrderFile(loadOrderPath, file, errors)) {
+        std::fprintf(stderr, "Unable to read load order %s\n", loadOrderPath.string().c_str());
+        return EXIT_FAILURE;
+    }
+    report(loadOrderPath.string().c_str());
+
+    std::vector<KidIni> kidInis(kidPaths.size());
+    std::size_t kidRules = 0;
+    for (std::size_t i = 0; i < kidPaths.size(); i++) {
+        if (!ReadKidIni(kidPaths[i], kidInis[i], errors)) {
+            std::fprintf(stderr, "Unable to read KID ini %s\n", kidPaths[i].string().c_str());
+            return EXIT_FAILURE;
+        }
+        kidRules += kidInis[i].rules.size();
+    }
+    auto added = ApplyKidRules(kidInis, file, errors);
+    report("KID");
+
+    auto config = ReadConfig(configPath);
+    if (!config) {
+        std::fprintf(stderr, "Unable to read config %s\n", configPath.string().c_str());
+        return EXIT_FAILURE;
+    }
+    Keywords keywords;
+    RecipeRules rules;
+    auto compiled = CompileRules(*config, file, keywords, rules, errors);
+    report(configPath.string().c_str());
+    if (!compiled) {
+        return EXIT_FAILURE;
+    }
+
+    auto plan = BuildPlan(file.loadOrder, keywords, rules, threads);
+    auto fingerprint = GetPlanFingerprint(file.loadOrder, keywords, rules, kPrebuiltPlanVersion);
+    if (!SavePlanCache(outPath, fingerprint, plan)) {
+        std::fprintf(stderr, "Unable to write %s\n", outPath.string().c_str());
+        return EXIT_FAILURE;
+    }
+    std::printf("%zu KID rules added %zu keywords, planned %zu recipes into %s\n", kidRules, added,
+                plan.recipes.Size(), outPath.string().c_str());
+
+    auto summary = Summarize(file, keywords, plan, fingerprint);
+    if (summaryPath.empty()) {
+        std::printf("\n%s", summary.c_str());
+    } else if (std::ofstream out(summaryPath, std::ios::trunc); !(out << summary).flush()) {
+        std::fprintf(stderr, "Unable to write %s\n", summaryPath.string().c_str());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,687 @@
+// Benchmarks the recipe planning stages the plugin runs on startup over synthetic load orders, and the planner's data
+// structures against the naive ones they replaced. Every stage reports its fastest run, its throughput and the heap
+// allocations and heap growth of one run. Results are written as JSON; given the JSON of an earlier run as baseline,
+// stages that got slower or allocate more than the tolerances allow fail the run.
+//
+// Usage: AlchemyPlannerBenchmark [vanilla|mods500|stress|all]... [--seed N] [--threads N] [--repeat N] [--json FILE]
+//                                [--baseline FILE] [--time-tolerance X] [--memory-tolerance X]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#ifdef _WIN32
+    #include <Windows.h>
+    #include <Psapi.h>
+#else
+    #include <sys/resource.h>
+#endif
+
+#include "Planner/Parallel.h"
+#include "Planner/Planner.h"
+#include "SyntheticLoadOrder.h"
+
+using namespace AlchemyPlanner;
+
+namespace {
+    // Heap usage of the whole process, kept up to date by the operator new/delete replacements below
+    struct HeapCounters {
+        std::atomic<std::uint64_t> allocations{0};
+        std::atomic<std::uint64_t> bytes{0};
+        std::atomic<std::uint64_t> live{0};
+        std::atomic<std::uint64_t> peak{0};
+    };
+
+    constinit HeapCounters heap;
+
+    // every block starts with its size so deallocation can update the live bytes without sized delete
+    constexpr std::size_t kBlockHeader = alignof(std::max_align_t);
+
+    void* Allocate(std::size_t size) noexcept {
+        auto* block = static_cast<unsigned char*>(std::malloc(size + kBlockHeader));
+        if (!block) {
+            return nullptr;
+        }
+        *reinterpret_cast<std::size_t*>(block) = size;
+        heap.allocations.fetch_add(1, std::memory_order_relaxed);
+        heap.bytes.fetch_add(size, std::memory_order_relaxed);
+        auto live = heap.live.fetch_add(size, std::memory_order_relaxed) + size;
+        auto peak = heap.peak.load(std::memory_order_relaxed);
+        while (live > peak && !heap.peak.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+        }
+        return block + kBlockHeader;
+    }
+
+    void Release(void* ptr) noexcept {
+        if (!ptr) {
+            return;
+        }
+        auto* block = static_cast<unsigned char*>(ptr) - kBlockHeader;
+        heap.live.fetch_sub(*reinterpret_cast<std::size_t*>(block), std::memory_order_relaxed);
+        std::free(block);
+    }
+}
+
+// Over-aligned allocations keep the library implementation and are not counted, the planner has none
+void* operator new(std::size_t size) {
+    if (auto* ptr = Allocate(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) { return operator new(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return Allocate(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return Allocate(size); }
+void operator delete(void* ptr) noexcept { Release(ptr); }
+void operator delete[](void* ptr) noexcept { Release(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { Release(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { Release(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { Release(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { Release(ptr); }
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    double ElapsedMs(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    std::uint64_t GetPeakRssBytes() {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters{};
+        if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+            return 0;
+        }
+        return counters.PeakWorkingSetSize;
+#else
+        rusage usage{};
+        if (getrusage(RUSAGE_SELF, &usage) != 0) {
+            return 0;
+        }
+    #ifdef __APPLE__
+        return static_cast<std::uint64_t>(usage.ru_maxrss);
+    #else
+        return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024;
+    #endif
+#endif
+    }
+
+    struct Sample {
+        // records, lookups or pairs the stage went through
+        std::size_t items = 0;
+        // fastest run
+        double ms = 0;
+        // of a single run
+        std::uint64_t allocations = 0;
+        std::uint64_t allocatedBytes = 0;
+        // most heap in use during a run on top of what was in use before it
+        std::uint64_t peakHeapBytes = 0;
+
+        [[nodiscard]] double GetItemsPerSecond() const noexcept {
+            return ms > 0 ? static_cast<double>(items) * 1000.0 / ms : 0;
+        }
+    };
+
+    // Runs run(state) `repeat` times, each on a fresh state from setup() that isn't measured. run returns the
+    // number of items it went through, state keeps the output of the last run. Heap figures are those of the last
+    // run so lazily created statics don't count.
+    template <class State, class Setup, class Run>
+    Sample Measure(int repeat, State& state, Setup&& setup, Run&& run) {
+        Sample sample;
+        sample.ms = std::numeric_limits<double>::max();
+        for (int i = 0; i < repeat; i++) {
+            state = setup();
+            auto allocations = heap.allocations.load();
+            auto bytes = heap.bytes.load();
+            auto live = heap.live.load();
+            heap.peak.store(live);
+
+            auto start = Clock::now();
+            sample.items = run(state);
+            sample.ms = std::min(sample.ms, ElapsedMs(start));
+
+            sample.allocations = heap.allocations.load() - allocations;
+            sample.allocatedBytes = heap.bytes.load() - bytes;
+            sample.peakHeapBytes = heap.peak.load() - live;
+        }
+        return sample;
+    }
+
+    template <class Run>
+    Sample Measure(int repeat, Run&& run) {
+        int unused = 0;
+        return Measure(repeat, unused, [] { return 0; }, [&](int&) { return run(); });
+    }
+
+    struct Comparison {
+        Sample naive;
+        Sample optimized;
+    };
+
+    struct ScaleResult {
+        std::string name;
+        // in the order they ran
+        std::vector<std::pair<std::string, Sample>> stages;
+        std::vector<std::pair<std::string, Comparison>> comparisons;
+    };
+
+    // Every distinct rarity pair of the rules, the pairs a planning run enumerates per effect
+    std::vector<RarityPair> GetRulePairs(const RecipeRules& rules) {
+        std::vector<RarityPair> pairs;
+        for (const auto& level : rules.levels) {
+            pairs.insert(pairs.end(), level.begin(), level.end());
+        }
+        std::sort(pairs.begin(), pairs.end());
+        pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+        return pairs;
+    }
+
+    // Indexes the ingredients by effect and looks up the ingredients of every potion line effect in every rarity, the
+    // candidate lists recipes are planned from. Returns the number of lookups, ingredients holds the sum of the list
+    // sizes.
+    std::size_t LookupEffects(const LoadOrder& loadOrder, const Plan& plan, std::size_t& ingredients) {
+        EffectIngredientIndex index(plan.ingredientsByRarity.size());
+        for (Index i = 0; i < loadOrder.ingredients.size(); i++) {
+            index.Add(i, plan.ingredientRarity[i], loadOrder.ingredients[i].effects);
+        }
+        index.Finalize();
+        std::size_t lookups = 0;
+        ingredients = 0;
+        for (auto effect : plan.potionTiers.GetEffectFormIds()) {
+            auto id = index.Find(effect);
+            for (Rarity rarity = 0; rarity < index.GetRarityCount(); rarity++) {
+                ingredients += id == kNoIndex ? 0 : index.Get(id, rarity).size();
+                lookups++;
+            }
+        }
+        return lookups;
+    }
+
+    // Same with an ordered map from effect to one growing list per rarity
+    std::size_t LookupEffectsNaive(const LoadOrder& loadOrder, const Plan& plan, std::size_t& ingredients) {
+        std::map<FormID, std::vector<std::vector<Index>>> byEffect;
+        const auto rarityCount = plan.ingredientsByRarity.size();
+        for (Index i = 0; i < loadOrder.ingredients.size(); i++) {
+            for (auto effect : loadOrder.ingredients[i].effects) {
+                auto& lists = byEffect[effect];
+                lists.resize(rarityCount);
+                lists[plan.ingredientRarity[i]].push_back(i);
+            }
+        }
+        std::size_t lookups = 0;
+        ingredients = 0;
+        for (auto effect : plan.potionTiers.GetEffectFormIds()) {
+            auto it = byEffect.find(effect);
+            for (std::size_t rarity = 0; rarity < rarityCount; rarity++) {
+                ingredients += it == byEffect.end() ? 0 : it->second[rarity].size();
+                lookups++;
+            }
+        }
+        return lookups;
+    }
+
+    // Walks every ingredient pair of every effect and rule pair. The naive walk deduplicates every pair through a
+    // hash set, the planner only does so for overlapping lists, which rarity lists never are. Returns the number of
+    // pairs, checksum sums up their ingredients so the walk can't be optimized away.
+    std::size_t EnumerateEffectPairs(const Plan& plan, std::span<const RarityPair> rulePairs, bool naive,
+                                     std::uint64_t& checksum) {
+        const auto& index = plan.effectIngredients;
+        std::size_t pairs = 0;
+        checksum = 0;
+        for (Index effect = 0; effect < index.EffectCount(); effect++) {
+            for (auto [first, second] : rulePairs) {
+                auto firstList = index.Get(effect, first);
+                auto secondList = first == second ? firstList : index.Get(effect, second);
+                auto emit = [&](std::size_t i, std::size_t k) {
+                    checksum += MakePairKey(firstList[i], secondList[k]);
+                    pairs++;
+                };
+                if (naive) {
+                    std::unordered_set<std::uint64_t> seen;
+                    EnumeratePairs(firstList, secondList, PairLists::kOverlapping, &seen, emit);
+                } else {
+                    EnumeratePairs(firstList, secondList, first == second ? PairLists::kSame : PairLists::kDisjoint,
+                                   nullptr, emit);
+                }
+            }
+        }
+        return pairs;
+    }
+
+    // A recipe the way the first version stored them, one record per recipe holding its effects by value
+    struct NaiveRecipe {
+        std::vector<FormID> effects;
+        Index ingr1 = kNoIndex;
+        Index ingr2 = kNoIndex;
+        Index ingr3 = kNoIndex;
+        int potionMinLevel = 0;
+        int targetIngredientLevel = 0;
+        bool poison = false;
+    };
+
+    // Learns effects on ~1% of the ingredients per round like a player would and collects the recipes that became
+    // known, either with a full scan every round or through the tracker. Returns the number of known recipes.
+    std::size_t LearnRecipes(const Plan& plan, std::size_t ingredientCount, std::uint64_t seed, bool naive) {
+        constexpr int kRounds = 20;
+        std::vector<Index> all(plan.recipes.Size());
+        for (Index i = 0; i < all.size(); i++) {
+            all[i] = i;
+        }
+        std::vector<std::uint32_t> knownEffects(ingredientCount);
+        std::vector<Index> known;
+        KnownRecipeTracker tracker;
+        if (!naive) {
+            tracker.Build(plan.recipes, ingredientCount);
+            tracker.Reset(plan.recipes, all, knownEffects, known);
+        }
+        for (int round = 0; round < kRounds; round++) {
+            for (std::size_t k = 0; k < std::max<std::size_t>(1, ingredientCount / 100); k++) {
+                seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+                knownEffects[(seed >> 33) % ingredientCount] |= 1u << ((seed >> 20) % 4);
+            }
+            if (naive) {
+                std::vector<Index> candidates = all;
+                known.clear();
+                MoveKnownRecipes(plan.recipes, knownEffects, candidates, known);
+            } else {
+                tracker.Update(plan.recipes, knownEffects, known);
+            }
+        }
+        return known.size();
+    }
+
+    ScaleResult Run(const SyntheticLoadOrder::Scale& scale, std::uint64_t seed, unsigned threads, int repeat,
+                    bool& valid) {
+        ScaleResult result{std::string(scale.name), {}, {}};
+        auto loadOrder = SyntheticLoadOrder::Generate(scale, seed);
+        auto keywords = SyntheticLoadOrder::GetKeywords();
+        auto rules = SyntheticLoadOrder::GetDefaultRules();
+        auto check = [&](bool same, const char* what) {
+            if (!same) {
+                std::printf("  %s: naive and optimized results differ\n", what);
+                valid = false;
+            }
+        };
+
+        // startup stages in the order BuildPlan() runs them, each on the output of the previous one
+        Plan plan;
+        result.stages.emplace_back("classifyIngredients", Measure(repeat, plan, [] { return Plan{}; }, [&](Plan& p) {
+                                       ClassifyIngredients(loadOrder, keywords, p);
+                                       return loadOrder.ingredients.size();
+                                   }));
+        auto classified = plan;
+        result.stages.emplace_back("classifyPotions", Measure(repeat, plan, [&] { return classified; }, [&](Plan& p) {
+                                       ClassifyPotions(loadOrder, keywords, p);
+                                       return loadOrder.potions.size();
+                                   }));
+
+        std::size_t ingredients = 0;
+        std::size_t naiveIngredients = 0;
+        Comparison effectLookup;
+        effectLookup.optimized = Measure(repeat, [&] { return LookupEffects(loadOrder, plan, ingredients); });
+        effectLookup.naive = Measure(repeat, [&] { return LookupEffectsNaive(loadOrder, plan, naiveIngredients); });
+        check(ingredients == naiveIngredients, "effect lookup");
+        result.stages.emplace_back("filterEffects", effectLookup.optimized);
+
+        auto rulePairs = GetRulePairs(rules);
+        Comparison pairDedup;
+        std::uint64_t checksum = 0;
+        std::uint64_t naiveChecksum = 0;
+        pairDedup.optimized = Measure(repeat, [&] { return EnumerateEffectPairs(plan, rulePairs, false, checksum); });
+        pairDedup.naive = Measure(repeat, [&] { return EnumerateEffectPairs(plan, rulePairs, true, naiveChecksum); });
+        check(pairDedup.optimized.items == pairDedup.naive.items && checksum == naiveChecksum, "pair enumeration");
+        result.stages.emplace_back("enumeratePairs", pairDedup.optimized);
+
+        auto potionsClassified = plan;
+        result.stages.emplace_back("planRecipes",
+                                   Measure(repeat, plan, [&] { return potionsClassified; }, [&](Plan& p) {
+                                       PlanRecipes(loadOrder, rules, p, threads);
+                                       return p.recipes.Size();
+                                   }));
+
+        Plan built;
+        result.stages.emplace_back("buildPlan", Measure(repeat, built, [] { return Plan{}; }, [&](Plan& p) {
+                                       p = BuildPlan(loadOrder, keywords, rules, threads);
+                                       return p.recipes.Size();
+                                   }));
+        check(built.recipes.ingr1 == plan.recipes.ingr1 && built.recipes.ingr2 == plan.recipes.ingr2,
+              "build plan");
+
+        // materializing the planned rows, as records holding their effects or as the column table sized up front
+        const auto& recipes = plan.recipes;
+        Comparison recipeStorage;
+        RecipeTable table;
+        recipeStorage.optimized = Measure(repeat, table, [] { return RecipeTable{}; }, [&](RecipeTable& t) {
+            t.Reserve(recipes.Size());
+            for (Index i = 0; i < recipes.Size(); i++) {
+                t.Add(recipes.signature[i], recipes.ingr1[i], recipes.slots1[i], recipes.ingr2[i], recipes.slots2[i],
+                      recipes.potionMinLevel[i], recipes.targetIngredientLevel[i], recipes.poison[i] != 0,
+                      recipes.ingr3[i], recipes.slots3[i]);
+            }
+            return t.Size();
+        });
+        std::vector<NaiveRecipe> records;
+        recipeStorage.naive = Measure(repeat, records, [] { return std::vector<NaiveRecipe>{}; },
+                                      [&](std::vector<NaiveRecipe>& r) {
+                                          for (Index i = 0; i < recipes.Size(); i++) {
+                                              auto effects = plan.potionTiers.GetEffects(recipes.signature[i]);
+                                              r.push_back({{effects.begin(), effects.end()}, recipes.ingr1[i],
+                                                           recipes.ingr2[i], recipes.ingr3[i],
+                                                           recipes.potionMinLevel[i],
+                                                           recipes.targetIngredientLevel[i], recipes.poison[i] != 0});
+                                          }
+                                          return r.size();
+                                      });
+        check(table.ingr1 == recipes.ingr1 && records.size() == recipes.Size(), "recipe storage");
+        result.stages.emplace_back("materializeRecipes", recipeStorage.optimized);
+
+        std::size_t known = 0;
+        std::size_t naiveKnown = 0;
+        Comparison knownRecipes;
+        knownRecipes.optimized = Measure(repeat, [&] {
+            known = LearnRecipes(plan, loadOrder.ingredients.size(), seed, false);
+            return recipes.Size();
+        });
+        knownRecipes.naive = Measure(repeat, [&] {
+            naiveKnown = LearnRecipes(plan, loadOrder.ingredients.size(), seed, true);
+            return recipes.Size();
+        });
+        check(known == naiveKnown, "known recipes");
+
+        result.comparisons = {{"effectLookup", effectLookup},
+                              {"pairDedup", pairDedup},
+                              {"recipeStorage", recipeStorage},
+                              {"knownRecipes", knownRecipes}};
+        return result;
+    }
+
+    double KiB(std::uint64_t bytes) { return static_cast<double>(bytes) / 1024.0; }
+
+    void Print(const ScaleResult& result) {
+        std::printf("[%s]\n", result.name.c_str());
+        for (const auto& [name, sample] : result.stages) {
+            std::printf("  %-20s %10.3f ms %14.0f items/s %10llu allocations %12.1f KiB, peak heap %12.1f KiB\n",
+                        name.c_str(), sample.ms, sample.GetItemsPerSecond(),
+                        static_cast<unsigned long long>(sample.allocations), KiB(sample.allocatedBytes),
+                        KiB(sample.peakHeapBytes));
+        }
+        for (const auto& [name, comparison] : result.comparisons) {
+            const auto& [naive, optimized] = comparison;
+            std::printf("  %-20s naive %.3f ms / %llu allocations / peak %.1f KiB, optimized %.3f ms / %llu "
+                        "allocations / peak %.1f KiB, %.1fx faster\n",
+                        name.c_str(), naive.ms, static_cast<unsigned long long>(naive.allocations),
+                        KiB(naive.peakHeapBytes), optimized.ms, static_cast<unsigned long long>(optimized.allocations),
+                        KiB(optimized.peakHeapBytes), optimized.ms > 0 ? naive.ms / optimized.ms : 0);
+        }
+    }
+
+    void AppendSample(std::ostringstream& out, const Sample& sample) {
+        char buffer[256];
+        std::snprintf(buffer, sizeof(buffer),
+                      "{\"items\": %zu, \"ms\": %.4f, \"itemsPerSecond\": %.0f, \"allocations\": %llu, "
+                      "\"allocatedBytes\": %llu, \"peakHeapBytes\": %llu}",
+                      sample.items, sample.ms, sample.GetItemsPerSecond(),
+                      static_cast<unsigned long long>(sample.allocations),
+                      static_cast<unsigned long long>(sample.allocatedBytes),
+                      static_cast<unsigned long long>(sample.peakHeapBytes));
+        out << buffer;
+    }
+
+    std::string ToJson(const std::vector<ScaleResult>& results, std::uint64_t seed, unsigned threads, int repeat) {
+        std::ostringstream out;
+        out << "{\n  \"seed\": " << seed << ",\n  \"threads\": " << ResolveThreadCount(threads)
+            << ",\n  \"repeat\": " << repeat << ",\n  \"peakRssBytes\": " << GetPeakRssBytes() << ",\n  \"scales\": {";
+        const char* scaleSeparator = "";
+        for (const auto& result : results) {
+            out << scaleSeparator << "\n    \"" << result.name << "\": {\n      \"stages\": {";
+            const char* separator = "";
+            for (const auto& [name, sample] : result.stages) {
+                out << separator << "\n        \"" << name << "\": ";
+                AppendSample(out, sample);
+                separator = ",";
+            }
+            out << "\n      },\n      \"comparisons\": {";
+            separator = "";
+            for (const auto& [name, comparison] : result.comparisons) {
+                out << separator << "\n        \"" << name << "\": {\n          \"naive\": ";
+                AppendSample(out, comparison.naive);
+                out << ",\n          \"optimized\": ";
+                AppendSample(out, comparison.optimized);
+                char speedup[32];
+                std::snprintf(speedup, sizeof(speedup), "%.2f",
+                              comparison.optimized.ms > 0 ? comparison.naive.ms / comparison.optimized.ms : 0);
+                out << ",\n          \"speedup\": " << speedup << "\n        }";
+                separator = ",";
+            }
+            out << "\n      }\n    }";
+            scaleSeparator = ",";
+        }
+        out << "\n  }\n}\n";
+        return out.str();
+    }
+
+    // Numbers of a JSON document by their dotted path ("scales.vanilla.stages.planRecipes.ms"). Only what ToJson()
+    // writes is supported: objects, numbers and strings without escapes.
+    class JsonNumbers {
+    public:
+        bool Parse(std::string_view text) {
+            _text = text;
+            _pos = 0;
+            _numbers.clear();
+            return ParseValue("") && (SkipSpace(), _pos == _text.size());
+        }
+
+        [[nodiscard]] const std::map<std::string, double>& Get() const noexcept { return _numbers; }
+
+    private:
+        void SkipSpace() {
+            while (_pos < _text.size() && std::string_view(" \t\r\n").find(_text[_pos]) != std::string_view::npos) {
+                _pos++;
+            }
+        }
+
+        bool ParseString(std::string& out) {
+            if (_pos >= _text.size() || _text[_pos] != '"') {
+                return false;
+            }
+            auto end = _text.find('"', _pos + 1);
+            if (end == std::string_view::npos) {
+                return false;
+            }
+            out = _text.substr(_pos + 1, end - _pos - 1);
+            _pos = end + 1;
+            return true;
+        }
+
+        bool ParseValue(const std::string& path) {
+            SkipSpace();
+            if (_pos >= _text.size()) {
+                return false;
+            }
+            if (_text[_pos] == '"') {
+                std::string ignored;
+                return ParseString(ignored);
+            }
+            if (_text[_pos] != '{') {
+                std::string number(_text.substr(_pos, _text.find_first_of(",} \t\r\n", _pos) - _pos));
+                char* end = nullptr;
+                auto value = std::strtod(number.c_str(), &end);
+                if (number.empty() || end != number.c_str() + number.size()) {
+                    return false;
+                }
+                _numbers[path] = value;
+                _pos += number.size();
+                return true;
+            }
+            _pos++;
+            SkipSpace();
+            if (_pos < _text.size() && _text[_pos] == '}') {
+                _pos++;
+                return true;
+            }
+            while (true) {
+                std::string key;
+                SkipSpace();
+                if (!ParseString(key)) {
+                    return false;
+                }
+                SkipSpace();
+                if (_pos >= _text.size() || _text[_pos++] != ':' ||
+                    !ParseValue(path.empty() ? key : path + "." + key)) {
+                    return false;
+                }
+                SkipSpace();
+                if (_pos >= _text.size()) {
+                    return false;
+                }
+                if (_text[_pos] == '}') {
+                    _pos++;
+                    return true;
+                }
+                if (_text[_pos++] != ',') {
+                    return false;
+                }
+            }
+        }
+
+        std::string_view _text;
+        std::size_t _pos = 0;
+        std::map<std::string, double> _numbers;
+    };
+
+    // Stage and optimized figures past tolerance * baseline are regressions. The naive side only changes with the
+    // benchmark itself, process figures depend on the allocator. Small absolute differences are ignored so stages
+    // taking a fraction of a millisecond don't fail on timer noise.
+    std::size_t CompareBaseline(const std::map<std::string, double>& current,
+                                const std::map<std::string, double>& baseline, double timeTolerance,
+                                double memoryTolerance) {
+        constexpr double kTimeSlackMs = 0.5;
+        constexpr double kMemorySlack = 64;
+        std::size_t regressions = 0;
+        for (const auto& [path, base] : baseline) {
+            if (!path.starts_with("scales.") || path.find(".naive.") != std::string::npos) {
+                continue;
+            }
+            auto it = current.find(path);
+            if (it == current.end()) {
+                continue;
+            }
+            double limit;
+            if (path.ends_with(".ms")) {
+                limit = base * timeTolerance + kTimeSlackMs;
+            } else if (path.ends_with(".allocations") || path.ends_with(".allocatedBytes") ||
+                       path.ends_with(".peakHeapBytes")) {
+                limit = base * memoryTolerance + kMemorySlack;
+            } else {
+                continue;
+            }
+            if (it->second > limit) {
+                std::printf("regression: %s is %.3f, baseline %.3f\n", path.c_str(), it->second, base);
+                regressions++;
+            }
+        }
+        return regressions;
+    }
+
+    bool ReadFile(const std::filesystem::path& path, std::string& out) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            return false;
+        }
+        std::ostringstream buffer;
+        buffer << in.rdbuf();
+        out = buffer.str();
+        return true;
+    }
+}
+
+int main(int argc, char** argv) {
+    std::vector<SyntheticLoadOrder::Scale> scales;
+    std::uint64_t seed = 0x5EED;
+    // single threaded by default so timings compare across machines
+    unsigned threads = 1;
+    int repeat = 5;
+    std::filesystem::path jsonPath;
+    std::filesystem::path baselinePath;
+    double timeTolerance = 3.0;
+    double memoryTolerance = 2.0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "--seed" && i + 1 < argc) {
+            seed = std::strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 0));
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--json" && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (arg == "--baseline" && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (arg == "--time-tolerance" && i + 1 < argc) {
+            timeTolerance = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--memory-tolerance" && i + 1 < argc) {
+            memoryTolerance = std::strtod(argv[++i], nullptr);
+        } else if (arg == "all") {
+            scales = {SyntheticLoadOrder::kVanilla, SyntheticLoadOrder::kMods500, SyntheticLoadOrder::kStress};
+        } else if (auto scale = SyntheticLoadOrder::FindScale(arg)) {
+            scales.push_back(*scale);
+        } else {
+            std::fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+            std::fprintf(stderr,
+                         "Usage: %s [vanilla|mods500|stress|all]... [--seed N] [--threads N] [--repeat N] "
+                         "[--json FILE] [--baseline FILE] [--time-tolerance X] [--memory-tolerance X]\n",
+                         argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (scales.empty()) {
+        scales = {SyntheticLoadOrder::kVanilla, SyntheticLoadOrder::kMods500};
+    }
+
+    auto valid = true;
+    std::vector<ScaleResult> results;
+    for (const auto& scale : scales) {
+        results.push_back(Run(scale, seed, threads, repeat, valid));
+        Print(results.back());
+    }
+    std::printf("peak RSS: %.1f MiB\n", KiB(GetPeakRssBytes()) / 1024.0);
+
+    auto json = ToJson(results, seed, threads, repeat);
+    if (!jsonPath.empty()) {
+        std::ofstream out(jsonPath, std::ios::trunc);
+        if (!(out << json).flush()) {
+            std::fprintf(stderr, "Unable to write %s\n", jsonPath.string().c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!baselinePath.empty()) {
+        std::string baselineText;
+        JsonNumbers baseline;
+        JsonNumbers current;
+        if (!ReadFile(baselinePath, baselineText) || !baseline.Parse(baselineText) || !current.Parse(json)) {
+            std::fprintf(stderr, "Unable to read baseline %s\n", baselinePath.string().c_str());
+            return EXIT_FAILURE;
+        }
+        auto regressions = CompareBaseline(current.Get(), baseline.Get(), timeTolerance, memoryTolerance);
+        if (regressions) {
+            std::printf("%zu regressions against %s\n", regressions, baselinePath.string().c_str());
+            return EXIT_FAILURE;
+        }
+        std::printf("no regressions against %s\n", baselinePath.string().c_str());
+    }
+    return valid ? EXIT_SUCCESS : EXIT_FAILURE;
+}
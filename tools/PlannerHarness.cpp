@@ -0,0 +1,570 @@
+// Drives the recipe planner over synthetic load orders and reports per-stage timings.
+//
+// Usage: AlchemyPlannerHarness [vanilla|mods500|stress|all]... [--seed N] [--threads N] [--tiers N] [--cache FILE]
+//                              [--stats FILE] [--triples]
+//
+// Every run checks the incremental paths against full scans and builds, the exit code is non-zero if any differ.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "Planner/Metrics.h"
+#include "Planner/Parallel.h"
+#include "Planner/PlanCache.h"
+#include "Planner/Planner.h"
+#include "SyntheticLoadOrder.h"
+
+using namespace AlchemyPlanner;
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+    // self checks that found a difference, any of them fails the run
+    int failures = 0;
+
+    double ElapsedMs(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    // Order independent digest of the planned recipes, stays stable when only the planning strategy changes
+    std::uint64_t Digest(const LoadOrder& loadOrder, const Plan& plan) {
+        std::uint64_t digest = 0;
+        const auto& recipes = plan.recipes;
+        for (Index i = 0; i < recipes.Size(); i++) {
+            std::vector<std::uint64_t> ingredients{loadOrder.ingredients[recipes.ingr1[i]].formId,
+                                                   loadOrder.ingredients[recipes.ingr2[i]].formId};
+            if (recipes.ingr3[i] != kNoIndex) {
+                ingredients.push_back(loadOrder.ingredients[recipes.ingr3[i]].formId);
+            }
+            std::sort(ingredients.begin(), ingredients.end());
+            std::uint64_t h = 1469598103934665603ull;
+            auto potion = loadOrder.potions[GetRecipePotion(plan, i)].formId;
+            for (auto effect : plan.potionTiers.GetEffects(recipes.signature[i])) {
+                h = (h ^ effect) * 1099511628211ull;
+            }
+            h = (h ^ potion) * 1099511628211ull;
+            for (auto ingredient : ingredients) {
+                h = (h ^ ingredient) * 1099511628211ull;
+            }
+            h = (h ^ recipes.potionMinLevel[i]) * 1099511628211ull;
+            digest += h;
+        }
+        return digest;
+    }
+
+    // Learns effects on a few ingredients at a time like a player would and checks the tracker against a full scan
+    void RunKnowledge(const Plan& plan, std::size_t ingredientCount, std::uint64_t seed) {
+        std::vector<Index> all(plan.recipes.Size());
+        for (Index i = 0; i < all.size(); i++) {
+            all[i] = i;
+        }
+        std::vector<std::uint32_t> knownEffects(ingredientCount);
+        std::vector<Index> known;
+
+        auto start = Clock::now();
+        KnownRecipeTracker tracker;
+        tracker.Build(plan.recipes, ingredientCount);
+        tracker.Reset(plan.recipes, all, knownEffects, known);
+        auto buildMs = ElapsedMs(start);
+
+        double updateMs = 0;
+        double scanMs = 0;
+        constexpr int kRounds = 20;
+        for (int round = 0; round < kRounds; round++) {
+            // learn one effect on ~1% of the ingredients
+            for (std::size_t k = 0; k < std::max<std::size_t>(1, ingredientCount / 100); k++) {
+                seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+                knownEffects[(seed >> 33) % ingredientCount] |= 1u << ((seed >> 20) % 4);
+            }
+            start = Clock::now();
+            tracker.Update(plan.recipes, knownEffects, known);
+            updateMs += ElapsedMs(start);
+
+            start = Clock::now();
+            std::vector<Index> candidates = all;
+            std::vector<Index> scanned;
+            MoveKnownRecipes(plan.recipes, knownEffects, candidates, scanned);
+            scanMs += ElapsedMs(start);
+            if (scanned.size() != known.size() || candidates.size() != tracker.GetPendingCount()) {
+                std::printf("  known recipe tracker differs from a full scan\n");
+                failures++;
+                return;
+            }
+        }
+        std::printf("  known recipes: %zu, tracker build: %.2f ms, update: %.3f ms, full scan: %.3f ms (per round)\n",
+                    known.size(), buildMs, updateMs / kRounds, scanMs / kRounds);
+    }
+
+    // Binds recipes to a fixed pool of forms the way the inventory pool mode does on workbench enter, for a player
+    // carrying a few dozen ingredients, and checks the selection against a full scan
+    void RunPool(const Plan& plan, std::size_t ingredientCount, std::uint64_t seed) {
+        constexpr std::size_t kPoolSize = 256;
+        constexpr std::size_t kCarried = 60;
+        KnownRecipeTracker tracker;
+        tracker.Build(plan.recipes, ingredientCount);
+
+        std::vector<std::uint8_t> held(ingredientCount);
+        std::vector<Index> heldIngredients;
+        for (std::size_t k = 0; k < kCarried; k++) {
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            auto ingr = static_cast<Index>((seed >> 33) % ingredientCount);
+            if (!held[ingr]) {
+                held[ingr] = 1;
+                heldIngredients.push_back(ingr);
+            }
+        }
+        std::vector<std::uint8_t> allowed(plan.recipes.Size(), 1);
+
+        std::vector<Index> bound;
+        auto start = Clock::now();
+        auto skipped = SelectCraftableRecipes(plan.recipes, tracker.GetRecipesByIngredient(), heldIngredients, held,
+                                              allowed, kPoolSize, bound);
+        auto selectMs = ElapsedMs(start);
+
+        start = Clock::now();
+        std::size_t craftable = 0;
+        for (Index i = 0; i < plan.recipes.Size(); i++) {
+            auto third = plan.recipes.ingr3[i];
+            craftable +=
+                held[plan.recipes.ingr1[i]] && held[plan.recipes.ingr2[i]] && (third == kNoIndex || held[third]);
+        }
+        auto scanMs = ElapsedMs(start);
+        std::printf("  recipe pool: %zu of %zu craftable recipes bound to %zu forms in %.3f ms, full scan: %.3f ms\n",
+                    bound.size(), craftable, kPoolSize, selectMs, scanMs);
+        if (bound.size() + skipped != craftable) {
+            std::printf("  recipe pool selection differs from a full scan\n");
+            failures++;
+        }
+    }
+
+    // Saves the plan, reads it back and checks the result still has the same recipes
+    void RunCache(const LoadOrder& loadOrder, const Keywords& keywords, const RecipeRules& rules, const Plan& plan,
+                  const std::filesystem::path& path) {
+        auto start = Clock::now();
+        auto fingerprint = GetPlanFingerprint(loadOrder, keywords, rules, "harness");
+        auto fingerprintMs = ElapsedMs(start);
+
+        start = Clock::now();
+        auto saved = SavePlanCache(path, fingerprint, plan);
+        auto saveMs = ElapsedMs(start);
+
+        Plan loaded;
+        start = Clock::now();
+        auto hit = saved && LoadPlanCache(path, fingerprint, loadOrder, loaded);
+        auto loadMs = ElapsedMs(start);
+
+        std::printf("  plan cache: fingerprint %016llx in %.2f ms, save: %.2f ms, load: %.2f ms, %zu bytes\n",
+                    static_cast<unsigned long long>(fingerprint), fingerprintMs, saveMs, loadMs,
+                    saved ? static_cast<std::size_t>(std::filesystem::file_size(path)) : 0);
+        if (!hit) {
+            std::printf("  plan cache could not be %s\n", saved ? "loaded" : "saved");
+            failures++;
+        } else if (Digest(loadOrder, loaded) != Digest(loadOrder, plan) ||
+                   LoadPlanCache(path, fingerprint + 1, loadOrder, loaded)) {
+            std::printf("  plan cache round trip differs\n");
+            failures++;
+        }
+        // a plan for other records is rejected even if the fingerprint was faked
+        auto fewerPotions = loadOrder;
+        if (hit && !fewerPotions.potions.empty()) {
+            fewerPotions.potions.pop_back();
+            if (LoadPlanCache(path, fingerprint, fewerPotions, loaded)) {
+                std::printf("  plan cache accepted a plan for other records\n");
+                failures++;
+            }
+        }
+    }
+
+    // Per perk state outputs must match evaluating every recipe on its own, for every quality perk combination and
+    // every highest unlocked level. Large tables are sampled.
+    void CheckOutputs(const Plan& plan) {
+        const auto step = std::max<std::size_t>(1, plan.recipes.Size() / 100'000);
+        for (int maxLevel = 1; maxLevel <= plan.potionTiers.GetTierCount(); maxLevel++) {
+            for (std::uint8_t flags = 0; flags < 16; flags++) {
+                PerkSnapshot perks;
+                for (int level = 2; level <= maxLevel; level++) {
+                    perks.UnlockLevel(level);
+                }
+                for (auto flag : {PerkSnapshot::kPotionQuality, PerkSnapshot::kPoisonQuality, PerkSnapshot::kAllQuality,
+                                  PerkSnapshot::kDoubleItems}) {
+                    if (flags & flag) {
+                        perks.Set(flag);
+                    }
+                }
+                RecipeOutputs outputs(perks, plan.potionTiers.GetTierCount());
+                for (Index i = 0; i < plan.recipes.Size(); i += static_cast<Index>(step)) {
+                    auto outcome = EvaluateRecipe(plan, i, perks);
+                    auto potion = outcome.upgradedPotion;
+                    if (potion == kNoIndex) {
+                        potion = GetRecipePotion(plan, i);
+                    }
+                    if (outputs.IsUnlocked(plan.recipes, i) != outcome.unlocked ||
+                        (outcome.unlocked && (outputs.GetPotion(plan, i) != potion ||
+                                              outputs.GetCount(plan.recipes, i) != (outcome.doubleItems ? 2 : 1)))) {
+                        std::printf("  recipe %u output differs from evaluating it on its own\n", i);
+                        failures++;
+                        return;
+                    }
+                }
+            }
+        }
+    }
+
+    // Every upgrade target must be the requested level or the closest lower one that has a potion
+    void CheckFallbacks(const PotionTierTable& tiers) {
+        for (Index signature = 0; signature < tiers.SignatureCount(); signature++) {
+            for (int level = 1; level <= tiers.GetTierCount(); level++) {
+                auto expected = tiers.Get(signature, 1);
+                for (int lower = level; lower > 1; lower--) {
+                    if (tiers.Get(signature, lower) != kNoIndex) {
+                        expected = tiers.Get(signature, lower);
+                        break;
+                    }
+                }
+                if (tiers.Resolve(signature, level) != expected) {
+                    std::printf("  signature %u level %d resolves to the wrong potion\n", signature, level);
+                    failures++;
+                    return;
+                }
+            }
+        }
+    }
+
+    // Overlapping rarity lists must yield every unordered pair of distinct ingredients exactly once, checked against
+    // a brute force set over random lists that share part of their ingredients
+    void CheckOverlappingPairs(std::uint64_t seed) {
+        constexpr Index kIngredients = 48;
+        constexpr int kRounds = 16;
+        for (int round = 0; round < kRounds; round++) {
+            std::vector<Index> first;
+            std::vector<Index> second;
+            for (Index ingr = 0; ingr < kIngredients; ingr++) {
+                seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+                auto side = (seed >> 33) % 4;
+                if (side == 0 || side == 2) {
+                    first.push_back(ingr);
+                }
+                if (side == 1 || side == 2) {
+                    second.push_back(ingr);
+                }
+            }
+            std::unordered_set<std::uint64_t> expected;
+            for (auto a : first) {
+                for (auto b : second) {
+                    if (a != b) {
+                        expected.insert(MakePairKey(a, b));
+                    }
+                }
+            }
+            std::unordered_set<std::uint64_t> seen;
+            std::unordered_set<std::uint64_t> emitted;
+            std::size_t emits = 0;
+            EnumeratePairs(first, second, PairLists::kOverlapping, &seen,
+                           [&](std::size_t i, std::size_t k) {
+                               emits++;
+                               if (first[i] != second[k]) {
+                                   emitted.insert(MakePairKey(first[i], second[k]));
+                               }
+                           });
+            if (emits != expected.size() || emitted != expected) {
+                std::printf("  overlapping pair enumeration differs from a brute force set\n");
+                failures++;
+                return;
+            }
+        }
+    }
+
+    // Replans level 3 the way a config reload does, once with the same rules and once with a changed rule, and
+    // compares the result against a full plan
+    void RunReplan(const LoadOrder& loadOrder, const Keywords& keywords, const RecipeRules& rules, const Plan& plan,
+                   unsigned threads) {
+        constexpr std::uint32_t kLevel3 = 1u << 2;
+        Plan replanned = plan;
+        auto start = Clock::now();
+        auto previousRows = ReplanLevels(loadOrder, rules, replanned, kLevel3, threads);
+        auto sameMs = ElapsedMs(start);
+        auto kept = static_cast<std::size_t>(
+            std::count_if(previousRows.begin(), previousRows.end(), [](Index row) { return row != kNoIndex; }));
+        if (Digest(loadOrder, replanned) != Digest(loadOrder, plan)) {
+            std::printf("  replan with unchanged rules differs from the full plan\n");
+            failures++;
+        }
+        for (Index i = 0; i < kept; i++) {
+            auto row = previousRows[i];
+            if (replanned.recipes.ingr1[i] != plan.recipes.ingr1[row] ||
+                replanned.recipes.ingr2[i] != plan.recipes.ingr2[row] ||
+                replanned.recipes.ingr3[i] != plan.recipes.ingr3[row] ||
+                replanned.recipes.signature[i] != plan.recipes.signature[row]) {
+                std::printf("  replanned row %u doesn't match its previous row %u\n", i, row);
+                failures++;
+                break;
+            }
+        }
+
+        auto changedRules = rules;
+        if (changedRules.levels.size() >= 3) {
+            changedRules.levels[2].pop_back();
+        }
+        start = Clock::now();
+        auto changedRows = ReplanLevels(loadOrder, changedRules, replanned, kLevel3, threads);
+        auto changedMs = ElapsedMs(start);
+        auto full = BuildPlan(loadOrder, keywords, changedRules, threads);
+        if (Digest(loadOrder, replanned) != Digest(loadOrder, full)) {
+            std::printf("  replan with changed rules differs from the full plan\n");
+            failures++;
+        }
+        auto created = static_cast<std::size_t>(std::count(changedRows.begin(), changedRows.end(), kNoIndex));
+        std::printf("  replan level3: %.2f ms keeping %zu of %zu recipes, changed rule: %.2f ms creating %zu\n",
+                    sameMs, kept, previousRows.size(), changedMs, created);
+    }
+
+    // Plans from keywords predicted with a few mistakes the way the plugin does before KID finishes, reconciles the
+    // plan against the actual keywords and compares it against a full plan. Mistakes are rarities an ingredient
+    // misses, potions a level off and, in the last round, a potion line missing entirely. The third round starts from a
+    // plan without planning scratch like one loaded from the plan cache.
+    void RunReconcile(const LoadOrder& loadOrder, const Keywords& keywords, const RecipeRules& rules, const Plan& plan,
+                      unsigned threads, std::uint64_t seed) {
+        auto next = [&seed]() {
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            return seed >> 33;
+        };
+        auto isRarity = [&](FormID keyword) {
+            return std::ranges::any_of(keywords.rarities, [&](const auto& entry) { return entry.first == keyword; });
+        };
+        auto isLevel = [&](FormID keyword) {
+            return std::find(keywords.levels.begin(), keywords.levels.end(), keyword) != keywords.levels.end();
+        };
+        const auto tierCount = keywords.GetTierCount();
+
+        for (int round = 0; round < 4; round++) {
+            auto predicted = loadOrder;
+            if (round > 0) {
+                for (std::size_t k = 0; k < std::max<std::size_t>(1, predicted.ingredients.size() / 50); k++) {
+                    std::erase_if(predicted.ingredients[next() % predicted.ingredients.size()].keywords, isRarity);
+                }
+                for (std::size_t k = 0; k < std::max<std::size_t>(1, predicted.potions.size() / 100); k++) {
+                    for (auto& keyword : predicted.potions[next() % predicted.potions.size()].keywords) {
+                        if (isLevel(keyword)) {
+                            keyword = keywords.levels[next() % static_cast<std::size_t>(tierCount)];
+                        }
+                    }
+                }
+            }
+            if (round > 2 && plan.potionTiers.SignatureCount() > 0) {
+                auto signature = static_cast<Index>(next() % plan.potionTiers.SignatureCount());
+                for (int level = 1; level <= tierCount; level++) {
+                    if (auto potion = plan.potionTiers.Get(signature, level); potion != kNoIndex) {
+                        std::erase_if(predicted.potions[potion].keywords, isLevel);
+                    }
+                }
+            }
+
+            auto reconciled = BuildPlan(predicted, keywords, rules, threads);
+            if (round == 2) {
+                ReleasePlanningScratch(reconciled);
+            }
+            auto start = Clock::now();
+            auto result = ReconcilePlan(loadOrder, keywords, rules, reconciled, threads);
+            auto reconcileMs = ElapsedMs(start);
+            std::printf("  reconcile: %.2f ms for %zu ingredients and %zu potions, "
+                        "replanned %zu of %zu potion lines%s\n",
+                        reconcileMs, result.ingredients, result.potions, result.signatures,
+                        plan.potionTiers.SignatureCount(), result.rebuilt ? " (rebuilt)" : "");
+            if (Digest(loadOrder, reconciled) != Digest(loadOrder, plan) ||
+                reconciled.ingredientRarity != plan.ingredientRarity || reconciled.potionLevel != plan.potionLevel) {
+                std::printf("  reconciled plan differs from the full plan\n");
+                failures++;
+            } else if (round == 0 && (result.ingredients || result.potions || result.signatures ||
+                                      reconciled.recipes.ingr1 != plan.recipes.ingr1)) {
+                std::printf("  reconcile changed a plan that was already right\n");
+            }
+        }
+    }
+
+    // Effect slots resolved at plan time must hold only signature effects, a pair ingredient all of them and the
+    // ingredients of a triple every one at least twice
+    void CheckSlots(const LoadOrder& loadOrder, const Plan& plan) {
+        const auto& recipes = plan.recipes;
+        for (Index i = 0; i < recipes.Size(); i++) {
+            auto signature = plan.potionTiers.GetEffects(recipes.signature[i]);
+            std::vector<std::size_t> coverage(signature.size());
+            auto matches = [&](Index ingredient, std::uint8_t slots) {
+                const auto& effects = loadOrder.ingredients[ingredient].effects;
+                std::vector<FormID> slotted;
+                for (std::size_t slot = 0; slot < effects.size() && slot < kMaxEffectSlots; slot++) {
+                    if ((slots >> slot) & 1) {
+                        slotted.push_back(effects[slot]);
+                    }
+                }
+                std::sort(slotted.begin(), slotted.end());
+                for (auto effect : slotted) {
+                    auto it = std::lower_bound(signature.begin(), signature.end(), effect);
+                    if (it == signature.end() || *it != effect) {
+                        return false;
+                    }
+                    coverage[static_cast<std::size_t>(it - signature.begin())]++;
+                }
+                return recipes.ingr3[i] != kNoIndex || std::ranges::equal(slotted, signature);
+            };
+            auto valid = matches(recipes.ingr1[i], recipes.slots1[i]) && matches(recipes.ingr2[i], recipes.slots2[i]);
+            if (valid && recipes.ingr3[i] != kNoIndex) {
+                valid = matches(recipes.ingr3[i], recipes.slots3[i]) && recipes.slots1[i] && recipes.slots2[i] &&
+                        recipes.slots3[i] && std::ranges::all_of(coverage, [](std::size_t n) { return n >= 2; });
+            }
+            if (!valid) {
+                std::printf("  recipe %u has a wrong effect slot\n", i);
+                failures++;
+                break;
+            }
+        }
+    }
+
+    void Run(const SyntheticLoadOrder::Scale& scale, std::uint64_t seed, unsigned threads, int tierCount,
+             bool triples, const std::filesystem::path& cachePath) {
+        auto start = Clock::now();
+        auto loadOrder = SyntheticLoadOrder::Generate(scale, seed, tierCount);
+        auto generateMs = ElapsedMs(start);
+
+        auto keywords = SyntheticLoadOrder::GetKeywords(tierCount);
+        auto rules = SyntheticLoadOrder::GetDefaultRules(tierCount);
+        if (triples) {
+            SyntheticLoadOrder::AddTripleRules(rules);
+        }
+        Plan plan;
+
+        start = Clock::now();
+        ClassifyIngredients(loadOrder, keywords, plan);
+        auto ingredientsMs = ElapsedMs(start);
+
+        start = Clock::now();
+        ClassifyPotions(loadOrder, keywords, plan);
+        auto potionsMs = ElapsedMs(start);
+
+        start = Clock::now();
+        PlanRecipes(loadOrder, rules, plan, threads);
+        auto recipesMs = ElapsedMs(start);
+
+        // whole graph as the plugin runs it
+        start = Clock::now();
+        auto built = BuildPlan(loadOrder, keywords, rules, threads);
+        auto buildMs = ElapsedMs(start);
+
+        std::size_t multiEffect = 0;
+        RecipeProjection planned;
+        planned.pairs.resize(plan.projection.pairs.size());
+        planned.triples.resize(plan.projection.triples.size());
+        for (Index i = 0; i < plan.recipes.Size(); i++) {
+            multiEffect += plan.potionTiers.GetEffects(plan.recipes.signature[i]).size() > 1;
+            auto& counts = plan.recipes.ingr3[i] != kNoIndex ? planned.triples : planned.pairs;
+            counts[plan.recipes.targetIngredientLevel[i] - 1]++;
+        }
+        std::size_t tripleCount = 0;
+        for (auto count : planned.triples) {
+            tripleCount += count;
+        }
+        std::printf("[%.*s] ingredients: %zu, alchemy items: %zu, effect signatures: %zu, levels: %d, "
+                    "recipes: %zu (%zu multi-effect, %zu triples)\n",
+                    static_cast<int>(scale.name.size()), scale.name.data(), loadOrder.ingredients.size(),
+                    loadOrder.potions.size(), plan.potionTiers.SignatureCount(), plan.potionTiers.GetTierCount(),
+                    plan.recipes.Size(), multiEffect, tripleCount);
+        if (triples) {
+            std::printf("  recipes by level (pairs/triples):");
+            for (std::size_t level = 0; level < planned.pairs.size(); level++) {
+                std::printf(" %zu/%zu", planned.pairs[level], planned.triples[level]);
+            }
+            std::printf("\n");
+        }
+        if (planned.pairs != plan.projection.pairs || planned.triples != plan.projection.triples ||
+            ProjectRecipes(loadOrder, rules, plan).triples != planned.triples) {
+            std::printf("  recipe projection differs from the planned recipes\n");
+            failures++;
+        }
+        std::printf("  generate: %.2f ms, classify ingredients: %.2f ms, classify potions: %.2f ms, "
+                    "plan recipes: %.2f ms\n",
+                    generateMs, ingredientsMs, potionsMs, recipesMs);
+        std::printf("  build plan (%u threads): %.2f ms\n", ResolveThreadCount(threads), buildMs);
+        std::printf("  digest: %016llx\n", static_cast<unsigned long long>(Digest(loadOrder, plan)));
+        if (Digest(loadOrder, built) != Digest(loadOrder, plan) || built.recipes.signature != plan.recipes.signature ||
+            built.recipes.ingr1 != plan.recipes.ingr1 || built.recipes.ingr2 != plan.recipes.ingr2 ||
+            built.recipes.ingr3 != plan.recipes.ingr3) {
+            std::printf("  build plan result differs from the staged run\n");
+            failures++;
+        }
+        CheckSlots(loadOrder, plan);
+        CheckFallbacks(plan.potionTiers);
+        CheckOutputs(plan);
+        CheckOverlappingPairs(seed);
+        RunKnowledge(plan, loadOrder.ingredients.size(), seed);
+        RunPool(plan, loadOrder.ingredients.size(), seed);
+        RunReplan(loadOrder, keywords, rules, plan, threads);
+        RunReconcile(loadOrder, keywords, rules, plan, threads, seed);
+        if (!cachePath.empty()) {
+            RunCache(loadOrder, keywords, rules, plan, cachePath);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    std::vector<SyntheticLoadOrder::Scale> scales;
+    std::uint64_t seed = 0x5EED;
+    unsigned threads = 0;
+    int tierCount = kDefaultTierCount;
+    std::filesystem::path cachePath;
+    std::filesystem::path statsPath;
+    bool triples = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "--seed" && i + 1 < argc) {
+            seed = std::strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 0));
+        } else if (arg == "--tiers" && i + 1 < argc) {
+            tierCount = std::clamp(std::atoi(argv[++i]), 1, kMaxTiers);
+        } else if (arg == "--cache" && i + 1 < argc) {
+            cachePath = argv[++i];
+        } else if (arg == "--stats" && i + 1 < argc) {
+            statsPath = argv[++i];
+        } else if (arg == "--triples") {
+            triples = true;
+        } else if (arg == "all") {
+            scales = {SyntheticLoadOrder::kVanilla, SyntheticLoadOrder::kMods500, SyntheticLoadOrder::kStress};
+        } else if (auto scale = SyntheticLoadOrder::FindScale(arg)) {
+            scales.push_back(*scale);
+        } else {
+            std::fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+            std::fprintf(stderr,
+                         "Usage: %s [vanilla|mods500|stress|all]... [--seed N] [--threads N] [--tiers N] "
+                         "[--cache FILE] [--stats FILE] [--triples]\n",
+                         argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (scales.empty()) {
+        scales = {SyntheticLoadOrder::kVanilla, SyntheticLoadOrder::kMods500};
+    }
+
+    for (const auto& scale : scales) {
+        Run(scale, seed, threads, tierCount, triples, cachePath);
+    }
+
+    // planner metrics accumulate over every scale that ran
+    if (!statsPath.empty()) {
+        Metrics::GetSingleton().ForEachSummaryLine([](const std::string& line) { std::printf("%s\n", line.c_str()); });
+        if (!Metrics::GetSingleton().WriteJson(statsPath)) {
+            std::fprintf(stderr, "Unable to write %s\n", statsPath.string().c_str());
+            return EXIT_FAILURE;
+        }
+    }
+    if (failures) {
+        std::fprintf(stderr, "%d self checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
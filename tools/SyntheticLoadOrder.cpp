@@ -0,0 +1,213 @@
+#include "SyntheticLoadOrder.h"
+
+#include <algorithm>
+#include <array>
+#include <string>
+
+using namespace AlchemyPlanner;
+
+namespace SyntheticLoadOrder {
+    namespace {
+        // AlchemyReworked.esp loaded at index 0x0A
+        constexpr FormID kKeywordBase = 0x0A000800;
+        constexpr FormID kEffectBase = 0x00100000;
+        constexpr FormID kMiscKeywordBase = 0x00010000;
+        constexpr std::uint32_t kMiscKeywordCount = 64;
+        // records per synthetic plugin, used to spread FormIDs over load order indices
+        constexpr std::uint32_t kRecordsPerPlugin = 1000;
+        // rarity tiers of the default config
+        constexpr Rarity kCommon = 0;
+        constexpr Rarity kUncommon = 1;
+        constexpr Rarity kRare = 2;
+        constexpr std::size_t kRarityCount = 3;
+
+        // splitmix64, stable across standard libraries unlike <random> distributions
+        class Rng {
+        public:
+            explicit Rng(std::uint64_t seed) : _state(seed) {}
+
+            std::uint64_t Next() noexcept {
+                auto z = (_state += 0x9E3779B97F4A7C15ull);
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+                return z ^ (z >> 31);
+            }
+
+            std::uint32_t Below(std::uint32_t bound) noexcept { return static_cast<std::uint32_t>(Next() % bound); }
+
+            bool Chance(std::uint32_t percent) noexcept { return Below(100) < percent; }
+
+        private:
+            std::uint64_t _state;
+        };
+
+        FormID MakeFormID(std::uint32_t index, std::uint32_t firstPlugin) {
+            auto plugin = firstPlugin + index / kRecordsPerPlugin;
+            return (plugin << 24) | (0x800 + index % kRecordsPerPlugin);
+        }
+
+        std::string MakeName(std::string_view prefix, std::uint32_t index) {
+            auto number = std::to_string(index);
+            return std::string(prefix) + " " + std::string(5 - std::min<std::size_t>(number.size(), 5), '0') + number;
+        }
+
+        void AddMiscKeywords(Rng& rng, std::vector<FormID>& keywords) {
+            auto count = rng.Below(3);
+            for (std::uint32_t i = 0; i < count; i++) {
+                keywords.push_back(kMiscKeywordBase + rng.Below(kMiscKeywordCount));
+            }
+        }
+
+        // skewed towards low effect ids so that some effects are much more common than others like in the game
+        FormID PickEffect(Rng& rng, std::uint32_t effects) {
+            return kEffectBase + std::min(rng.Below(effects), rng.Below(effects));
+        }
+    }
+
+    std::optional<Scale> FindScale(std::string_view name) noexcept {
+        for (const auto& scale : {kVanilla, kMods500, kStress}) {
+            if (scale.name == name) {
+                return scale;
+            }
+        }
+        return std::nullopt;
+    }
+
+    Keywords GetKeywords(int tierCount) {
+        Keywords keywords;
+        keywords.craftable = kKeywordBase;
+        for (int level = 1; level <= tierCount; level++) {
+            keywords.levels.push_back(kKeywordBase + (level <= kDefaultTierCount ? level : level + kRarityCount));
+        }
+        for (std::size_t rarity = 0; rarity < kRarityCount; rarity++) {
+            keywords.rarities.emplace_back(kKeywordBase + 6 + static_cast<FormID>(rarity), static_cast<Rarity>(rarity));
+        }
+        // ingredients without a rarity keyword are uncommon
+        keywords.defaultRarity = kUncommon;
+        keywords.rarityCount = kRarityCount;
+        return keywords;
+    }
+
+    RecipeRules GetDefaultRules(int tierCount) {
+        RecipeRules rules;
+        rules.levels = {{{kCommon, kCommon}},
+                        {{kCommon, kUncommon}},
+                        {{kCommon, kRare}, {kUncommon, kUncommon}},
+                        {{kUncommon, kRare}},
+                        {{kRare, kRare}}};
+        rules.levels.resize(static_cast<std::size_t>(tierCount), {{kRare, kRare}});
+        return rules;
+    }
+
+    void AddTripleRules(RecipeRules& rules, std::size_t maxTriplesPerSignature) {
+        rules.tripleLevels = {{},
+                              {{kCommon, kCommon, kCommon}},
+                              {{kCommon, kCommon, kUncommon}},
+                              {{kCommon, kUncommon, kUncommon}, {kCommon, kCommon, kRare}},
+                              {{kUncommon, kUncommon, kRare}, {kCommon, kRare, kRare}}};
+        rules.tripleLevels.resize(rules.levels.size());
+        rules.maxTriplesPerSignature = maxTriplesPerSignature;
+    }
+
+    LoadOrder Generate(const Scale& scale, std::uint64_t seed, int tierCount) {
+        Rng rng(seed);
+        auto keywords = GetKeywords(tierCount);
+        LoadOrder loadOrder;
+
+        loadOrder.ingredients.reserve(scale.ingredients);
+        for (std::uint32_t i = 0; i < scale.ingredients; i++) {
+            IngredientRecord ingr;
+            ingr.formId = MakeFormID(i, 1);
+            ingr.name = MakeName("Ingredient", i);
+
+            AddMiscKeywords(rng, ingr.keywords);
+            auto roll = rng.Below(100);
+            if (roll < 40) {
+                ingr.keywords.push_back(keywords.rarities[kCommon].first);
+            } else if (roll < 75) {
+                ingr.keywords.push_back(keywords.rarities[kUncommon].first);
+            } else if (roll < 95) {
+                ingr.keywords.push_back(keywords.rarities[kRare].first);
+            }
+
+            while (ingr.effects.size() < 4) {
+                auto effect = PickEffect(rng, scale.effects);
+                if (std::find(ingr.effects.begin(), ingr.effects.end(), effect) == ingr.effects.end()) {
+                    ingr.effects.push_back(effect);
+                }
+            }
+            loadOrder.ingredients.push_back(std::move(ingr));
+        }
+
+        // ingredients carrying each effect, secondary effects of potion lines are taken from them
+        std::vector<std::vector<std::uint32_t>> ingredientsByEffect(scale.effects);
+        for (std::uint32_t i = 0; i < loadOrder.ingredients.size(); i++) {
+            for (auto effect : loadOrder.ingredients[i].effects) {
+                ingredientsByEffect[effect - kEffectBase].push_back(i);
+            }
+        }
+
+        std::uint32_t potionIndex = 0;
+        auto addPotion = [&](std::vector<FormID> effects, std::vector<FormID> potionKeywords, bool poison) {
+            PotionRecord potion;
+            potion.formId = MakeFormID(potionIndex, 0x80);
+            potion.name = MakeName(poison ? "Poison" : "Potion", potionIndex);
+            potion.keywords = std::move(potionKeywords);
+            AddMiscKeywords(rng, potion.keywords);
+            potion.effects = std::move(effects);
+            potion.poison = poison;
+            loadOrder.potions.push_back(std::move(potion));
+            potionIndex++;
+        };
+
+        for (std::uint32_t effect = 0; effect < scale.effects; effect++) {
+            if (!rng.Chance(scale.potionEffectsPercent)) {
+                continue;
+            }
+            auto poison = rng.Chance(30);
+            for (int level = 1; level <= tierCount; level++) {
+                if (!rng.Chance(level == 1 ? 90 : 85)) {
+                    continue;
+                }
+                addPotion({kEffectBase + effect}, {keywords.craftable, keywords.levels[level - 1]}, poison);
+                // same potion overridden by another mod
+                if (rng.Chance(5)) {
+                    addPotion({kEffectBase + effect}, {keywords.craftable, keywords.levels[level - 1]}, poison);
+                }
+            }
+            // craftable potion line with a secondary effect, the one ingredients carry most often next to the first
+            // so the line can actually be crafted. The random pick only keeps the draws of the other records stable.
+            if (rng.Chance(3)) {
+                auto secondary = PickEffect(rng, scale.effects);
+                std::vector<std::uint32_t> together(scale.effects);
+                std::uint32_t best = 0;
+                for (auto ingredient : ingredientsByEffect[effect]) {
+                    for (auto other : loadOrder.ingredients[ingredient].effects) {
+                        auto id = other - kEffectBase;
+                        if (id != effect && ++together[id] > best) {
+                            best = together[id];
+                            secondary = other;
+                        }
+                    }
+                }
+                addPotion({kEffectBase + effect, secondary},
+                          {keywords.craftable, keywords.levels[rng.Below(tierCount)]}, poison);
+            }
+            // craftable potion missing its level keyword
+            if (rng.Chance(2)) {
+                addPotion({kEffectBase + effect}, {keywords.craftable}, poison);
+            }
+        }
+
+        for (std::uint32_t i = 0; i < scale.otherAlchemyItems; i++) {
+            std::vector<FormID> effects;
+            auto count = 1 + rng.Below(3);
+            for (std::uint32_t k = 0; k < count; k++) {
+                effects.push_back(PickEffect(rng, scale.effects));
+            }
+            addPotion(std::move(effects), {}, false);
+        }
+
+        return loadOrder;
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+#include "Planner/Planner.h"
+
+// Deterministic generator of load orders shaped like real ones, used to drive the planner outside of the game.
+namespace SyntheticLoadOrder {
+    struct Scale {
+        std::string_view name;
+        std::uint32_t ingredients;
+        // distinct magic effects found on ingredients
+        std::uint32_t effects;
+        // fraction of effects in percent that have a craftable potion line
+        std::uint32_t potionEffectsPercent;
+        // non craftable alchemy items (food, drinks, quest potions)
+        std::uint32_t otherAlchemyItems;
+    };
+
+    inline constexpr Scale kVanilla{"vanilla", 110, 55, 90, 250};
+    inline constexpr Scale kMods500{"mods500", 1500, 300, 70, 4000};
+    inline constexpr Scale kStress{"stress", 50000, 4000, 50, 20000};
+
+    [[nodiscard]] std::optional<Scale> FindScale(std::string_view name) noexcept;
+
+    // Keywords used by the generated records, mirrors AlchemyReworked.esp 0x800-0x808. Levels past the fifth get
+    // keywords of their own after the rarity keywords.
+    [[nodiscard]] AlchemyPlanner::Keywords GetKeywords(int tierCount = AlchemyPlanner::kDefaultTierCount);
+
+    // Recipe rules shipped in the default AlchemyReworked.yaml, levels past the fifth are crafted from rare|rare
+    [[nodiscard]] AlchemyPlanner::RecipeRules GetDefaultRules(int tierCount = AlchemyPlanner::kDefaultTierCount);
+
+    // Three ingredient rules of the shipped AlchemyReworked.yaml (off there by default) for the first five levels
+    void AddTripleRules(AlchemyPlanner::RecipeRules& rules, std::size_t maxTriplesPerSignature = 50);
+
+    // Potion lines get one level keyword per tier, the default tier count generates the same records as before
+    // tiers were configurable
+    [[nodiscard]] AlchemyPlanner::LoadOrder Generate(const Scale& scale, std::uint64_t seed = 0x5EED,
+                                                     int tierCount = AlchemyPlanner::kDefaultTierCount);
+}